@@ -38,6 +38,18 @@
 #include "MultiplexedSocket.hpp"
 #include "ASIOReadBuffer.hpp"
 namespace Sirikata { namespace Network {
+namespace {
+///Lets a receiver swap a packet that was read into its own Chunk out of the read buffer
+class ChunkReceivedBuffer:public Stream::ReceivedBuffer {
+    Chunk&mChunk;
+public:
+    explicit ChunkReceivedBuffer(Chunk&chunk):mChunk(chunk){}
+    virtual void take(Chunk&chunk) {
+        chunk.swap(mChunk);
+        mChunk.resize(0);
+    }
+};
+}
 void MakeASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket) {
     new ASIOReadBuffer(parentSocket,whichSocket);
 }
@@ -45,8 +57,8 @@ void ASIOReadBuffer::processError(MultiplexedSocket*parentSocket, const boost::s
     parentSocket->hostDisconnectedCallback(mWhichBuffer,error);
     delete this;
 }
-void ASIOReadBuffer::processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket, unsigned int whichSocket, const Stream::StreamID&id, const Chunk&newChunk){
-    parentSocket->receiveFullChunk(whichSocket,id,newChunk);
+void ASIOReadBuffer::processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket, unsigned int whichSocket, const Stream::StreamID&id, MemoryReference newChunk, Stream::ReceivedBuffer&buffer){
+    parentSocket->receiveFullChunk(whichSocket,id,newChunk,buffer);
 }
 
 
@@ -105,10 +117,15 @@ void ASIOReadBuffer::translateBuffer(const std::tr1::shared_ptr<MultiplexedSocke
                     return;
                 }
             }else {
-                uint32 chunkLength=packetLength.read();
-                Chunk resultChunk;
-                Stream::StreamID resultID=processPartialChunk(mBuffer+chunkPos+packetHeaderLength,packetLength.read(),chunkLength,resultChunk);
-                processFullChunk(thus,mWhichBuffer,resultID,resultChunk);
+                //hand the packet over where it lies in mBuffer: receivers that keep it copy it out themselves
+                uint8*packetStart=mBuffer+chunkPos+packetHeaderLength;
+                unsigned int streamIDLength=packetLength.read();
+                Stream::StreamID resultID;
+                resultID.unserialize(packetStart,streamIDLength);
+                assert(streamIDLength<=packetLength.read());
+                MemoryReference resultChunk(packetStart+streamIDLength,packetLength.read()-streamIDLength);
+                Stream::CopyReceivedBuffer resultBuffer(resultChunk);
+                processFullChunk(thus,mWhichBuffer,resultID,resultChunk,resultBuffer);
                 chunkPos+=packetHeaderLength+packetLength.read();
             }
         }
@@ -132,7 +149,8 @@ void ASIOReadBuffer::asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_r
         }else {
             if (mBufferPos>=mNewChunk.size()){
                 assert(mBufferPos==mNewChunk.size());
-                processFullChunk(thus,mWhichBuffer,mNewChunkID,mNewChunk);
+                ChunkReceivedBuffer newChunkBuffer(mNewChunk);
+                processFullChunk(thus,mWhichBuffer,mNewChunkID,MemoryReference(mNewChunk),newChunkBuffer);
                 mNewChunk.resize(0);
                 mBufferPos=0;
                 readIntoFixedBuffer(thus);
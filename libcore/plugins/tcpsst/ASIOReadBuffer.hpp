@@ -63,11 +63,14 @@ class ASIOReadBuffer {
      * \param whichSocket is the current ASIO socket responsible for having read the data. It must equal mWhichBuffer
      * \param sid is the StreamID that sent the data which made it to this socket and got processed. It will help determine which callback to call
      * \param newChunk is the chunk that was sent from the other side to this side and is ready for client processing (or server processing if sid==Stream::StreamID())
+     *        It points into the read buffer and is only valid during the call
+     * \param buffer lets the callee take ownership of the bytes
      */
     void processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,
                           unsigned int whichSocket,
                           const Stream::StreamID& sid,
-                          const Chunk&newChunk);
+                          MemoryReference newChunk,
+                          Stream::ReceivedBuffer&buffer);
     /**
      *  This function is called when either 0 information is known about the data to be read (such as size, etc)
      *  or if the data is known but the packet is sufficiently small that other packets may be conjoined with it in the buffer
@@ -92,7 +95,7 @@ class ASIOReadBuffer {
     Stream::StreamID processPartialChunk(uint8* dataBuffer, uint32 packetLength, uint32 &bufferReceived, Chunk&retval);
 
     /**
-     * Examines the class variable mBuffer from the beginning to mBufferPos and translates all packets contained within to chunks and calls the appropriate callback
+     * Examines the class variable mBuffer from the beginning to mBufferPos and hands every complete packet contained within to the appropriate callback in place
      * If the information in the last unprocessed chunk is less than sLowWaterMark that excess information is moved to the front of the buffer and readIntoFixedBuffer is called
      * If the information in the last unprocessed chunk is greater than the sLowWaterMark 
      * then a new chunk is made specifically for the remaining data using the processPartialChunk function and readIntoChunk is called
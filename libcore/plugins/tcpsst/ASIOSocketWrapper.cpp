@@ -37,6 +37,10 @@
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
+#if SIRIKATA_PLATFORM == PLATFORM_LINUX
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
 
 namespace Sirikata { namespace Network {
 
@@ -57,212 +61,191 @@ void copyHeader(void * destination, const UUID&key, unsigned int num) {
                 UUID::static_size);
 }
 
+PacketBuffer*ASIOSocketWrapper::idleMarker() {
+    //an address no PacketBuffer can have
+    static char sIdle;
+    return reinterpret_cast<PacketBuffer*>(&sIdle);
+}
+
+PacketBuffer*ASIOSocketWrapper::detachSendQueue(bool idleIfEmpty) {
+    for (;;) {
+        PacketBuffer*head=mSendQueue;
+        //only the sending thread detaches, and only it could have marked the queue idle
+        assert(head!=idleMarker());
+        PacketBuffer*replacement=(head==NULL&&idleIfEmpty)?idleMarker():NULL;
+        if (head==replacement)
+            return NULL;
+        if (compare_and_swap((volatile PacketBuffer*volatile*)&mSendQueue,(volatile PacketBuffer*)head,(volatile PacketBuffer*)replacement))
+            return head;
+    }
+}
+
+void ASIOSocketWrapper::appendInSendOrder(PacketBuffer*newestFirst, std::deque<PacketBuffer*>&toSend) {
+    size_t oldSize=toSend.size();
+    for (;newestFirst;newestFirst=newestFirst->mNextQueued) {
+        toSend.push_back(newestFirst);
+    }
+    std::reverse(toSend.begin()+oldSize,toSend.end());
+}
+
 void ASIOSocketWrapper::finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket) {
-    //When this function is called, the ASYNCHRONOUS_SEND_FLAG must be set because this particular context is the one finishing up a send
-    assert(mSendingStatus.read()&ASYNCHRONOUS_SEND_FLAG);
-    //Turn on the information that the queue is being checked and this means that further pushes to the queue may not be heeded if the queue happened to be empty
-    mSendingStatus+=QUEUE_CHECK_FLAG;
-    std::deque<Chunk*>toSend;
-    mSendQueue.swap(toSend);
-    std::size_t num_packets=toSend.size();
-    if (num_packets==0) {
-        //if there are no packets in the queue, some other send() operation will need to take the torch to send further packets
-        mSendingStatus-=(ASYNCHRONOUS_SEND_FLAG+QUEUE_CHECK_FLAG);
-    }else {
-        //there are packets in the queue, now is the chance to send them out, so get rid of the queue check flag since further items *will* be checked from the queue as soon as the
-        //send finishes
-        mSendingStatus-=QUEUE_CHECK_FLAG;
-        if (num_packets==1)
-            sendToWire(parentMultiSocket,toSend.front());
-        else
-            sendToWire(parentMultiSocket,toSend);
+    bool moreScheduled=hasUnscheduledPackets();
+    PacketBuffer*queued=detachSendQueue(!moreScheduled);
+    if (queued==NULL&&!moreScheduled) {
+        //the queue is idle: the next rawSend takes up sending
+        return;
     }
+    std::deque<PacketBuffer*>toSend;
+    appendInSendOrder(queued,toSend);
+    sendToWire(parentMultiSocket,toSend);
 }
-void ASIOSocketWrapper::sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",&*toSend->begin()+originalOffset,bytes_sent,error);
+void ASIOSocketWrapper::sendVectoredItems(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const ErrorCode &error, std::size_t bytes_sent) {
     if (error)  {
         triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
         SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
-    }else if (bytes_sent+originalOffset!=toSend->size()) {
-        sendToWire(parentMultiSocket,toSend,originalOffset+bytes_sent);
-    }else {
-        delete toSend;
+        return;
+    }
+    mQueuedBytes-=(uint32)bytes_sent;
+    //retire every packet that made it out completely
+    while (!mSending.empty()) {
+        PacketBuffer *front=mSending.front();
+        size_t remaining=front->size()-mSendingOffset;
+        if (bytes_sent<remaining) {
+            TCPSSTLOG(this,"snd",front->data()+mSendingOffset,bytes_sent,error);
+            mSendingOffset+=bytes_sent;
+            break;
+        }
+        TCPSSTLOG(this,"snd",front->data()+mSendingOffset,remaining,error);
+        bytes_sent-=remaining;
+        mSendingOffset=0;
+        front->release();
+        mSending.pop_front();
+    }
+    if (mSending.empty()) {
+        //no items to send, check the new queue for any more and send those, otherwise sleep
         finishAsyncSend(parentMultiSocket);
+    }else {
+        //a partial write, or more packets than fit in one buffer sequence
+        sendToWire(parentMultiSocket);
     }
 }
 
-void ASIOSocketWrapper::sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",&*const_toSend.front()->begin()+originalOffset,bytes_sent,error);
-    if (error )   {
-        triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
-        SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
-    } else if (bytes_sent+originalOffset!=const_toSend.front()->size()) {
-        sendToWire(parentMultiSocket,const_toSend,originalOffset+bytes_sent);
-    }else if (const_toSend.size()<2) {
-        //the entire packet got sent and there's no more items left: delete the front item
-        delete const_toSend.front();
-        //and send further items on the global queue if they are there
-        finishAsyncSend(parentMultiSocket);
-    }else {
-        std::deque<Chunk*> toSend=const_toSend;
-        //the first item got sent out
-        delete toSend.front();
-        toSend.pop_front();
-        if (toSend.size()==1) {
-            //if there's just one item left, it may be sent by itself
-            sendToWire(parentMultiSocket,toSend.front());
-        }else {
-            //otherwise send the whole queue
-            sendToWire(parentMultiSocket,toSend);
-        }
+bool ASIOSocketWrapper::hasUnscheduledPackets()const {
+    if (!mArrived.empty())
+        return true;
+    for (unsigned int i=0;i<NUM_PRIORITIES;++i) {
+        if (!mPrioritized[i].empty())
+            return true;
     }
+    return false;
 }
-#define ASIOSocketWrapperBuffer(pointer,size) boost::asio::buffer(pointer,(size))
-void ASIOSocketWrapper::sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",current_buffer,bytes_sent,error);
-    if (!error) {
-        //mPacketLogger.insert(mPacketLogger.end(),currentBuffer,currentBuffer+bytes_sent);
+
+PacketBuffer*ASIOSocketWrapper::nextByPriority() {
+    unsigned int i;
+    for (i=0;i<NUM_PRIORITIES&&mPrioritized[i].empty();++i) {
     }
-    if ( error ) {
-        triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
-        SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
-    }else if (bytes_sent!=bufferSize) {
-		 
-		 
-        //if the previous send was not able to push the whole buffer out to the network, the rest must be sent
-        mSocket->async_send(ASIOSocketWrapperBuffer(currentBuffer+bytes_sent,bufferSize-bytes_sent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                        this,
-                                        parentMultiSocket,
-                                        toSend,
-                                        currentBuffer+bytes_sent,
-                                        bufferSize-bytes_sent,
-                                        lastChunkOffset,
-                                          _1,
-                                          _2));        
-    }else {
-        if (!toSend.empty()) {
-            //if stray items are left in a deque
-            if (toSend.size()==1) {
-                //if there's one item send that
-                sendToWire(parentMultiSocket,toSend.front(),lastChunkOffset);
-            }else {
-                //otherwise send the whole lot
-                sendToWire(parentMultiSocket,toSend,lastChunkOffset);
-            }
-        }else {
-            //no items to send, check the new queue for any more and send those, otherwise sleep
-            finishAsyncSend(parentMultiSocket);
+    if (i==NUM_PRIORITIES)
+        return NULL;
+    for (;;) {
+        std::deque<PacketBuffer*>&queue=mPrioritized[mCurrentPriority];
+        if (queue.empty()) {
+            mDeficit[mCurrentPriority]=0;
+        }else if (queue.front()->size()<=mDeficit[mCurrentPriority]) {
+            PacketBuffer*retval=queue.front();
+            queue.pop_front();
+            mDeficit[mCurrentPriority]-=retval->size();
+            return retval;
         }
+        //the next lower priority's turn, wrapping around to the highest
+        mCurrentPriority=(mCurrentPriority==0?NUM_PRIORITIES:mCurrentPriority)-1;
+        mDeficit[mCurrentPriority]+=((size_t)PRIORITY_QUANTUM_BYTES)<<mCurrentPriority;
     }
 }
-    
 
-void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent) {
-    //sending a single chunk is a straightforward call directly to asio
-     
-     
-    mSocket->async_send(ASIOSocketWrapperBuffer(&*toSend->begin()+bytesSent,toSend->size()-bytesSent),
-                        std::tr1::bind(&ASIOSocketWrapper::sendLargeChunkItem,
-                                    this,
-                                    parentMultiSocket,
-                                    toSend,
-                                    bytesSent,
-                                          _1,
-                                          _2));
+void ASIOSocketWrapper::schedulePackets() {
+    assert(mSending.empty());
+    size_t batchBytes=0;
+    while (mSending.size()<MAX_SEND_BUFFERS&&batchBytes<SEND_BATCH_BYTES) {
+        //sort the packets that arrived before the next barrier by priority
+        while (!mArrived.empty()&&mArrived.front()->priority()<NUM_PRIORITIES) {
+            mPrioritized[mArrived.front()->priority()].push_back(mArrived.front());
+            mArrived.pop_front();
+        }
+        PacketBuffer*next=nextByPriority();
+        if (next==NULL) {
+            if (mArrived.empty())
+                break;
+            //a barrier: everything that arrived before it is already in mSending
+            next=mArrived.front();
+            mArrived.pop_front();
+        }
+        mSending.push_back(next);
+        batchBytes+=next->size();
+    }
 }
 
-void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent){
-     
-     
-    if (const_toSend.front()->size()-bytesSent>PACKET_BUFFER_SIZE||const_toSend.size()==1) {
-        //if there's but a single packet, or a single big packet that is bigger than the mBuffer's size...send that one by itself 
-        mSocket->async_send(ASIOSocketWrapperBuffer(&*const_toSend.front()->begin()+bytesSent,const_toSend.front()->size()-bytesSent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendLargeDequeItem,
-                                        this,
-                                        parentMultiSocket,
-                                        const_toSend,
-                                        bytesSent,
-                                          _1,
-                                          _2));
-    }else if (const_toSend.front()->size()){
-        //otherwise copy the packets onto the mBuffer and send from the fixed sized buffer
-        std::deque<Chunk*> toSend=const_toSend;
-        size_t bufferLocation=toSend.front()->size()-bytesSent;
-        std::memcpy(mBuffer,&*toSend.front()->begin()+bytesSent,toSend.front()->size()-bytesSent);
-        delete toSend.front();
-        toSend.pop_front();
-        bytesSent=0;
-        while (bufferLocation<PACKET_BUFFER_SIZE&&toSend.size()) {            
-            if (toSend.front()->size()>PACKET_BUFFER_SIZE-bufferLocation) {
-                //if the first packet is too large for the buffer, copy part of it but keep it around
-                bytesSent=PACKET_BUFFER_SIZE-bufferLocation;
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),bytesSent);
-                bufferLocation=PACKET_BUFFER_SIZE;
-            }else {
-                //if the entire packets fits in the buffer, copy it there and delete the packet
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),toSend.front()->size());
-                bufferLocation+=toSend.front()->size();
-                delete toSend.front();
-                toSend.pop_front();
-            }
+void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket) {
+    mSendBuffers.clear();
+    size_t offset=mSendingOffset;
+    std::deque<PacketBuffer*>::iterator kept=mSending.begin(),i=mSending.begin(),ie=mSending.end();
+    for (;i!=ie&&mSendBuffers.size()<MAX_SEND_BUFFERS;++i) {
+        PacketBuffer *chunk=*i;
+        if (offset==0&&chunk->superseded()) {
+            //a newer unreliable packet from the same stream is queued: this one need not go out
+            mQueuedBytes-=(uint32)chunk->size();
+            parentMultiSocket->countUnreliableDropped();
+            chunk->release();
+            continue;
         }
-        //send the buffer filled with possibly many packets
-        mSocket->async_send(ASIOSocketWrapperBuffer(mBuffer,bufferLocation),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                          this,
-                                          parentMultiSocket,
-                                          toSend,
-                                          mBuffer,
-                                          bufferLocation,
-                                          bytesSent,
-                                          _1,
-                                          _2));
+        *kept++=chunk;
+        if (chunk->size()>offset)
+            mSendBuffers.push_back(boost::asio::buffer(chunk->data()+offset,chunk->size()-offset));
+        offset=0;
+    }
+    if (kept!=i) {
+        mSending.erase(std::copy(i,ie,kept),mSending.end());
     }
+    if (mSending.empty()) {
+        finishAsyncSend(parentMultiSocket);
+        return;
+    }
+    mSocket->async_send(mSendBuffers,
+                        std::tr1::bind(&ASIOSocketWrapper::sendVectoredItems,
+                                       this,
+                                       parentMultiSocket,
+                                       _1,
+                                       _2));
 }
-#undef ASIOSocketWrapperBuffer
-void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, uint32 current_status) {
-    bool queue_check=(current_status&QUEUE_CHECK_FLAG)!=0;
-    bool sending_packet=(current_status&ASYNCHRONOUS_SEND_FLAG)!=0;
-    while (sending_packet==false||queue_check) {
-        if (sending_packet==false) {
-            //no one should check the queue without being willing to send
-            assert(queue_check==false);
-            //potentially volunteer to do the send
-            current_status=++mSendingStatus;
-            if (current_status==1) {//if this thread is the first into the system with nothing else having claimed the status
-                //then this thread should take the torch, check the queue and if not empty be willing to send
-                mSendingStatus+=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG-1);
-                std::deque<Chunk*>toSend;
-                mSendQueue.swap(toSend);
-                if (toSend.empty()) {//the chunk that we put on the queue must have been sent by someone else
-                    //nothing to send, let another thread take up the torch if something was placed there by it
-                    mSendingStatus-=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG);
-                    return;
-                }else {//the chunk may be on this queue, but we should promise folks to send it
-                    //we just set the asynchronous send flag, so it shouuld still be set
-                    assert(mSendingStatus.read()&ASYNCHRONOUS_SEND_FLAG);
-                    //turn off the queue check since we've got at least one packet to send off and will therefore come around again for further checks
-                    mSendingStatus-=QUEUE_CHECK_FLAG;
-                    if (toSend.size()==1) {
-                        //if there's just one packet to send: send that one
-                        sendToWire(parentMultiSocket,toSend.front());
-                    }else {
-                        //if there are more packets to send, send those
-                        sendToWire(parentMultiSocket,toSend);
-                    }
-                    return;
-                }
-            }else {
-                //it wasn't us doing the sending...see if those queue checks are still going on
-                --mSendingStatus;
-            }
-        }
-        //read the current status for another spin of the loop
-        current_status=mSendingStatus.read();
-        queue_check=(current_status&QUEUE_CHECK_FLAG)!=0;
-        sending_packet=(current_status&ASYNCHRONOUS_SEND_FLAG)!=0;
+
+void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, std::deque<PacketBuffer*>&toSend){
+    if (mArrived.empty()) {
+        mArrived.swap(toSend);
+    }else {
+        mArrived.insert(mArrived.end(),toSend.begin(),toSend.end());
+        toSend.clear();
+    }
+    mSendingOffset=0;
+    schedulePackets();
+    sendToWire(parentMultiSocket);
+}
+
+uint32 ASIOSocketWrapper::roundTripMicroseconds()const {
+#if SIRIKATA_PLATFORM == PLATFORM_LINUX
+    if (mSocket==NULL) {
+        return 0;
+    }
+#if BOOST_VERSION >= 104700
+    int fd=mSocket->native_handle();
+#else
+    int fd=mSocket->native();
+#endif
+    struct tcp_info info;
+    socklen_t infoLength=sizeof(info);
+    if (getsockopt(fd,IPPROTO_TCP,TCP_INFO,&info,&infoLength)==0) {
+        return info.tcpi_rtt;
     }
+#endif
+    return 0;
 }
 
 void ASIOSocketWrapper::shutdownAndClose() {
@@ -288,23 +271,22 @@ void ASIOSocketWrapper::destroySocket() {
 }
 
 
-void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk) {
-    TCPSSTLOG(this,"raw",&*chunk->begin(),chunk->size(),false);
-    uint32 current_status=++mSendingStatus;
-    if (current_status==1) {//we are teh chosen thread
-        mSendingStatus+=(ASYNCHRONOUS_SEND_FLAG-1);//committed to be the sender thread
-        sendToWire(parentMultiSocket, chunk);
-    }else {//if someone else is possibly sending a packet
-        //push the packet on the queue
-        mSendQueue.push(chunk);
-        current_status=--mSendingStatus;
-        //the packet is out of our hands now...
-        //but the other thread could just have been finishing up and we have missed the send
-        //this is our opportunity to take up the torch and send if our packet is still there
-        retryQueuedSend(parentMultiSocket,current_status);
+void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, PacketBuffer * chunk) {
+    TCPSSTLOG(this,"raw",chunk->data(),chunk->size(),false);
+    mQueuedBytes+=(uint32)chunk->size();
+    PacketBuffer*head;
+    do {
+        head=mSendQueue;
+        chunk->mNextQueued=(head==idleMarker()?NULL:head);
+    }while (!compare_and_swap((volatile PacketBuffer*volatile*)&mSendQueue,(volatile PacketBuffer*)head,(volatile PacketBuffer*)chunk));
+    if (head==idleMarker()) {
+        //no thread was sending: this one sends everything queued so far, starting with chunk
+        std::deque<PacketBuffer*>toSend;
+        appendInSendOrder(detachSendQueue(false),toSend);
+        sendToWire(parentMultiSocket,toSend);
     }
 }
-Chunk*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid){
+PacketBuffer*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid){
     const unsigned int max_size=16;
     uint8 dataStream[max_size+2*Stream::uint30::MAX_SERIALIZED_LENGTH];
     unsigned int size=max_size;
@@ -322,14 +304,14 @@ Chunk*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes
         unsigned int retval=streamSize.serialize(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,Stream::uint30::MAX_SERIALIZED_LENGTH);
         assert(retval==actualHeaderLength);
     }
-    return new Chunk(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,dataStream+size+cur);
+    return PacketBuffer::construct(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,actualHeaderLength+size+cur-Stream::uint30::MAX_SERIALIZED_LENGTH);
 }
 
 void ASIOSocketWrapper::sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections) {
     UUID return_value=UUID::random();
     
-    Chunk *headerData=new Chunk(TCPStream::TcpSstHeaderSize);
-    copyHeader(&*headerData->begin(),value,numConnections);
+    PacketBuffer *headerData=PacketBuffer::construct(TCPStream::TcpSstHeaderSize);
+    copyHeader(headerData->data(),value,numConnections);
     rawSend(parentMultiSocket,headerData);
 }
 
@@ -30,6 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/UUID.hpp"
+#include "PacketBuffer.hpp"
 
 namespace Sirikata { namespace Network {
 class ASIOSocketWrapper;
@@ -40,85 +41,112 @@ class ASIOSocketWrapper {
 
     TCPSocket*mSocket;
     /**
-     * The status of sending threads: odd number indicates asynchronous send... number >0  indicates other waiting threads number&ASYNCHRONOUS_SEND_FLAG indicates a thread is
-     * currently sending data off. number&QUEUE_CHECK_FLAG means queue is currently being swapped away and items added to the queue may not ever be processed if the queue is empty
-     * unless a thread takes up the torch and does it
+     * The packets handed to rawSend that the sending thread has not picked up yet, newest first, linked
+     * through PacketBuffer::mNextQueued. Any thread may push with a compare and swap; the sending thread
+     * takes the whole list at once. The value idleMarker() means the queue is empty and no thread is
+     * sending: whoever pushes onto it becomes the sending thread.
      */
-    AtomicValue<uint32> mSendingStatus;
-    /**
-     * The queue of packets to send while an active async_send is doing its job
-     */
-    ThreadSafeQueue<Chunk*>mSendQueue;
+    PacketBuffer*volatile mSendQueue;
 	enum {
-		ASYNCHRONOUS_SEND_FLAG=(1<<29),
-		QUEUE_CHECK_FLAG=(1<<30),
-		PACKET_BUFFER_SIZE=1400
+		/**
+		 * Most buffers handed to a single async_send. asio gathers at most 64
+		 * buffers into one writev call (IOV_MAX is often 1024 but asio's own
+		 * limit is lower); whatever does not fit goes out on the next send.
+		 */
+		MAX_SEND_BUFFERS=64,
+		/**
+		 * Most bytes of packets committed to a single send (beyond the first packet), so a
+		 * HighPriority packet never waits behind more than this much lower priority data.
+		 * The wire format cannot interleave the pieces of one packet, so a packet that has
+		 * started going out is always finished first.
+		 */
+		SEND_BATCH_BYTES=65536,
+		///bytes LowPriority packets may send per round; each higher priority gets twice the share of the one below
+		PRIORITY_QUANTUM_BYTES=2048,
+		NUM_PRIORITIES=HighPriority+1
 	};
-    uint8 mBuffer[PACKET_BUFFER_SIZE];
+    /**
+     * The packets owned by the send currently in progress, in wire order. Only the sending thread
+     * touches these members.
+     */
+    std::deque<PacketBuffer*> mSending;
+    ///how many bytes of mSending.front() already made it to the network
+    size_t mSendingOffset;
+    ///scratch space for the buffer sequence passed to async_send
+    std::vector<boost::asio::const_buffer> mSendBuffers;
+    ///bytes handed to rawSend that have not yet reached the network
+    AtomicValue<uint32> mQueuedBytes;
+    ///packets taken off mSendQueue that wait behind the PacketBuffer::ORDERING_BARRIER at their front
+    std::deque<PacketBuffer*> mArrived;
+    ///packets waiting for their turn to join mSending, by priority
+    std::deque<PacketBuffer*> mPrioritized[NUM_PRIORITIES];
+    ///bytes each priority may still send in the current round of the deficit round robin
+    size_t mDeficit[NUM_PRIORITIES];
+    ///the priority whose turn it is
+    unsigned int mCurrentPriority;
 
     typedef boost::system::error_code ErrorCode;
+    ///The value of mSendQueue while no thread is sending
+    static PacketBuffer*idleMarker();
     /**
-     * This function sets the QUEUE_CHECK_FLAG and checks the sendQueue for additional packets to send out.
-     * If nothing is in the queue then it unsets the ASYNCHRONOUS_SEND_FLAG and QUEUE_CHECK_FLAGS
-     * If something is present in the queue it calls sendToWire with the queue
+     * Takes every packet from mSendQueue, returning them newest first.
+     * If there are none and idleIfEmpty is set, marks the queue idle, which ends this thread's turn as the sender.
      */
-    void finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket);
-
+    PacketBuffer*detachSendQueue(bool idleIfEmpty);
+    ///Appends a list returned by detachSendQueue to toSend in the order rawSend received the packets
+    static void appendInSendOrder(PacketBuffer*newestFirst, std::deque<PacketBuffer*>&toSend);
     /**
-     * The callback for when a single Chunk was sent.
-     * If the whole Chunk was not sent then the rest of the Chunk is passed back to sendToWire
-     * If the whole Chunk was shipped off, the finishAsyncSend function is called
+     * Called by the sending thread once mSending is written out.
+     * Sends whatever was queued in the meantime or, if nothing is left, marks the queue idle.
      */
-    void sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
+    void finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket);
 
     /**
-     * The callback for when a single large Chunk at the front of a chunk deque was sent.
-     * If the whole large Chunk was not sent then the rest of the Chunk is passed back to sendToWire
-     * If the whole Chunk was shipped off, the sendToWire function is called with the rest of the queue unless it is empty in which case the finishAsyncSend is called
+     * The callback for when a vectored send finished.
+     * Packets that were entirely written are released and the offset into a partially written front packet is advanced.
+     * Whatever remains in mSending is sent again; once it is empty finishAsyncSend looks for further packets.
      */
-    void sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
+    void sendVectoredItems(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const ErrorCode &error, std::size_t bytes_sent);
 
+    ///whether packets wait in mArrived or mPrioritized
+    bool hasUnscheduledPackets()const;
     /**
-     * The callback for when a static buffer was shipped to the network.
-     * If the whole static buffer was not sent then the rest of the static buffer is passed back to async_send and the currentBuffer is offset by the necessary ammt to finish off
-     * sending it. This could be slightly inefficient if there are tons of other packets in the deque toSend but generally the buffer size should be chosen so that it can be sent
-     * in one go.
-     * If the whole buffer was shipped off, the sendToWire function is called with the rest of the queue unless it is empty
+     * Fills the empty mSending with up to MAX_SEND_BUFFERS packets or SEND_BATCH_BYTES bytes.
+     * Packets of different priorities share the batch by deficit round robin.
+     * A packet of each priority keeps its order relative to the others of that priority,
+     * and a barrier packet goes out only after everything that arrived before it.
      */
-    void sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent);
-
-/**
- * When there's a single packet to be sent to the network, mSocket->async_send is simply called upon the Chunk to be sent
- */
-    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent=0);
+    void schedulePackets();
+    ///Takes the next packet due by the deficit round robin among mPrioritized, or NULL if they are all empty
+    PacketBuffer*nextByPriority();
+    void initializeScheduler() {
+        for (unsigned int i=0;i<NUM_PRIORITIES;++i) {
+            mDeficit[i]=0;
+        }
+        mCurrentPriority=HighPriority;
+    }
 
 /**
- *  This function sends a while queue of packets to the network
- * The function first checks to see if the front packet is too large to fit in the packet-sized buffer.
- * If it's too large it sends the packet individually much like a chunk would be sent individually and it is left on the queue for data storage purposes
- * If the packet is not too large it and all subsequent packets that can fit are jammed into the packet sized mBuffer
- *  and then those packets are deleted from the queue and shipped to the network partial packets are left on the queue in that case
+ * Hands up to MAX_SEND_BUFFERS packets from mSending straight to async_send as one buffer sequence:
+ * the packets are neither copied nor sent with one system call apiece.
+ * Superseded packets that have not been partially written are dropped from mSending on the way.
  */
-    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent=0);
+    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket);
 
 /**
- * If another thread claimed to be sending data asynchronously
- * This function checks to see if the send is still proceeding after the queue push
- * This thread waits until all queue checks are done, then it sees if someone took up the torch of sending the data
- * If no data is being sent, this thread takes up the torch and sets the queue check flag and sees if data is on the queue
- * If no data is on the queue at this point, since it pushed its own data to the queue it assumes someone else successfully sent it off
- * If data is on the queue, it goes ahead and sends the data to the wire by using the appropriate overload of the sendToWire function
- * it then unsets the QUEUE_CHECK_FLAG and if data isn't being set also the ASYNCHRONOUS_SEND_FLAG
+ *  This function schedules a whole queue of packets for the network, taking ownership of the packets and leaving toSend empty
  */
-    void retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, uint32 current_status);
+    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, std::deque<PacketBuffer*>&toSend);
 
 public:
 
-    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendingStatus(0){
+    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendQueue(idleMarker()),mSendingOffset(0),mQueuedBytes(0){
+        initializeScheduler();
         //mPacketLogger.reserve(268435456);
     }
 
-    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendingStatus(0){
+    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendQueue(idleMarker()),mSendingOffset(0),mQueuedBytes(0){
+        initializeScheduler();
         //mPacketLogger.reserve(268435456);
     }
 
@@ -127,11 +155,18 @@ public:
         return *this;
     }
 
-    ASIOSocketWrapper() :mSocket(NULL),mSendingStatus(0){
+    ASIOSocketWrapper() :mSocket(NULL),mSendQueue(idleMarker()),mSendingOffset(0),mQueuedBytes(0){
+        initializeScheduler();
     }
 
     TCPSocket&getSocket() {return *mSocket;}
 
+    ///How many bytes are waiting to be written to this socket
+    uint32 getQueuedBytes()const {return mQueuedBytes.read();}
+
+    ///The kernel's smoothed round trip estimate for this socket, or 0 where the platform does not provide one
+    uint32 roundTripMicroseconds()const;
+
     const TCPSocket&getSocket()const {return *mSocket;}
 
     ///close this socket by disallowing sends, then closing
@@ -143,12 +178,13 @@ public:
     ///Destroys the lowlevel TCPSocket
     void destroySocket();
     /**
-     * Sends the exact bytes contained within the typedeffed vector
-     * \param chunk is the exact bytes to put on the network (including streamID and framing data)
+     * Sends the exact bytes contained within the packet buffer
+     * \param chunk is the exact bytes to put on the network (including streamID and framing data); this takes over the caller's reference
+     * The packet must not be queued on any other socket at the same time.
      */
-    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk);
+    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, PacketBuffer * chunk);
 
-    static Chunk*constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
+    static PacketBuffer*constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
     /**
      *  Sends a streamID #0 packet with further control data on it. 
      *  To start with only stream disconnect and the ack thereof are allowed
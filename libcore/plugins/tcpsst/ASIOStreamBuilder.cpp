@@ -37,6 +37,10 @@
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "TCPSetCallbacks.hpp"
+#include "network/IOServiceFactory.hpp"
+#if SIRIKATA_PLATFORM != PLATFORM_WINDOWS
+#include <unistd.h>
+#endif
 namespace Sirikata { namespace Network { namespace ASIOStreamBuilder{
 
 class IncompleteStreamState {
@@ -49,6 +53,74 @@ namespace {
 typedef std::map<UUID,IncompleteStreamState> IncompleteStreamMap;
 std::deque<UUID> sStaleUUIDs;
 IncompleteStreamMap sIncompleteStreams;
+
+/**
+ * Moves the sockets of one stream from ioService to streamService so that all their completions run there.
+ * Returns the service the sockets ended up on, or NULL if they were lost on the way.
+ * Before boost 1.66 there is no release(), so a duplicate of each descriptor is handed over instead.
+ * Windows keeps the sockets on ioService.
+ */
+IOService* moveSockets(std::vector<TCPSocket*>&sockets, IOService*ioService, IOService*streamService) {
+#if SIRIKATA_PLATFORM != PLATFORM_WINDOWS
+    std::vector<boost::asio::ip::tcp> protocols;
+    boost::system::error_code err;
+    for (size_t i=0;i<sockets.size();++i) {
+        protocols.push_back(sockets[i]->local_endpoint(err).protocol());
+        if (err) {
+            return ioService;
+        }
+    }
+    IOService*retval=streamService;
+    for (size_t i=0;i<sockets.size();++i) {
+        TCPSocket*moved=new TCPSocket(*streamService);
+#if BOOST_VERSION >= 106600
+        int fd=sockets[i]->release(err);
+#else
+        int fd=::dup(sockets[i]->native());
+        if (fd<0) {
+            err=boost::asio::error::no_descriptors;
+        } else {
+            boost::system::error_code closeErr;
+            sockets[i]->close(closeErr);
+        }
+#endif
+        if (!err) {
+            moved->assign(protocols[i],fd,err);
+            if (err) {
+                ::close(fd);
+            }
+        }
+        if (err) {
+            SILOG(tcpsst,error,"Cannot move accepted socket to its stream's service: "<<err.message());
+            retval=NULL;
+        }
+        delete sockets[i];
+        sockets[i]=moved;
+    }
+    return retval;
+#else
+    return ioService;
+#endif
+}
+
+///Sets up the stream once its sockets are on streamService; runs on streamService
+void startStream(const UUID&context,
+                 const std::vector<TCPSocket*>&sockets,
+                 IOService *streamService,
+                 const Stream::SubstreamCallback&callback) {
+    std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
+        MultiplexedSocket::construct<MultiplexedSocket>(streamService,context,sockets,callback));
+    MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+    Stream::StreamID newID=Stream::StreamID(1);
+    TCPStream * strm=new TCPStream(shared_socket,newID);
+
+    TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
+    callback(strm,setCallbackFunctor);
+    if (setCallbackFunctor.mCallbacks==NULL) {
+        SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
+        shared_socket->closeStream(shared_socket,newID);
+    }
+}
 }
 ///gets called when a complete 24 byte header is actually received: uses the UUID within to match up appropriate sockets
 void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
@@ -75,18 +147,22 @@ void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
         }else {
             where->second.mSockets.push_back(socket);
             if (numConnections==(unsigned int)where->second.mSockets.size()) {
-                std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
-                    MultiplexedSocket::construct<MultiplexedSocket>(ioService,context,where->second.mSockets,callback));
-                MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+                //the whole stream, sockets included, moves to the pool service its UUID hashes to, if any
+                std::vector<TCPSocket*> sockets;
+                sockets.swap(where->second.mSockets);
                 sIncompleteStreams.erase(where);
-                Stream::StreamID newID=Stream::StreamID(1);
-                TCPStream * strm=new TCPStream(shared_socket,newID);
-
-                TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
-                callback(strm,setCallbackFunctor);
-                if (setCallbackFunctor.mCallbacks==NULL) {
-                    SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
-                    shared_socket->closeStream(shared_socket,newID);
+                IOService *streamService=IOServiceFactory::affinityService(ioService,UUID::Hasher()(context));
+                if (streamService==ioService) {
+                    startStream(context,sockets,streamService,callback);
+                }else {
+                    streamService=moveSockets(sockets,ioService,streamService);
+                    if (streamService==NULL) {
+                        for (size_t i=0;i<sockets.size();++i) {
+                            delete sockets[i];
+                        }
+                    }else {
+                        streamService->post(std::tr1::bind(&startStream,context,sockets,streamService,callback));
+                    }
                 }
             }else{
                 sStaleUUIDs.push_back(context);
@@ -31,6 +31,7 @@
  */
 #include "util/Platform.hpp"
 #include "network/TCPDefinitions.hpp"
+#include "network/IOServiceFactory.hpp"
 #include "network/Stream.hpp"
 #include "TCPStream.hpp"
 #include "util/ThreadSafeQueue.hpp"
@@ -106,29 +107,108 @@ bool MultiplexedSocket::CommitCallbacks(std::deque<StreamIDCallbackPair> &regist
 }
 
 size_t MultiplexedSocket::leastBusyStream() {
-        ///FIXME look at bytes to be sent or recently used, etc
-        return rand()%mSockets.size();
- }
-float MultiplexedSocket::dropChance(const Chunk*data,size_t whichStream) {
-    return .25;
+    size_t retval=0;
+    uint32 leastQueued=mSockets[0].getQueuedBytes();
+    for (size_t i=1;i<mSockets.size()&&leastQueued;++i) {
+        uint32 queued=mSockets[i].getQueuedBytes();
+        if (queued<leastQueued) {
+            leastQueued=queued;
+            retval=i;
+        }
+    }
+    return retval;
+}
+bool MultiplexedSocket::admitUnreliable(const RawRequest&data,size_t whichStream) {
+    uint32 backlog=mSockets[whichStream].getQueuedBytes();
+    if (backlog<SUPERSEDE_UNRELIABLE_BACKLOG) {
+        return true;
+    }
+    if (backlog>=DROP_UNRELIABLE_BACKLOG) {
+        countUnreliableDropped();
+        return false;
+    }
+    boost::lock_guard<boost::mutex> unreliableLock(mUnreliableMutex);
+    PacketBuffer *&latest=mLatestUnreliable[data.originStream];
+    if (latest) {
+        latest->supersede();
+        latest->release();
+    }
+    latest=data.data->addRef();
+    return true;
+}
+void MultiplexedSocket::forgetUnreliable(const Stream::StreamID&id) {
+    boost::lock_guard<boost::mutex> unreliableLock(mUnreliableMutex);
+    UnreliablePacketMap::iterator where=mLatestUnreliable.find(id);
+    if (where!=mLatestUnreliable.end()) {
+        where->second->release();
+        mLatestUnreliable.erase(where);
+    }
 }
 
-void MultiplexedSocket::sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data) {
-    TCPSSTLOG(this,"sendnow",&*data.data->begin(),data.data->size(),false);
+StreamStats MultiplexedSocket::getStats()const {
+    StreamStats retval;
+    mConnectionCounters.read(retval);
+    retval.unreliableDropped=mUnreliableDropped.read();
+    uint32 roundTripTotal=0;
+    uint32 roundTripsKnown=0;
+    for (size_t i=0;i<mSockets.size();++i) {
+        retval.queuedBytes+=mSockets[i].getQueuedBytes();
+        uint32 roundTrip=mSockets[i].roundTripMicroseconds();
+        if (roundTrip) {
+            roundTripTotal+=roundTrip;
+            ++roundTripsKnown;
+        }
+    }
+    if (roundTripsKnown) {
+        retval.roundTripMicroseconds=roundTripTotal/roundTripsKnown;
+    }
+    return retval;
+}
+void MultiplexedSocket::startStatsLogging() {
+    Duration period=Stream::statsLogPeriod();
+    if (period>Duration::seconds(0.0)) {
+        IOServiceFactory::dispatchServiceMessage(mIO,period,std::tr1::bind(&MultiplexedSocket::logStatsPeriodically,getWeakPtr(),period));
+    }
+}
+void MultiplexedSocket::logStatsPeriodically(const std::tr1::weak_ptr<MultiplexedSocket>&weakThus,const Duration&period) {
+    std::tr1::shared_ptr<MultiplexedSocket> thus(weakThus.lock());
+    if (!thus||thus->mSocketConnectionPhase==DISCONNECTED) {
+        return;
+    }
+    StreamStats stats=thus->getStats();
+    SILOG(tcpsst,info,"Connection "<<&*thus<<" sent "<<stats.bytesSent<<" bytes in "<<stats.packetsSent<<" packets, received "
+          <<stats.bytesReceived<<" bytes in "<<stats.packetsReceived<<" packets, "<<stats.queuedBytes<<" bytes queued, "
+          <<stats.unreliableDropped<<" unreliable packets dropped, rtt "<<stats.roundTripMicroseconds<<"us");
+    for (CallbackMap::const_iterator i=thus->mCallbacks.begin(),ie=thus->mCallbacks.end();i!=ie;++i) {
+        StreamStats streamStats;
+        i->second->mCounters->read(streamStats);
+        SILOG(tcpsst,info,"Connection "<<&*thus<<" stream "<<i->first.read()<<" sent "<<streamStats.bytesSent<<" bytes in "<<streamStats.packetsSent
+              <<" packets, received "<<streamStats.bytesReceived<<" bytes in "<<streamStats.packetsReceived<<" packets");
+    }
+    IOServiceFactory::dispatchServiceMessage(thus->mIO,period,std::tr1::bind(&MultiplexedSocket::logStatsPeriodically,weakThus,period));
+}
+
+bool MultiplexedSocket::sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data) {
+    TCPSSTLOG(this,"sendnow",data.data->data(),data.data->size(),false);
     TCPSSTLOG(this,"sendnow","\n",1,false);
     static Stream::StreamID::Hasher hasher;
     if (data.originStream==Stream::StreamID()) {
         unsigned int socket_size=(unsigned int)thus->mSockets.size();
-        for(unsigned int i=1;i<socket_size;++i) {                
-            thus->mSockets[i].rawSend(thus,new Chunk(*data.data));
+        //every socket carries control packets: the others queue references to the one buffer since a packet is queued on one socket at a time
+        for(unsigned int i=1;i<socket_size;++i) {
+            thus->mSockets[i].rawSend(thus,PacketBuffer::constructReference(data.data));
         }
         thus->mSockets[0].rawSend(thus,data.data);
     }else {
         size_t whichStream=data.unordered?thus->leastBusyStream():hasher(data.originStream)%thus->mSockets.size();
-        if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data.data,whichStream)) {
+        if (data.unreliable==false||thus->admitUnreliable(data,whichStream)) {
             thus->mSockets[whichStream].rawSend(thus,data.data);
-        }        
+        }else {
+            data.data->release();
+            return false;
+        }
     }
+    return true;
 }
 
 
@@ -142,9 +222,9 @@ void MultiplexedSocket::closeStream(const std::tr1::shared_ptr<MultiplexedSocket
 }
 
 
-void MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data) {
+bool MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data) {
     if (thus->mSocketConnectionPhase==CONNECTED) {
-        sendBytesNow(thus,data);
+        return sendBytesNow(thus,data);
     }else {
         bool lockCheckConnected=false;
         {
@@ -154,21 +234,23 @@ void MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&
             }else if(thus->mSocketConnectionPhase==DISCONNECTED) {
                 //retval=false;
                 //FIXME is this the correct thing to do?
-                TCPSSTLOG(this,"sendnvr",&*data.data->begin(),data.data->size(),false);                
+                TCPSSTLOG(this,"sendnvr",data.data->data(),data.data->size(),false);                
                 TCPSSTLOG(this,"sendnvr","\n",1,false);
-                delete data.data;
+                data.data->release();
+                return false;
             }else {
                 //with the connectionMutex acquired, no socket is allowed to be in the mSocketConnectionPhase
                 assert(thus->mSocketConnectionPhase==PRECONNECTION);
-                TCPSSTLOG(this,"sendl8r",&*data.data->begin(),data.data->size(),false);
+                TCPSSTLOG(this,"sendl8r",data.data->data(),data.data->size(),false);
                 TCPSSTLOG(this,"sendl8r","\n",1,false);
                 thus->mNewRequests.push_back(data);
             }
         }
         if (lockCheckConnected) {
-            sendBytesNow(thus,data);
+            return sendBytesNow(thus,data);
         }
     }
+    return true;
 }
 
 MultiplexedSocket::SocketConnectionPhase MultiplexedSocket::addCallbacks(const Stream::StreamID&sid, 
@@ -180,22 +262,23 @@ MultiplexedSocket::SocketConnectionPhase MultiplexedSocket::addCallbacks(const S
 
 
 Stream::StreamID MultiplexedSocket::getNewID() {
-    if (!mFreeStreamIDs.probablyEmpty()) {
-        Stream::StreamID retval;
-        if (mFreeStreamIDs.pop(retval))
-            return retval;
+    Stream::StreamID reused;
+    if (mFreeStreamIDs.pop(reused)) {
+        assert(reused.odd()==((mHighestStreamID.read()&1)?true:false));
+        return reused;
     }
     unsigned int retval=mHighestStreamID+=2;
     assert(retval>1);
     return Stream::StreamID(retval);
 }
-MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),mNewSubstreamCallback(substreamCallback),mHighestStreamID(1) {
+MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),mNewSubstreamCallback(substreamCallback),mHighestStreamID(1),mUnreliableDropped(0) {
     mSocketConnectionPhase=PRECONNECTION;
 }
 MultiplexedSocket::MultiplexedSocket(IOService*io,const UUID&uuid,const std::vector<TCPSocket*>&sockets, const Stream::SubstreamCallback &substreamCallback)
     :ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),
      mNewSubstreamCallback(substreamCallback),
-     mHighestStreamID(0) {
+     mHighestStreamID(0),
+     mUnreliableDropped(0) {
     mSocketConnectionPhase=PRECONNECTION;
     for (unsigned int i=0;i<(unsigned int)sockets.size();++i) {
         mSockets.push_back(ASIOSocketWrapper(sockets[i]));
@@ -211,6 +294,7 @@ void MultiplexedSocket::sendAllProtocolHeaders(const std::tr1::shared_ptr<Multip
     for (unsigned int i=0,ie=thus->mSockets.size();i!=ie;++i) {
         MakeASIOReadBuffer(thus,i);
     }
+    thus->startStatsLogging();
     assert (thus->mNewRequests.size()==0);//would otherwise need to empty out new requests--but no one should have a reference to us here
 }
 ///erase all sockets and callbacks since the refcount is now zero;
@@ -233,9 +317,13 @@ MultiplexedSocket::~MultiplexedSocket() {
         mCallbackRegistration.pop_front();
     }
     for (size_t i=0;i<mNewRequests.size();++i) {
-        delete mNewRequests[i].data;
+        mNewRequests[i].data->release();
     }
     mNewRequests.clear();
+    for (UnreliablePacketMap::iterator i=mLatestUnreliable.begin(),ie=mLatestUnreliable.end();i!=ie;++i) {
+        i->second->release();
+    }
+    mLatestUnreliable.clear();
     while(!mCallbacks.empty()) {
         delete mCallbacks.begin()->second;
         mCallbacks.erase(mCallbacks.begin());
@@ -243,6 +331,7 @@ MultiplexedSocket::~MultiplexedSocket() {
 }
 
 void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stream::StreamID &id) {
+    forgetUnreliable(id);
     if (controlCode==TCPStream::TCPStreamCloseStream){
         std::deque<StreamIDCallbackPair> registrations;
         CommitCallbacks(registrations,CONNECTED,false);
@@ -268,16 +357,17 @@ void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stre
         mFreeStreamIDs.push(id);
     }
 }
-void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const Chunk&newChunk){
+void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,MemoryReference newChunk,Stream::ReceivedBuffer&buffer){
     if (id==Stream::StreamID()) {//control packet
         if(newChunk.size()) {
-            unsigned int controlCode=*newChunk.begin();
+            const uint8*controlData=(const uint8*)newChunk.data();
+            unsigned int controlCode=controlData[0];
             switch (controlCode) {
               case TCPStream::TCPStreamCloseStream:
               case TCPStream::TCPStreamAckCloseStream:
                 if (newChunk.size()>1) {
                     unsigned int avail_len=newChunk.size()-1;
-                    id.unserialize((const uint8*)&(newChunk[1]),avail_len);
+                    id.unserialize(controlData+1,avail_len);
                     if (avail_len+1>newChunk.size()) {
                         SILOG(tcpsst,warning,"Control Chunk too short");
                     }
@@ -313,9 +403,11 @@ void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::Strea
     }else {
         std::deque<StreamIDCallbackPair> registrations;
         CommitCallbacks(registrations,CONNECTED,false);
+        mConnectionCounters.countReceived(newChunk.size());
         CallbackMap::iterator where=mCallbacks.find(id);
         if (where!=mCallbacks.end()) {
-            where->second->mBytesReceivedCallback(newChunk);
+            where->second->mCounters->countReceived(newChunk.size());
+            where->second->mBytesReceivedCallback(newChunk,buffer);
         }else if (mOneSidedClosingStreams.find(id)==mOneSidedClosingStreams.end()) {
             //new substream
             TCPStream*newStream=new TCPStream(getSharedPtr(),id);
@@ -323,7 +415,8 @@ void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::Strea
             mNewSubstreamCallback(newStream,setCallbackFunctor);
             if (setCallbackFunctor.mCallbacks != NULL) {
                 CommitCallbacks(registrations,CONNECTED,false);//make sure bytes are received
-                setCallbackFunctor.mCallbacks->mBytesReceivedCallback(newChunk);
+                setCallbackFunctor.mCallbacks->mCounters->countReceived(newChunk.size());
+                setCallbackFunctor.mCallbacks->mBytesReceivedCallback(newChunk,buffer);
             }else {
                 closeStream(getSharedPtr(),id);
             }
@@ -337,6 +430,9 @@ void MultiplexedSocket::connectionFailureOrSuccessCallback(SocketConnectionPhase
     std::deque<StreamIDCallbackPair> registrations;
     bool actuallyDoSend=CommitCallbacks(registrations,status,true);
     if (actuallyDoSend) {
+        if (status==CONNECTED) {
+            startStatsLogging();
+        }
         for (CallbackMap::iterator i=mCallbacks.begin(),ie=mCallbacks.end();i!=ie;++i) {
             i->second->mConnectionCallback(stat,errorMessage);
         }
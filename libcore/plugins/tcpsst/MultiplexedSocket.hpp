@@ -30,6 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/ThreadId.hpp"
+#include "util/LockFreeQueue.hpp"
 namespace Sirikata { namespace Network {
 
 class MultiplexedSocket:public SelfWeakPtr<MultiplexedSocket>,ThreadIdCheck {
@@ -39,7 +40,7 @@ public:
         bool unordered;
         bool unreliable;
         Stream::StreamID originStream;
-        Chunk * data;
+        PacketBuffer * data;
     };
     enum SocketConnectionPhase{
         PRECONNECTION,
@@ -84,12 +85,28 @@ private:
     std::tr1::unordered_map<Stream::StreamID,unsigned int,Stream::StreamID::Hasher>mAckedClosingStreams;
     ///a set of StreamIDs to hold the streams that were requested closed but have not been acknowledged, to prevent received packets triggering NewStream callbacks as if a new ID were received
     std::tr1::unordered_set<Stream::StreamID,Stream::StreamID::Hasher>mOneSidedClosingStreams;
-#define ThreadSafeStack ThreadSafeQueue //FIXME this can be way more efficient
-    ///The highest streamID that has been used for making new streams on this side
+    ///The highest streamID that has been used for making new streams on this side: odd for the connecting side, even for the listening side
     AtomicValue<uint32> mHighestStreamID;
-    ///actually free stream IDs that will not be sent out until recalimed by this side
-    ThreadSafeStack<Stream::StreamID>mFreeStreamIDs;
-#undef ThreadSafeStack
+    /**
+     * Stream IDs of this side's parity whose close has been acknowledged, ready for reuse.
+     * Lock free, so cloning streams from many threads does not serialize on a mutex.
+     */
+    LockFreeQueue<Stream::StreamID>mFreeStreamIDs;
+    enum {
+        ///once a socket has this many bytes waiting, a new unreliable packet supersedes its stream's previous one
+        SUPERSEDE_UNRELIABLE_BACKLOG=16384,
+        ///once a socket has this many bytes waiting, new unreliable packets are dropped outright
+        DROP_UNRELIABLE_BACKLOG=262144
+    };
+    typedef std::tr1::unordered_map<Stream::StreamID,PacketBuffer*,Stream::StreamID::Hasher> UnreliablePacketMap;
+    ///protects mLatestUnreliable, which may be touched by any sending thread
+    boost::mutex mUnreliableMutex;
+    ///the most recent unreliable packet each stream sent while its socket was congested (holds a reference)
+    UnreliablePacketMap mLatestUnreliable;
+    ///payload traffic of every stream on this connection
+    TCPStream::TrafficCounters mConnectionCounters;
+    ///unreliable packets refused or superseded because a socket was backed up
+    AtomicValue<uint64> mUnreliableDropped;
 
 //Begin helper functions//
 
@@ -97,19 +114,28 @@ private:
     void ioReactorThreadCommitCallback(StreamIDCallbackPair& newcallback);
     ///reads the current list of id-callback pairs to the registration list and if setConectedStatus is set, changes the status of the overall MultiplexedSocket at the same time
     bool CommitCallbacks(std::deque<StreamIDCallbackPair> &registration, SocketConnectionPhase status, bool setConnectedStatus=false);
-    ///Returns the least busy stream upon which unordered data may be piled
+    ///Returns the socket with the fewest bytes waiting, upon which unordered data may be piled
     size_t leastBusyStream();
     /**
-     *chance in the current load that an unreliable packet may be dropped 
-     * (due to busy queues, etc). 
-     * \returns drop chance which must be less than 1.0 and greater or equal to 0.0 
+     * Decides whether an unreliable packet is worth queueing on a socket given the bytes already waiting there.
+     * On a lightly loaded socket everything goes out. Past SUPERSEDE_UNRELIABLE_BACKLOG the packet replaces
+     * the previous unreliable packet of the same stream that is still waiting, so the stream only sends its
+     * latest state. Past DROP_UNRELIABLE_BACKLOG the packet is refused.
+     * \returns whether the packet should be handed to the socket
      */
-    float dropChance(const Chunk*data,size_t whichStream);
+    bool admitUnreliable(const RawRequest&data,size_t whichStream);
+    ///Forgets the latest unreliable packet recorded for a stream
+    void forgetUnreliable(const Stream::StreamID&id);
     /**
      *  sends bytes to the network directly.
      *  assumes that the mSocketConnectionPhase in the CONNECTED state    
+     *  \returns false if the packet was refused and released rather than queued on a socket
      */
-    static void sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data);
+    static bool sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data);
+    ///Starts logging the counters every Stream::statsLogPeriod() if the netstats option asks for it
+    void startStatsLogging();
+    ///Logs the connection and per stream counters, then schedules the next time to do so while the connection lives
+    static void logStatsPeriodically(const std::tr1::weak_ptr<MultiplexedSocket>&weakThus,const Duration&period);
     /**
      * Calls the connected callback with the succeess or failure status. Sets status while holding the sConnectingMutex lock so that after that point no more Connected responses
      * will be sent out. Then inserts the registrations into the mCallbacks map during the ioReactor thread.
@@ -138,14 +164,21 @@ public:
     /**
      * Either sends or queues bytes in the data request depending on the connection state 
      * if the state is not connected then it must take a lock and place them on the mNewRequests queue
+     * \returns false if the packet was released instead: the connection is gone or an unreliable packet was refused
      */
-    static void sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data);
+    static bool sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data);
     /**
      * Adds callbacks onto the queue of callbacks-to-be-added
      * Returns true if the callbacks will be actually used or false if the socket is already disconnected
      */
     SocketConnectionPhase addCallbacks(const Stream::StreamID&sid, TCPStream::Callbacks* cb);
-    ///function that searches mFreeStreamIDs or uses the mHighestStreamID to find the next unused free stream ID
+    ///The counters to which streams add the traffic they send
+    TCPStream::TrafficCounters&connectionCounters(){return mConnectionCounters;}
+    ///Notes that an unreliable packet did not make it onto the wire
+    void countUnreliableDropped(){++mUnreliableDropped;}
+    ///Returns a snapshot of the traffic counters of the whole connection; may be called from any thread
+    StreamStats getStats()const;
+    ///function that reuses an ID from mFreeStreamIDs or else advances mHighestStreamID to find the next unused free stream ID; safe from any thread
     Stream::StreamID getNewID();
     ///Constructor for a connecting stream
     MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback);
@@ -162,7 +195,7 @@ public:
      * Control packets come in on Stream::StreamID() and others should be directed
      * to the appropriate callback
      */
-    void receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const Chunk&newChunk);
+    void receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,MemoryReference newChunk,Stream::ReceivedBuffer&buffer);
    /**
     * The a particular socket's connection failed
     * This function will call all substreams disconnected methods
@@ -0,0 +1,113 @@
+/*  Sirikata Network Utilities
+ *  PacketBuffer.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Platform.hpp"
+#include "util/LockFreeQueue.hpp"
+#include "PacketBuffer.hpp"
+
+namespace Sirikata { namespace Network {
+
+namespace {
+class PacketBufferPool {
+public:
+    LockFreeQueue<PacketBuffer*> mFree;
+    AtomicValue<int> mNumFree;
+    PacketBufferPool():mNumFree(0) {}
+};
+// Never freed: packets may still be released while static objects are torn down.
+PacketBufferPool*packetBufferPools() {
+    static PacketBufferPool*pools=new PacketBufferPool[PacketBuffer::NUM_SIZE_CLASSES];
+    return pools;
+}
+}
+
+uint32 PacketBuffer::sizeClass(size_t size) {
+    uint32 retval=0;
+    while (retval<NUM_SIZE_CLASSES&&capacity(retval)<size)
+        ++retval;
+    return retval;
+}
+
+PacketBuffer*PacketBuffer::construct(size_t size) {
+    uint32 whichClass=sizeClass(size);
+    PacketBuffer*retval=NULL;
+    if (whichClass<NUM_SIZE_CLASSES) {
+        PacketBufferPool&pool=packetBufferPools()[whichClass];
+        if (pool.mFree.pop(retval)) {
+            --pool.mNumFree;
+            retval->mRefCount=1;
+            retval->mSuperseded=0;
+            retval->mPriority=ORDERING_BARRIER;
+            retval->mNextQueued=NULL;
+        }else {
+            retval=new (new uint8[sizeof(PacketBuffer)+capacity(whichClass)]) PacketBuffer(whichClass);
+        }
+    }else {
+        retval=new (new uint8[sizeof(PacketBuffer)+size]) PacketBuffer(whichClass);
+    }
+    retval->mSize=(uint32)size;
+    return retval;
+}
+
+PacketBuffer*PacketBuffer::construct(const void*data, size_t size) {
+    PacketBuffer*retval=construct(size);
+    if (size)
+        std::memcpy(retval->data(),data,size);
+    return retval;
+}
+
+PacketBuffer*PacketBuffer::constructReference(PacketBuffer*payload) {
+    PacketBuffer*retval=construct(0);
+    retval->mPayload=payload->addRef();
+    retval->mSize=payload->mSize;
+    retval->mPriority=payload->mPriority;
+    return retval;
+}
+
+void PacketBuffer::recycle() {
+    if (mPayload) {
+        mPayload->release();
+        mPayload=NULL;
+    }
+    if (mSizeClass<NUM_SIZE_CLASSES) {
+        PacketBufferPool&pool=packetBufferPools()[mSizeClass];
+        if (pool.mNumFree.read()<(int)(MAX_POOLED_BYTES_PER_CLASS/capacity(mSizeClass))+16) {
+            ++pool.mNumFree;
+            pool.mFree.push(this);
+            return;
+        }
+    }
+    this->~PacketBuffer();
+    delete []reinterpret_cast<uint8*>(this);
+}
+
+} }
@@ -0,0 +1,131 @@
+/*  Sirikata Network Utilities
+ *  PacketBuffer.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_PacketBuffer_HPP__
+#define SIRIKATA_PacketBuffer_HPP__
+#include "util/AtomicTypes.hpp"
+namespace Sirikata { namespace Network {
+class ASIOSocketWrapper;
+
+/**
+ * The bytes of one outgoing packet, framing included. A PacketBuffer is queued on at most
+ * one socket; to send the same bytes on several sockets, queue references made with
+ * constructReference, which share the original's bytes. PacketBuffers are reference counted
+ * so they may be held past the send queue of their socket, and they are recycled through
+ * per-size-class free lists so the steady state send path does not touch the allocator.
+ */
+class PacketBuffer {
+public:
+    enum {
+        ///the smallest size class holds 1<<SMALLEST_SIZE_CLASS_SHIFT bytes
+        SMALLEST_SIZE_CLASS_SHIFT=6,
+        ///size classes run from 64 bytes to 64 kilobytes; bigger packets are allocated and freed directly
+        NUM_SIZE_CLASSES=11,
+        ///how many bytes of idle buffers each size class may keep around
+        MAX_POOLED_BYTES_PER_CLASS=1<<20,
+        ///priority of packets that every packet queued before them must precede on the wire
+        ORDERING_BARRIER=0xff
+    };
+private:
+    AtomicValue<uint32> mRefCount;
+    ///nonzero once a newer packet has made this one pointless to send
+    AtomicValue<uint32> mSuperseded;
+    uint32 mSize;
+    uint32 mSizeClass;
+    ///a Network::StreamPriority or ORDERING_BARRIER
+    uint32 mPriority;
+    friend class ASIOSocketWrapper;
+    ///the link of the intrusive send queue of the one socket the packet is queued on
+    PacketBuffer*mNextQueued;
+    ///the buffer whose bytes this one sends, or NULL if they follow this object
+    PacketBuffer*mPayload;
+    PacketBuffer(uint32 sizeClass):mRefCount(1),mSuperseded(0),mSize(0),mSizeClass(sizeClass),mPriority(ORDERING_BARRIER),mNextQueued(NULL),mPayload(NULL) {}
+    PacketBuffer(const PacketBuffer&);
+    PacketBuffer&operator=(const PacketBuffer&);
+    static uint32 sizeClass(size_t size);
+    static size_t capacity(uint32 sizeClass) {
+        return ((size_t)1)<<(sizeClass+SMALLEST_SIZE_CLASS_SHIFT);
+    }
+    ///returns a buffer whose last reference went away to its pool
+    void recycle();
+public:
+    /**
+     * Returns a buffer of size bytes with a reference count of one.
+     * The contents are uninitialized and the priority is ORDERING_BARRIER.
+     */
+    static PacketBuffer*construct(size_t size);
+    ///Returns a buffer holding a copy of size bytes of data with a reference count of one
+    static PacketBuffer*construct(const void*data, size_t size);
+    /**
+     * Returns a buffer with a reference count of one that sends the bytes and has the priority
+     * of payload, and holds a reference to it, so the bytes may be queued on another socket without a copy.
+     */
+    static PacketBuffer*constructReference(PacketBuffer*payload);
+
+    PacketBuffer*addRef() {
+        ++mRefCount;
+        return this;
+    }
+    ///Drops one reference; the buffer must not be touched by the caller afterwards
+    void release() {
+        if (--mRefCount==0)
+            recycle();
+    }
+
+    uint8*data() {
+        return mPayload?mPayload->data():reinterpret_cast<uint8*>(this+1);
+    }
+    const uint8*data()const {
+        return mPayload?mPayload->data():reinterpret_cast<const uint8*>(this+1);
+    }
+    size_t size()const {
+        return mSize;
+    }
+    /**
+     * Marks an unreliable packet as replaced by a newer one from the same stream.
+     * A socket skips superseded packets that it has not started writing.
+     */
+    void supersede() {
+        mSuperseded=1;
+    }
+    bool superseded()const {
+        return mSuperseded.read()!=0;
+    }
+    void setPriority(uint32 priority) {
+        mPriority=priority;
+    }
+    uint32 priority()const {
+        return mPriority;
+    }
+};
+
+} }
+#endif
@@ -42,7 +42,16 @@ public:
                             const Stream::BytesReceivedCallback &bytesReceivedCallback){
         mCallbacks=new TCPStream::Callbacks(connectionCallback,
                                             bytesReceivedCallback,
-                                            mStream->mSendStatus);
+                                            mStream->mSendStatus,
+                                            mStream->mCounters);
+        mMultiSocket->addCallbacks(mStream->getID(),mCallbacks);
+    }
+    virtual void setReferenceCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                       const Stream::BytesReferenceReceivedCallback &bytesReceivedCallback){
+        mCallbacks=new TCPStream::Callbacks(connectionCallback,
+                                            bytesReceivedCallback,
+                                            mStream->mSendStatus,
+                                            mStream->mCounters);
         mMultiSocket->addCallbacks(mStream->getID(),mCallbacks);
     }
 };
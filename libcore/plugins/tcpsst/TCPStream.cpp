@@ -43,7 +43,7 @@
 namespace Sirikata { namespace Network {
 
 using namespace boost::asio::ip;
-TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendStatus(new AtomicValue<int>(0)) {
+TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendStatus(new AtomicValue<int>(0)),mPriority(NormalPriority),mCounters(new TrafficCounters) {
 
 }
 void TCPStream::send(const Chunk&data, StreamReliability reliability) {
@@ -52,7 +52,72 @@ void TCPStream::send(const Chunk&data, StreamReliability reliability) {
 void TCPStream::send(MemoryReference firstChunk, StreamReliability reliability) {
     send(firstChunk,MemoryReference::null(),reliability);
 }
+namespace {
+///Writes the length prefix and StreamID of a packet carrying dataSize bytes and returns where the data goes
+uint8*writePacketHeader(uint8*output, const uint8*serializedStreamId, unsigned int streamIdLength, size_t dataSize) {
+    Stream::uint30 packetLength=Stream::uint30(dataSize+streamIdLength);
+    unsigned int packetHeaderLength=packetLength.serialize(output,Stream::uint30::MAX_SERIALIZED_LENGTH);
+    std::memcpy(output+packetHeaderLength,serializedStreamId,streamIdLength);
+    return output+packetHeaderLength+streamIdLength;
+}
+///How many bytes writePacketHeader takes for a packet carrying dataSize bytes
+size_t packetHeaderSize(unsigned int streamIdLength, size_t dataSize) {
+    uint8 packetLengthSerialized[Stream::uint30::MAX_SERIALIZED_LENGTH];
+    return Stream::uint30(dataSize+streamIdLength).serialize(packetLengthSerialized,Stream::uint30::MAX_SERIALIZED_LENGTH)+streamIdLength;
+}
+}
+unsigned int TCPStream::serializeID(uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH])const {
+    unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
+    unsigned int successLengthNeeded=getID().serialize(serializedStreamId,streamIdLength);
+    ///this function should never return something larger than the  MAX_SERIALIZED_LEGNTH
+    assert(successLengthNeeded<=streamIdLength);
+    return successLengthNeeded;
+}
 void TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, StreamReliability reliability) {
+    uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
+    unsigned int streamIdLength=serializeID(serializedStreamId);
+    size_t dataSize=firstChunk.size()+secondChunk.size();
+    //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data
+    PacketBuffer *packet=PacketBuffer::construct(packetHeaderSize(streamIdLength,dataSize)+dataSize);
+    uint8 *outputBuffer=writePacketHeader(packet->data(),serializedStreamId,streamIdLength,dataSize);
+    if (firstChunk.size()) {
+        std::memcpy(outputBuffer,
+                    firstChunk.data(),
+                    firstChunk.size());
+    }
+    if (secondChunk.size()) {
+        std::memcpy(outputBuffer+firstChunk.size(),
+                    secondChunk.data(),
+                    secondChunk.size());
+    }
+    sendPacket(packet,1,dataSize,reliability);
+}
+void TCPStream::sendBatch(const MemoryReference*messages, size_t numMessages, StreamReliability reliability) {
+    if (numMessages==0) {
+        return;
+    }
+    uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
+    unsigned int streamIdLength=serializeID(serializedStreamId);
+    size_t totalSize=0;
+    size_t payloadBytes=0;
+    for (size_t i=0;i<numMessages;++i) {
+        totalSize+=packetHeaderSize(streamIdLength,messages[i].size())+messages[i].size();
+        payloadBytes+=messages[i].size();
+    }
+    //every message is framed as a packet of its own, back to back in one buffer that goes out as one write
+    PacketBuffer *packets=PacketBuffer::construct(totalSize);
+    uint8 *outputBuffer=packets->data();
+    for (size_t i=0;i<numMessages;++i) {
+        outputBuffer=writePacketHeader(outputBuffer,serializedStreamId,streamIdLength,messages[i].size());
+        if (messages[i].size()) {
+            std::memcpy(outputBuffer,messages[i].data(),messages[i].size());
+            outputBuffer+=messages[i].size();
+        }
+    }
+    assert(outputBuffer==packets->data()+totalSize);
+    sendPacket(packets,numMessages,payloadBytes,reliability);
+}
+void TCPStream::sendPacket(PacketBuffer*packet, size_t numMessages, size_t payloadBytes, StreamReliability reliability) {
     MultiplexedSocket::RawRequest toBeSent;
     // only allow 3 of the four possibilities because unreliable ordered is tricky and usually useless
     switch(reliability) {
@@ -70,49 +135,49 @@ void TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
         break;
     }
     toBeSent.originStream=getID();
-    uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
-    unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-    unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
-    ///this function should never return something larger than the  MAX_SERIALIZED_LEGNTH
-    assert(successLengthNeeded<=streamIdLength);
-    streamIdLength=successLengthNeeded;
-    size_t totalSize=firstChunk.size()+secondChunk.size();
-    totalSize+=streamIdLength;
-    uint30 packetLength=uint30(totalSize);
-    uint8 packetLengthSerialized[uint30::MAX_SERIALIZED_LENGTH];
-    unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,uint30::MAX_SERIALIZED_LENGTH);
-    //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-    //packetHeaderLength = the length of the length component of the packet
-    toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-    uint8 *outputBuffer=&(*toBeSent.data)[0];
-    std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
-    std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
-    if (firstChunk.size()) {
-        std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
-                    firstChunk.data(),
-                    firstChunk.size());
-    }
-    if (secondChunk.size()) {
-        std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
-                    secondChunk.data(),
-                    secondChunk.size());
-    }
+    toBeSent.data=packet;
+    toBeSent.data->setPriority(mPriority);
     bool didsend=false;
     //indicate to other would-be TCPStream::close()ers that we are sending and they will have to wait until we give up control to actually ack the close and shut down the stream
     unsigned int sendStatus=++(*mSendStatus);
     if ((sendStatus&(3*SendStatusClosing))==0) {///max of 3 entities can close the stream at once (FIXME: should implement |= on atomic ints), but as of now at most the recv thread the sender responsible and a user close() is all that is allowed at once...so 3 is fine)
-        MultiplexedSocket::sendBytes(mSocket,toBeSent);
+        if (MultiplexedSocket::sendBytes(mSocket,toBeSent)) {
+            //only packets the connection took count; refused ones were already released
+            mCounters->countSent(payloadBytes,numMessages);
+            mSocket->connectionCounters().countSent(payloadBytes,numMessages);
+        }
         didsend=true;
     }
     //relinquish control to a potential closer
     --(*mSendStatus);
     if (!didsend) {
         //if the data was not sent, its our job to clean it up
-        delete toBeSent.data;
+        toBeSent.data->release();
         SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
     }
 }
+void TCPStream::setPriority(StreamPriority priority) {
+    if (priority==mPriority) {
+        return;
+    }
+    mPriority=priority;
+    if (!mSocket) {
+        return;
+    }
+    //an empty barrier on every socket keeps the packets queued under the old priority ahead of the ones sent under the new priority
+    MultiplexedSocket::RawRequest barrier;
+    barrier.unordered=false;
+    barrier.unreliable=false;
+    barrier.originStream=StreamID();
+    barrier.data=PacketBuffer::construct(0);
+    unsigned int sendStatus=++(*mSendStatus);
+    if ((sendStatus&(3*SendStatusClosing))==0) {
+        MultiplexedSocket::sendBytes(mSocket,barrier);
+    }else {
+        barrier.data->release();
+    }
+    --(*mSendStatus);
+}
 ///This function waits on the sendStatus clearing up so no outstanding sends are being made (and no further ones WILL be made cus of the SendStatusClosing flag that is on
 bool TCPStream::closeSendStatus(AtomicValue<int>&vSendStatus) {
     int sendStatus=vSendStatus.read();
@@ -138,10 +203,21 @@ void TCPStream::close() {
         MultiplexedSocket::closeStream(mSocket,getID());
     }
 }
+StreamStats TCPStream::getStats()const {
+    StreamStats retval;
+    mCounters->read(retval);
+    return retval;
+}
+StreamStats TCPStream::getConnectionStats()const {
+    if (!mSocket) {
+        return StreamStats();
+    }
+    return mSocket->getStats();
+}
 TCPStream::~TCPStream() {
     close();
 }
-TCPStream::TCPStream(IOService&io):mIO(&io),mSendStatus(new AtomicValue<int>(0)) {
+TCPStream::TCPStream(IOService&io):mIO(&io),mSendStatus(new AtomicValue<int>(0)),mPriority(NormalPriority),mCounters(new TrafficCounters) {
 }
 
 #define NUM_SIMULANEOUS_CONNECTIONS 1 // 3 is a good number here.
@@ -155,7 +231,8 @@ void TCPStream::connect(const Address&addy,
     mID=StreamID(1);
     mSocket->addCallbacks(getID(),new Callbacks(connectionCallback,
                                                 bytesReceivedCallback,
-                                                mSendStatus));
+                                                mSendStatus,
+                                                mCounters));
     mSocket->connect(addy,NUM_SIMULANEOUS_CONNECTIONS);
 }
 
@@ -168,7 +245,8 @@ void TCPStream::prepareOutboundConnection(
     mID=StreamID(1);
     mSocket->addCallbacks(getID(),new Callbacks(connectionCallback,
                                                 bytesReceivedCallback,
-                                                mSendStatus));
+                                                mSendStatus,
+                                                mCounters));
     mSocket->prepareConnect(NUM_SIMULANEOUS_CONNECTIONS);
 }
 void TCPStream::connect(const Address&addy) {
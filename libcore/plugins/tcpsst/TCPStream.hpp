@@ -35,6 +35,7 @@
 #include "util/AtomicTypes.hpp"
 namespace Sirikata { namespace Network {
 class MultiplexedSocket;
+class PacketBuffer;
 class TCPSetCallbacks;
 class IOService;
 
@@ -86,6 +87,33 @@ class IOService;
 class TCPStream:public Stream {
 public:
     class Callbacks;
+    /**
+     * Traffic counters updated by whichever thread sends or receives.
+     * Each stream shares one set with its Callbacks; the MultiplexedSocket keeps another for the whole connection.
+     */
+    class TrafficCounters:public Noncopyable {
+    public:
+        AtomicValue<uint64> mBytesSent;
+        AtomicValue<uint64> mPacketsSent;
+        AtomicValue<uint64> mBytesReceived;
+        AtomicValue<uint64> mPacketsReceived;
+        TrafficCounters():mBytesSent(0),mPacketsSent(0),mBytesReceived(0),mPacketsReceived(0) {}
+        void countSent(size_t bytes, size_t packets) {
+            mBytesSent+=bytes;
+            mPacketsSent+=packets;
+        }
+        void countReceived(size_t bytes) {
+            mBytesReceived+=bytes;
+            ++mPacketsReceived;
+        }
+        ///Copies the counters into stats
+        void read(StreamStats&stats)const {
+            stats.bytesSent=mBytesSent.read();
+            stats.packetsSent=mPacketsSent.read();
+            stats.bytesReceived=mBytesReceived.read();
+            stats.packetsReceived=mPacketsReceived.read();
+        }
+    };
     static const char * STRING_PREFIX() {
         return "SSTTCP";
     }
@@ -114,6 +142,14 @@ private:
     };
     ///incremented while sending: or'd in SendStatusClosing when close function triggered so no further packets will be sent using old ID.
     std::tr1::shared_ptr<AtomicValue<int> >mSendStatus;
+    ///The priority stamped on each packet this stream sends
+    volatile StreamPriority mPriority;
+    ///Counts this stream's traffic: shared with its Callbacks so the receiving thread can count too
+    std::tr1::shared_ptr<TrafficCounters> mCounters;
+    ///Serializes mID into serializedStreamId and returns its length
+    unsigned int serializeID(uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH])const;
+    ///Hands one or more framed packets to the MultiplexedSocket unless the stream is closing, in which case they are released
+    void sendPacket(PacketBuffer*packet, size_t numMessages, size_t payloadBytes, StreamReliability reliability);
 public:
     ///Atomically sets the sendStatus for this socket to closed. FIXME: should use atomic compare and swap for |= instead of += right now only supports 2 non-io threads closing at once
     static bool closeSendStatus(AtomicValue<int>&vSendStatus);
@@ -126,14 +162,28 @@ public:
     class Callbacks:public Noncopyable {        
     public:
         Stream::ConnectionCallback mConnectionCallback;
-        Stream::BytesReceivedCallback mBytesReceivedCallback;
+        ///receives each packet by reference into the read buffer; Chunk callbacks are adapted to this
+        Stream::BytesReferenceReceivedCallback mBytesReceivedCallback;
         std::tr1::weak_ptr<AtomicValue<int> > mSendStatus;
+        ///the counters of the stream these callbacks belong to
+        std::tr1::shared_ptr<TrafficCounters> mCounters;
         Callbacks(const Stream::ConnectionCallback &connectionCallback,
                   const Stream::BytesReceivedCallback &bytesReceivedCallback,
-                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus):
+                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus,
+                  const std::tr1::shared_ptr<TrafficCounters>&counters):
+            mConnectionCallback(connectionCallback),
+            mBytesReceivedCallback(Stream::referenceCallbackFor(bytesReceivedCallback)),
+            mSendStatus(sendStatus),
+            mCounters(counters){
+        }
+        Callbacks(const Stream::ConnectionCallback &connectionCallback,
+                  const Stream::BytesReferenceReceivedCallback &bytesReceivedCallback,
+                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus,
+                  const std::tr1::shared_ptr<TrafficCounters>&counters):
             mConnectionCallback(connectionCallback),
             mBytesReceivedCallback(bytesReceivedCallback),
-            mSendStatus(sendStatus){
+            mSendStatus(sendStatus),
+            mCounters(counters){
         }
     };
     ///Constructor which leaves socket in a disconnection state, prepared for a connect() or a clone()
@@ -147,6 +197,14 @@ public:
     virtual void send(MemoryReference, MemoryReference, StreamReliability);
     ///Implementation of send interface
     virtual void send(const Chunk&data,StreamReliability);
+    ///Implementation of sendBatch interface: the batch goes out as one write
+    virtual void sendBatch(const MemoryReference*messages, size_t numMessages, StreamReliability);
+    ///Stamps later packets with the given priority; queued packets still go out ahead of them
+    virtual void setPriority(StreamPriority);
+    ///Implementation of getStats interface
+    virtual StreamStats getStats()const;
+    ///Implementation of getConnectionStats interface
+    virtual StreamStats getConnectionStats()const;
     ///Implementation of connect interface
     virtual void connect(
         const Address& addy,
@@ -80,21 +80,167 @@ void IOServiceFactory::resetService(IOService*ios){
 void IOServiceFactory::dispatchServiceMessage(IOService*ios,const std::tr1::function<void()>&f){
     ios->dispatch(f);
 }
-namespace {
-void handle_deadline_timer(const boost::system::error_code&e,const std::tr1::shared_ptr<boost::asio::deadline_timer>&timer,const std::tr1::function<void()>&f) {
-    if (e) {
-    }else {
-        f();
+
+/**
+ * Runs every timer of an IOService off a single TimerWheel and a single
+ * deadline_timer, which is armed for the wheel's next expiry.
+ */
+class IOTimerWheel {
+    typedef Task::TimerWheel<std::tr1::function<void()> > Wheel;
+    boost::mutex mMutex;
+    boost::asio::deadline_timer mTimer;
+    Wheel mWheel;
+    bool mArmed;
+    Task::AbsTime mArmedFor;
+
+    /// Call with mMutex held.
+    void rearm() {
+        Task::AbsTime next=Task::AbsTime::null();
+        if (!mWheel.nextExpiry(next)) {
+            return;
+        }
+        if (mArmed && mArmedFor <= next) {
+            return;
+        }
+        mArmed=true;
+        mArmedFor=next;
+        Duration waitFor=next-Task::AbsTime::now();
+        if (waitFor<Duration::zero())
+            waitFor=Duration::zero();
+        // Replaces any earlier wait, whose handler sees operation_aborted.
+        mTimer.expires_from_now(boost::posix_time::microseconds(waitFor.toMicroseconds()));
+        using std::tr1::placeholders::_1;
+        mTimer.async_wait(std::tr1::bind(&IOTimerWheel::fired,this,_1));
+    }
+
+    void fired(const boost::system::error_code&e) {
+        if (e==boost::asio::error::operation_aborted) {
+            return;
+        }
+        Task::AbsTime now=Task::AbsTime::now();
+        std::tr1::function<void()> f;
+        for (;;) {
+            {
+                boost::mutex::scoped_lock lock(mMutex);
+                mArmed=false;
+                // One at a time, so a callback can cancel a timer due
+                // at the same moment.
+                if (!mWheel.expireOne(now,f)) {
+                    rearm();
+                    break;
+                }
+            }
+            f();
+        }
+    }
+public:
+    IOTimerWheel(IOService*ios)
+        : mTimer(*ios),mWheel(Task::AbsTime::now()),
+          mArmed(false),mArmedFor(Task::AbsTime::null()) {
+    }
+    IOServiceFactory::TimerHandle schedule(const Duration&waitFor,const std::tr1::function<void()>&f) {
+        boost::mutex::scoped_lock lock(mMutex);
+        IOServiceFactory::TimerHandle retval=mWheel.schedule(Task::AbsTime::now()+waitFor,f);
+        rearm();
+        return retval;
     }
+    bool cancel(const IOServiceFactory::TimerHandle&timer) {
+        // Otherwise leaves the deadline_timer armed; an early wakeup is
+        // harmless, but an idle one would keep run() from returning.
+        boost::mutex::scoped_lock lock(mMutex);
+        bool retval=mWheel.cancel(timer);
+        if (retval&&mArmed&&mWheel.empty()) {
+            mArmed=false;
+            mTimer.cancel();
+        }
+        return retval;
+    }
+};
+
+void IOServiceFactory::dispatchServiceMessage(IOService*ios,const Duration&waitFor,const std::tr1::function<void()>&f){
+    ios->mTimers->schedule(waitFor,f);
 }
+IOServiceFactory::TimerHandle IOServiceFactory::scheduleTimer(IOService*ios,const Duration&waitFor,const std::tr1::function<void()>&f){
+    return ios->mTimers->schedule(waitFor,f);
 }
-void IOServiceFactory::dispatchServiceMessage(IOService*ios,const Duration&waitFor,const std::tr1::function<void()>&f){
-    std::tr1::shared_ptr<boost::asio::deadline_timer> t(new boost::asio::deadline_timer(*ios,boost::posix_time::microseconds(waitFor.toMicroseconds())));
-    using std::tr1::placeholders::_1;
-    t->async_wait(std::tr1::bind(&handle_deadline_timer,_1,t,f));
+bool IOServiceFactory::cancelTimer(IOService*ios,const TimerHandle&timer){
+    return ios->mTimers->cancel(timer);
+}
+IOService* IOServiceFactory::affinityService(IOService*ios,size_t hash){
+    if (ios->mPool==NULL)
+        return ios;
+    return ios->mPool->service(hash%ios->mPool->size());
+}
+
+/**
+ * One service of an IOServicePool along with the thread and the work item
+ * that keep it running when it has nothing else to do.
+ */
+class IOServicePool::Reactor {
+public:
+    IOService *mIO;
+    boost::asio::io_service::work *mWork;
+    boost::thread *mThread;
+    Reactor():mIO(IOServiceFactory::makeIOService()),mWork(NULL),mThread(NULL) {
+    }
+    ~Reactor() {
+        IOServiceFactory::destroyIOService(mIO);
+    }
+};
+
+IOServicePool::IOServicePool(size_t numServices){
+    if (numServices==0)
+        numServices=boost::thread::hardware_concurrency();
+    if (numServices==0)
+        numServices=1;
+    for (size_t i=0;i<numServices;++i) {
+        mReactors.push_back(new Reactor);
+        mReactors.back()->mIO->mPool=this;
+    }
+}
+IOServicePool::~IOServicePool(){
+    stop();
+    for (size_t i=0;i<mReactors.size();++i) {
+        delete mReactors[i];
+    }
+}
+IOService* IOServicePool::service(size_t which){
+    return mReactors[which]->mIO;
+}
+void IOServicePool::run(){
+    for (size_t i=0;i<mReactors.size();++i) {
+        Reactor*reactor=mReactors[i];
+        if (reactor->mWork==NULL) {
+            reactor->mWork=new boost::asio::io_service::work(*reactor->mIO);
+        }
+        if (i&&reactor->mThread==NULL) {
+            reactor->mThread=new boost::thread(boost::bind(&IOServiceFactory::runService,reactor->mIO));
+        }
+    }
+    IOServiceFactory::runService(mReactors[0]->mIO);
+}
+void IOServicePool::stop(){
+    for (size_t i=0;i<mReactors.size();++i) {
+        Reactor*reactor=mReactors[i];
+        delete reactor->mWork;
+        reactor->mWork=NULL;
+        IOServiceFactory::stopService(reactor->mIO);
+    }
+    for (size_t i=0;i<mReactors.size();++i) {
+        Reactor*reactor=mReactors[i];
+        if (reactor->mThread) {
+            reactor->mThread->join();
+            delete reactor->mThread;
+            reactor->mThread=NULL;
+        }
+    }
 }
 
 
-IOService::IOService():boost::asio::io_service(1){}
-IOService::~IOService(){}
+IOService::IOService():boost::asio::io_service(1),mPool(NULL){
+    mTimers=new IOTimerWheel(this);
+}
+IOService::~IOService(){
+    delete mTimers;
+}
 } }
@@ -32,11 +32,16 @@
 #ifndef _SIRIKATA_IOSERVICEFACTORY_HPP_
 #define _SIRIKATA_IOSERVICEFACTORY_HPP_
 
+#include "task/TimerWheel.hpp"
+
 namespace Sirikata { namespace Network {
 class IOService;
+class IOServicePool;
 class SIRIKATA_EXPORT IOServiceFactory {
     static void io_service_initializer(IOService*io_ret);
   public:
+    /// Identifies a timer created with scheduleTimer.
+    typedef Task::TimerWheel<std::tr1::function<void()> >::Handle TimerHandle;
     static IOService* makeIOService();
     static void destroyIOService(IOService*io);
     static IOService& singletonIOService();
@@ -48,6 +53,51 @@ class SIRIKATA_EXPORT IOServiceFactory {
     static void resetService(IOService*);
     static void dispatchServiceMessage(IOService*,const std::tr1::function<void()>&f);
     static void dispatchServiceMessage(IOService*,const Duration& waitFor, const std::tr1::function<void()>&f);
+    /**
+     * Calls f from the IOService after waitFor has elapsed. All timers of an
+     * IOService share one timing wheel and one deadline_timer, so scheduling
+     * and cancelling are O(1) and do not allocate in steady state.
+     */
+    static TimerHandle scheduleTimer(IOService*,const Duration& waitFor, const std::tr1::function<void()>&f);
+    /**
+     * Cancels a timer from scheduleTimer.
+     * @returns false if it has already been called or cancelled.
+     */
+    static bool cancelTimer(IOService*,const TimerHandle&timer);
+    /**
+     * Picks the IOService that should run everything belonging to one connection.
+     * If ios is part of an IOServicePool, hash selects one of the pool's services,
+     * so equal hashes always land on the same service; otherwise ios is returned.
+     */
+    static IOService* affinityService(IOService*ios,size_t hash);
+};
+
+/**
+ * A fixed set of IOServices, each run by exactly one thread.
+ * A tcpsst listener on service(0) hands each accepted stream, sockets included,
+ * to the service its handshake UUID hashes to (see IOServiceFactory::affinityService),
+ * so every callback of that stream, including the new stream callback, runs on that
+ * service's thread. Listener callbacks must therefore be thread safe.
+ */
+class SIRIKATA_EXPORT IOServicePool:Noncopyable {
+    class Reactor;
+    std::vector<Reactor*> mReactors;
+  public:
+    ///Makes numServices services, or one per hardware thread if numServices is 0
+    IOServicePool(size_t numServices=0);
+    ///Stops and joins every service
+    ~IOServicePool();
+    size_t size()const {
+        return mReactors.size();
+    }
+    IOService* service(size_t which);
+    /**
+     * Runs services 1..size()-1 in threads of their own and service(0) in the calling thread.
+     * Returns once stop() is called.
+     */
+    void run();
+    ///Stops every service and joins the threads started by run()
+    void stop();
 };
 } }
 #endif
@@ -32,7 +32,19 @@
 
 #include "util/Standard.hh"
 #include "Stream.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
 namespace Sirikata { namespace Network {
+namespace {
+OptionValue*sStatsLogPeriod;
+InitializeGlobalOptions streamOptions("",
+    sStatsLogPeriod=new OptionValue("netstats","0",OptionValueType<double>(),"Seconds between logging the traffic counters of each connection, 0 to never log them"),
+    NULL
+);
+}
+Duration Stream::statsLogPeriod() {
+    return Duration::seconds(sStatsLogPeriod->as<double>());
+}
 void Stream::ignoreSubstreamCallback(Stream * stream, SetCallbacks&) {
     delete stream;
 }
@@ -48,6 +60,31 @@ void Stream::ignoreBytesReceived(const Chunk&c) {
     SILOG(tcpsst,debug,ss.str());
 #endif
 }
+namespace {
+void deliverChunkByReference(const Stream::BytesReferenceReceivedCallback&callback, const Chunk&chunk) {
+    MemoryReference data(chunk);
+    Stream::CopyReceivedBuffer buffer(data);
+    callback(data,buffer);
+}
+void deliverReferenceAsChunk(const Stream::BytesReceivedCallback&callback, MemoryReference, Stream::ReceivedBuffer&buffer) {
+    Chunk chunk;
+    buffer.take(chunk);
+    callback(chunk);
+}
+}
+Stream::BytesReceivedCallback Stream::chunkCallbackFor(const BytesReferenceReceivedCallback&callback) {
+    using std::tr1::placeholders::_1;
+    return std::tr1::bind(&deliverChunkByReference,callback,_1);
+}
+Stream::BytesReferenceReceivedCallback Stream::referenceCallbackFor(const BytesReceivedCallback&callback) {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    return std::tr1::bind(&deliverReferenceAsChunk,callback,_1,_2);
+}
+void Stream::SetCallbacks::setReferenceCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                                 const Stream::BytesReferenceReceivedCallback &bytesReceivedCallback) {
+    (*this)(connectionCallback,chunkCallbackFor(bytesReceivedCallback));
+}
 unsigned int Stream::StreamID::serialize(uint8 *destination, unsigned int maxsize) const{
     assert (maxsize>=MAX_SERIALIZED_LENGTH);
     assert (mID< (1 <<30));
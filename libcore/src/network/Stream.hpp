@@ -45,6 +45,39 @@ enum StreamReliability {
     ReliableOrdered
 };
 
+/**
+ * How a stream's packets share a connection with the packets of other streams.
+ * Higher priorities get a larger share of the bandwidth when sockets are backed up,
+ * but lower priorities are never starved.
+ */
+enum StreamPriority {
+    LowPriority,
+    NormalPriority,
+    HighPriority
+};
+
+/**
+ * A snapshot of the traffic counters of a stream or of the whole connection it belongs to.
+ * Byte counts cover message payloads only, not framing or control packets.
+ * Sent counts cover the messages the connection accepted, counted once accepted. An accepted
+ * unreliable message may still be superseded before it reaches the wire; unreliableDropped
+ * counts those along with the ones refused outright.
+ */
+class StreamStats {
+public:
+    uint64 bytesSent;
+    uint64 packetsSent;
+    uint64 bytesReceived;
+    uint64 packetsReceived;
+    ///unreliable packets dropped or superseded by later ones because the connection was backed up (connection only)
+    uint64 unreliableDropped;
+    ///bytes handed to the connection but not yet written to the network (connection only)
+    uint64 queuedBytes;
+    ///round trip time estimated by the transport, 0 if unknown (connection only)
+    uint32 roundTripMicroseconds;
+    StreamStats():bytesSent(0),packetsSent(0),bytesReceived(0),packetsReceived(0),
+                  unreliableDropped(0),queuedBytes(0),roundTripMicroseconds(0) {}
+};
 
 /**
  * This is the stream interface by which applications will send packets to the world
@@ -134,6 +167,34 @@ public:
     typedef std::tr1::function<void(ConnectionStatus,const std::string&reason)> ConnectionCallback;
     ///Callback type for when a full chunk of bytes are waiting on the stream
     typedef std::tr1::function<void(const Chunk&)> BytesReceivedCallback;
+    /**
+     * Passed to a BytesReferenceReceivedCallback alongside the received bytes,
+     * for receivers that want to keep the bytes after the callback returns.
+     */
+    class ReceivedBuffer : Noncopyable {
+    public:
+        virtual ~ReceivedBuffer(){}
+        /**
+         * Moves the received bytes into chunk. If the stream read them into a buffer of
+         * their own that buffer is swapped in; otherwise they are copied. The
+         * MemoryReference handed to the callback must not be used afterwards.
+         */
+        virtual void take(Chunk&chunk)=0;
+    };
+    ///A ReceivedBuffer for bytes that live in storage it does not own: take() always copies
+    class CopyReceivedBuffer : public ReceivedBuffer {
+        MemoryReference mData;
+    public:
+        explicit CopyReceivedBuffer(MemoryReference data):mData(data){}
+        virtual void take(Chunk&chunk) {
+            chunk.assign((const uint8*)mData.begin(),(const uint8*)mData.end());
+        }
+    };
+    /**
+     * Callback type for when a full chunk of bytes is waiting on the stream, handed over without copying it out of
+     * the stream's read buffer. The MemoryReference is only valid for the duration of the callback.
+     */
+    typedef std::tr1::function<void(MemoryReference,ReceivedBuffer&)> BytesReferenceReceivedCallback;
     /**
      *  This class is passed into any newSubstreamCallback functions so they may 
      *  immediately setup callbacks for connetion events and possibly start sending immediate responses.     
@@ -147,6 +208,12 @@ public:
          */
         virtual void operator()(const Stream::ConnectionCallback &connectionCallback,
                                 const Stream::BytesReceivedCallback &bytesReceivedCallback)=0;
+        /**
+         * Like operator(), but incoming bytes are delivered by reference into the stream's read buffer.
+         * Streams that cannot do so fall back on copying each chunk.
+         */
+        virtual void setReferenceCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                           const Stream::BytesReferenceReceivedCallback &bytesReceivedCallback);
     };
     /**
      * The substreamCallback must call SetCallbacks' operator() to activate the stream
@@ -160,6 +227,10 @@ public:
     static void ignoreConnectionStatus(ConnectionStatus status,const std::string&reason);
     ///Simple example function to ignore incoming bytes on a connection
     static void ignoreBytesReceived(const Chunk&);
+    ///Adapts a reference callback so it may be called with a Chunk
+    static BytesReceivedCallback chunkCallbackFor(const BytesReferenceReceivedCallback&);
+    ///Adapts a Chunk callback so it may be called with a reference: the bytes are taken from the ReceivedBuffer
+    static BytesReferenceReceivedCallback referenceCallbackFor(const BytesReceivedCallback&);
     /**
      * Will attempt to connect to the given provided address, specifying all callbacks for the first successful stream
      * The stream is immediately active and may have bytes sent on it immediately. 
@@ -199,6 +270,25 @@ public:
     virtual void send(MemoryReference, MemoryReference, StreamReliability)=0;
     ///Send a chunk of data to the receiver
     virtual void send(const Chunk&data,StreamReliability)=0;
+    /**
+     * Sends numMessages messages, each received as if it had been sent on its own, for the cost of a single send.
+     * Messages are delivered in order with respect to each other; unreliable batches are kept or dropped as a whole.
+     */
+    virtual void sendBatch(const MemoryReference*messages, size_t numMessages, StreamReliability)=0;
+    /**
+     * Sets the priority of packets sent on this stream from now on (streams start at NormalPriority).
+     * Packets already queued keep their place ahead of later packets of the stream.
+     */
+    virtual void setPriority(StreamPriority)=0;
+    ///Returns the traffic counters of this stream alone; may be called from any thread
+    virtual StreamStats getStats()const=0;
+    ///Returns the traffic counters of the connection this stream shares with its substreams; may be called from any thread
+    virtual StreamStats getConnectionStats()const=0;
+    /**
+     * How often connections log their traffic counters, set by the netstats option.
+     * A zero duration means they do not.
+     */
+    static Duration statsLogPeriod();
     ///close this stream: if it is the last stream, close the connection as well
     virtual void close()=0;
     virtual ~Stream(){};
@@ -43,9 +43,14 @@ typedef boost::asio::io_service InternalIOService;
 typedef boost::asio::ip::tcp::socket InternalTCPSocket;
 typedef  boost::asio::ip::tcp::acceptor InternalTCPAcceptor;
 class IOServiceFactory;
+class IOServicePool;
+class IOTimerWheel;
 
 class SIRIKATA_EXPORT IOService:public InternalIOService {
     friend class IOServiceFactory;
+    friend class IOServicePool;
+    IOTimerWheel *mTimers; ///< Backs IOServiceFactory::scheduleTimer.
+    IOServicePool *mPool; ///< The pool this service belongs to, if any.
     IOService();
     ~IOService();
 public:
@@ -284,7 +284,10 @@ public:
 				 if (options.count(i->first)){
                      const simple_string* s=boost::any_cast<simple_string>(&options[i->first].value());
                      assert(s!=NULL);
+                     Any oldValue=i->second->mValue;
                      HolderStash::getSingleton().hideUntilQuit(i->first,i->second->mValue.newAndDoNotFree(i->second->mParser(*s)));
+                     if (i->second->mChangeFunction)
+                         i->second->mChangeFunction(i->first,oldValue,i->second->mValue);
 				 }
         }
         return true;
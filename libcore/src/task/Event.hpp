@@ -178,6 +178,12 @@ public:
 			return mId == other.mId;
 		}
 
+		/** The small integer this name was interned to. IDs are handed
+		 * out densely starting from 0, so this can index an array. */
+		inline int index() const {
+			return mId;
+		}
+
 		/// Trivial hasher functor to be used in a hash_map.
 		struct Hasher {
 			size_t operator() (const Primary &pri) const{
@@ -74,10 +74,18 @@ struct EventManager<T>::ListenerUnsubRequest : public WorkItem {
 		} else {
 			EventSubscriptionInfo &subInfo = (*iter).second;
 			SILOG(task,debug,"**** Unsubscribe " << mListenerId);
-			if (mNotifyListener) {
-				(*subInfo.mIter).first(EventPtr());
+			ListenerList *list = subInfo.mList;
+			for (size_t i = 0; i < list->size(); ++i) {
+				if (!(*list)[i].mDead && (*list)[i].mId == mListenerId) {
+					if (mNotifyListener) {
+						(*list)[i].mListener(EventPtr());
+					}
+					subInfo.mLists->kill((*list)[i]);
+					break;
+				}
 			}
-			subInfo.mList->erase(subInfo.mIter);
+			// Subscription requests only run outside of dispatch.
+			subInfo.mLists->compact();
 			if (subInfo.secondaryMap) {
 				SILOG(task,debug," with Secondary ID " <<
 						  subInfo.secondaryId << std::endl << "\t");
@@ -132,25 +140,25 @@ struct EventManager<T>::ListenerSubRequest : public WorkItem {
 		AutoPtr ref(this); // Allow deletion at the end.
 
 		PrimaryListenerInfo *newPrimary = mParent->insertPriId(mEventId.mPriId);
-		ListenerList *insertList;
+		PartiallyOrderedListenerList *insertLists;
 		SecondaryListenerMap *secondListeners = NULL;
 		if (mOnlyPrimary) {
-			insertList = &(newPrimary->first.get(mWhichOrder));
+			insertLists = &(newPrimary->first);
 		} else {
 			secondListeners = &(newPrimary->second);
 			typename SecondaryListenerMap::iterator secondIter =
 				mParent->insertSecId(*secondListeners, mEventId.mSecId);
-			insertList = &((*secondIter).second->get(mWhichOrder));
+			insertLists = (*secondIter).second;
 		}
-		typename ListenerList::iterator iter =
-			mParent->addListener(insertList, mListenerFunc, mListenerId);
+		ListenerList *insertList = &(insertLists->get(mWhichOrder));
+		mParent->addListener(insertList, mListenerFunc, mListenerId);
 
 		if (mListenerId != SubscriptionIdClass::null()) {
 			mParent->mRemoveById.insert(
 				typename RemoveMap::value_type(mListenerId,
 					EventSubscriptionInfo(
+						insertLists,
 						insertList,
-						iter,
 						secondListeners,
 						mEventId.mSecId)));
 		}
@@ -169,70 +177,57 @@ struct EventManager<T>::FireEvent : public WorkItem {
 	}
 
 	virtual void operator() () {
-		AutoPtr ref(this); // Allow deletion at the end.
-
-		mParent->mSubscriptionQueue->dequeueAll();
+		EventManager<T> *parent = mParent;
+		EventPtr event;
+		event.swap(mEvent);
+		// Hand ourselves back before dispatching, so listeners that fire
+		// more events can reuse this item.
+		parent->releaseFireEvent(this);
+		parent->dispatchEvent(event);
+	}
+};
 
-		typename PrimaryListenerMap::iterator priIter =
-			mParent->mListeners.find(mEvent->getId().mPriId);
-		if (priIter == mParent->mListeners.end()) {
-			SILOG(task,insane," >>>\tNo listeners for type " <<
-                  "event type " << mEvent->getId().mPriId);
-			return;
-		}
+template <class T>
+struct EventManager<T>::FireBatch : public WorkItem {
+	EventManager<T> *mParent;
+	typedef typename EventManager<T>::EventPtr EventPtr;
+	std::vector<EventPtr> mEvents;
 
-		PartiallyOrderedListenerList *primaryLists =
-			&((*priIter).second->first);
-		SecondaryListenerMap *secondaryMap =
-			&((*priIter).second->second);
-
-		typename SecondaryListenerMap::iterator secIter;
-		secIter = secondaryMap->find(mEvent->getId().mSecId);
-
-        bool cancel = false;
-        EventHistory eventHistory=EVENT_UNHANDLED;
-		// Call once per event order.
-		for (int i = 0; i < NUM_EVENTORDER && cancel == false; i++) {
-			SILOG(task,insane," >>>\tFiring " << mEvent << ": " << mEvent->getId() <<
-                  " [order " << i << "]");
-			ListenerList *currentList = &(primaryLists->get(i));
-			if (!currentList->empty())
-				eventHistory=EVENT_HANDLED;
-			if (mParent->callAllListeners(mEvent, currentList)) {
-				cancel = cancel || true;
-			}
+	FireBatch(EventManager<T> *parent,
+			  const std::vector<EventPtr> &events)
+		: mParent(parent), mEvents(events) {
+	}
 
-			if (secIter != secondaryMap->end() &&
-					!(*secIter).second->get(i).empty()) {
-				currentList = &((*secIter).second->get(i));
-				if (!currentList->empty())
-					eventHistory=EVENT_HANDLED;
+	virtual void operator() () {
+		AutoPtr ref(this); // Allow deletion at the end.
+		mParent->dispatchBatch(mEvents);
+	}
+};
 
-				if (mParent->callAllListeners(mEvent, currentList)) {
-					cancel = cancel || true;
+template <class T>
+void EventManager<T>::PartiallyOrderedListenerList::compact() {
+	if (mNumDead == 0) {
+		return;
+	}
+	for (int i = 0; i < NUM_EVENTORDER; i++) {
+		ListenerList &list = ll[i];
+		size_t out = 0;
+		for (size_t in = 0; in < list.size(); ++in) {
+			if (!list[in].mDead) {
+				if (out != in) {
+					list[out] = list[in];
 				}
-				// all listeners may have returned false.
-				// cleanUp(secondaryMap, secIter);
-				// secIter = secondaryMap->find(ev->getId().mSecId);
-			}
-
-			if (cancel) {
-				SILOG(task,insane," >>>\tCancelling " << mEvent->getId());
+				++out;
 			}
 		}
-		if (secIter != secondaryMap->end()) {
-			mParent->cleanUp(secondaryMap, secIter);
-		}
-
-        if (cancel) eventHistory=EVENT_CANCELED;
-        (*mEvent)(eventHistory);
-		SILOG(task,insane," >>>\tFinished " << mEvent->getId());
+		list.erase(list.begin() + out, list.end());
 	}
-};
+	mNumDead = 0;
+}
 
 template <class T>
 EventManager<T>::EventManager(WorkQueue *workQueue)
-		: mWorkQueue(workQueue) {
+		: mWorkQueue(workQueue), mDispatchDepth(0), mNumFreeFireEvents(0) {
 	mSubscriptionQueue = new LockFreeWorkQueue;
 }
 
@@ -241,13 +236,20 @@ EventManager<T>::~EventManager() {
 	typename PrimaryListenerMap::iterator iter;
 	typename SecondaryListenerMap::iterator secIter;
 	for (iter = mListeners.begin(); iter != mListeners.end(); ++iter) {
-		SecondaryListenerMap *secMap = &((*iter).second->second);
+		if (*iter == NULL) {
+			continue;
+		}
+		SecondaryListenerMap *secMap = &((*iter)->second);
 		for (secIter = secMap->begin(); secIter != secMap->end(); ++secIter) {
 			delete (*secIter).second;
 		}
-		delete (*iter).second;
+		delete (*iter);
 	}
 	mListeners.clear();
+	FireEvent *fe;
+	while (mFreeFireEvents.pop(fe)) {
+		delete fe;
+	}
 	delete mSubscriptionQueue;
 }
 
@@ -259,14 +261,14 @@ typename EventManager<T>::PrimaryListenerInfo *
 	EventManager<T>::insertPriId(
 			const IdPair::Primary &pri)
 {
-	typename PrimaryListenerMap::iterator iter = mListeners.find(pri);
-	if (iter == mListeners.end()) {
-		iter = mListeners.insert(
-			typename PrimaryListenerMap::value_type(
-				pri, new PrimaryListenerInfo)
-			).first;
+	size_t index = (size_t)pri.index();
+	if (index >= mListeners.size()) {
+		mListeners.resize(index + 1, NULL);
+	}
+	if (mListeners[index] == NULL) {
+		mListeners[index] = new PrimaryListenerInfo;
 	}
-	return (*iter).second;
+	return mListeners[index];
 }
 
 
@@ -355,19 +357,18 @@ SubscriptionId EventManager<T>::subscribeId(
 /**
  * Standard function to add a listener to a ListenerList.
  *
- * Note that we use push_front so as not to disrupt any
- * events currently being processed (and possibly go in
- * an infinite loop, due to a stupid listener adding another
- * copy of itself back into the end).
+ * Listeners are appended, and callAllListeners walks lists from the back,
+ * so the newest listener is called first.  Subscriptions are never
+ * processed while an event is being dispatched, so this can not disrupt
+ * an event currently being processed (and possibly go in an infinite loop,
+ * due to a stupid listener adding another copy of itself).
  */
 template <class T>
-typename EventManager<T>::ListenerList::iterator
-EventManager<T>::addListener(ListenerList *insertList,
+void EventManager<T>::addListener(ListenerList *insertList,
 		const EventListener &listener,
 		SubscriptionId removeId)
 {
-	return insertList->insert( insertList->begin(),
-		ListenerSubscriptionInfo(listener, removeId));
+	insertList->push_back(ListenerSubscriptionInfo(listener, removeId));
 }
 
 // ============= UNSUBSCRIPTION FUNCTIONS ==============
@@ -402,10 +403,7 @@ bool EventManager<T>::cleanUp(
 	SecondaryListenerMap *slm,
 	typename SecondaryListenerMap::iterator &slm_iter)
 {
-	bool isEmpty = true;
-	for (int i = 0; i < NUM_EVENTORDER; i++) {
-		isEmpty = isEmpty && (*slm_iter).second->get(i).empty();
-	}
+	bool isEmpty = (*slm_iter).second->empty();
 	if (isEmpty) {
 		SILOG(task,debug,"[Cleaning up Secondary ID " << (*slm_iter).first << "]");
 		delete (*slm_iter).second;
@@ -417,50 +415,222 @@ bool EventManager<T>::cleanUp(
 
 // =============== EVENT QUEUE FUNCTIONS ===============
 
+template <class T>
+typename EventManager<T>::FireEvent *EventManager<T>::allocateFireEvent(const EventPtr &ev) {
+	FireEvent *fe;
+	if (mFreeFireEvents.pop(fe)) {
+		--mNumFreeFireEvents;
+		fe->mEvent = ev;
+		return fe;
+	}
+	return new FireEvent(this, ev);
+}
+
+template <class T>
+void EventManager<T>::releaseFireEvent(FireEvent *fe) {
+	if (mNumFreeFireEvents.read() >= MAX_FREE_FIRE_EVENTS) {
+		delete fe;
+		return;
+	}
+	++mNumFreeFireEvents;
+	mFreeFireEvents.push(fe);
+}
+
 template <class T>
 void EventManager<T>::fire(EventPtr ev) {
-	mWorkQueue->enqueue(new FireEvent(this, ev));
+	mWorkQueue->enqueue(allocateFireEvent(ev));
 	SILOG(task,insane,"**** Firing event " << (void*)(&(*ev)) <<
 		" with " << ev->getId());
 };
 
+template <class T>
+void EventManager<T>::processSubscriptions() {
+	if (mDispatchDepth == 0 && !mSubscriptionQueue->probablyEmpty()) {
+		mSubscriptionQueue->dequeueAll();
+	}
+}
+
+template <class T>
+void EventManager<T>::fireBatch(const std::vector<EventPtr> &events) {
+	if (events.empty()) {
+		return;
+	}
+	mWorkQueue->enqueue(new FireBatch(this, events));
+	SILOG(task,insane,"**** Firing batch of " << events.size() << " events");
+}
+
+template <class T>
+typename EventManager<T>::PrimaryListenerInfo *
+	EventManager<T>::findPriId(const IdPair::Primary &pri)
+{
+	size_t priIndex = (size_t)pri.index();
+	if (priIndex >= mListeners.size()) {
+		return NULL;
+	}
+	return mListeners[priIndex];
+}
+
+template <class T>
+void EventManager<T>::compactLists(PrimaryListenerInfo *info,
+			const IdPair::Secondary &sec) {
+	info->first.compact();
+	SecondaryListenerMap *secondaryMap = &(info->second);
+	typename SecondaryListenerMap::iterator secIter = secondaryMap->find(sec);
+	if (secIter != secondaryMap->end()) {
+		(*secIter).second->compact();
+		cleanUp(secondaryMap, secIter);
+	}
+}
+
+template <class T>
+void EventManager<T>::dispatchEvent(const EventPtr &ev) {
+	processSubscriptions();
+
+	PrimaryListenerInfo *info = findPriId(ev->getId().mPriId);
+	if (info == NULL) {
+		SILOG(task,insane," >>>\tNo listeners for type " <<
+              "event type " << ev->getId().mPriId);
+		return;
+	}
+
+	SecondaryListenerMap *secondaryMap = &(info->second);
+	typename SecondaryListenerMap::iterator secIter;
+	secIter = secondaryMap->find(ev->getId().mSecId);
+
+	++mDispatchDepth;
+	deliverEvent(ev, &(info->first),
+		(secIter == secondaryMap->end()) ? NULL : (*secIter).second);
+	--mDispatchDepth;
+
+	if (mDispatchDepth == 0) {
+		compactLists(info, ev->getId().mSecId);
+	}
+}
+
+template <class T>
+void EventManager<T>::dispatchBatch(const std::vector<EventPtr> &events) {
+	processSubscriptions();
+
+	PrimaryListenerInfo *info = NULL;
+	PartiallyOrderedListenerList *secondaryLists = NULL;
+	const IdPair *lastId = NULL;
+
+	++mDispatchDepth;
+	for (size_t i = 0; i < events.size(); ++i) {
+		const EventPtr &ev = events[i];
+		const IdPair &id = ev->getId();
+		// Listener tables do not change shape while mDispatchDepth > 0,
+		// so lookups can be reused for a run of events with the same id.
+		if (lastId == NULL || !(id.mPriId == lastId->mPriId)) {
+			info = findPriId(id.mPriId);
+			lastId = NULL;
+		}
+		if (info == NULL) {
+			SILOG(task,insane," >>>\tNo listeners for type " <<
+				  "event type " << id.mPriId);
+			continue;
+		}
+		if (lastId == NULL || !(id.mSecId == lastId->mSecId)) {
+			typename SecondaryListenerMap::iterator secIter =
+				info->second.find(id.mSecId);
+			secondaryLists = (secIter == info->second.end()) ?
+				NULL : (*secIter).second;
+		}
+		lastId = &id;
+		deliverEvent(ev, &(info->first), secondaryLists);
+	}
+	--mDispatchDepth;
+
+	if (mDispatchDepth == 0) {
+		lastId = NULL;
+		for (size_t i = 0; i < events.size(); ++i) {
+			const IdPair &id = events[i]->getId();
+			if (lastId != NULL && id == *lastId) {
+				continue;
+			}
+			lastId = &id;
+			info = findPriId(id.mPriId);
+			if (info) {
+				compactLists(info, id.mSecId);
+			}
+		}
+	}
+}
+
+template <class T>
+void EventManager<T>::deliverEvent(const EventPtr &ev,
+			PartiallyOrderedListenerList *primaryLists,
+			PartiallyOrderedListenerList *secondaryLists) {
+	bool cancel = false;
+	EventHistory eventHistory=EVENT_UNHANDLED;
+	// Call once per event order.
+	for (int i = 0; i < NUM_EVENTORDER && cancel == false; i++) {
+		SILOG(task,insane," >>>\tFiring " << ev << ": " << ev->getId() <<
+              " [order " << i << "]");
+		ListenerList *currentList = &(primaryLists->get(i));
+		if (!currentList->empty())
+			eventHistory=EVENT_HANDLED;
+		if (callAllListeners(ev, primaryLists, currentList)) {
+			cancel = true;
+		}
+
+		if (secondaryLists && !secondaryLists->get(i).empty()) {
+			currentList = &(secondaryLists->get(i));
+			eventHistory=EVENT_HANDLED;
+
+			if (callAllListeners(ev, secondaryLists, currentList)) {
+				cancel = true;
+			}
+		}
+
+		if (cancel) {
+			SILOG(task,insane," >>>\tCancelling " << ev->getId());
+		}
+	}
+
+	if (cancel) eventHistory=EVENT_CANCELED;
+	(*ev)(eventHistory);
+	SILOG(task,insane," >>>\tFinished " << ev->getId());
+}
+
 
 /* FIXME: We need a "never" constant for AbsTime that is
    always grreater than anything else */
 
 template <class T>
-bool EventManager<T>::callAllListeners(EventPtr ev,
+bool EventManager<T>::callAllListeners(const EventPtr &ev,
+			PartiallyOrderedListenerList *lists,
 			ListenerList *lili) {
 
 	bool cancel = false;
-	typename ListenerList::iterator iter = lili->begin();
-	/* Disallow 'unsubscribe()' while in this while loop.
-	 * We make a temporary mUnsubscribe list, and unsubscribe all
-	 * of them after we are done here.
-	 *
-	 * The reason for this is 'iter' or 'next' may end up getting
-	 * deleted in the process.
+	/* The list can not grow or shrink while we are in here: subscription
+	 * requests wait until no event is being dispatched, and removed
+	 * listeners are only marked dead until the list is compacted.
 	 */
 	SILOG(task,insane," >>>\tHas " << lili->size() <<
 		" Listeners registered.");
-	while (iter!=lili->end()) {
-		typename ListenerList::iterator next = iter;
-		++next;
+	size_t i = lili->size();
+	while (i > 0) {
+		--i;
+		if ((*lili)[i].mDead) {
+			continue;
+		}
 		// Now call the event listener.
-		SILOG(task,insane," >>>\tCalling " << (*iter).second <<"...");
-		EventResponse resp = (*iter).first(ev);
+		SILOG(task,insane," >>>\tCalling " << (*lili)[i].mId <<"...");
+		EventResponse resp = (*lili)[i].mListener(ev);
+		ListenerSubscriptionInfo &info = (*lili)[i];
 		if (((int)resp.mResp) & EventResponse::DELETE_LISTENER) {
 			if (((int)resp.mResp) & EventResponse::CANCEL_EVENT) {
 				SILOG(task,insane," >>>\t\tReturned DELETE_LISTENER and CANCEL_EVENT");
 			} else {
 				SILOG(task,insane," >>>\t\tReturned DELETE_LISTENER");
 			}
-			if ((*iter).second != SubscriptionIdClass::null()) {
-				clearRemoveId((*iter).second);
+			if (!info.mDead && info.mId != SubscriptionIdClass::null()) {
+				clearRemoveId(info.mId);
 				// We do not want to send a NULL message to it.
 				// if we are removing due to return value.
 			}
-			lili->erase(iter);
+			lists->kill(info);
 		}
 		if (((int)resp.mResp) & EventResponse::CANCEL_EVENT) {
 			if (!(((int)resp.mResp) & EventResponse::DELETE_LISTENER)) {
@@ -468,7 +638,6 @@ bool EventManager<T>::callAllListeners(EventPtr ev,
 			}
 			cancel = true;
 		}
-		iter = next;
 	}
 	return cancel;
 }
@@ -147,49 +147,73 @@ public:
 
 private:
 
-	/// if the listener does not corresond to an id, use SubscriptionId::null().
-	typedef std::pair<EventListener, SubscriptionId> ListenerSubscriptionInfo;
-	typedef std::list<ListenerSubscriptionInfo> ListenerList;
+	/** One subscribed listener. If the listener does not correspond to an
+	 * id, mId is SubscriptionId::null(). Removed listeners are only marked
+	 * dead while an event is being dispatched, and compacted away later. */
+	struct ListenerSubscriptionInfo {
+		EventListener mListener;
+		SubscriptionId mId;
+		bool mDead;
+
+		ListenerSubscriptionInfo(const EventListener &listener, SubscriptionId id)
+			: mListener(listener), mId(id), mDead(false) {
+		}
+	};
+	/** Stored contiguously. Newest listeners are at the back, and lists are
+	 * walked back to front so newer listeners still run first. */
+	typedef std::vector<ListenerSubscriptionInfo> ListenerList;
 
-	/** Since std::map is free to reallocate its elements at its own choosing
-	 this class must be a pointer, not a statically-allocated array. (we want
-	 to be able to carry ListenerList iterators around) */
+	/** Since the maps are free to reallocate their elements at their own
+	 choosing this class must be a pointer, not a statically-allocated array.
+	 (we want to be able to carry ListenerList pointers around) */
 	class PartiallyOrderedListenerList {
 		ListenerList ll[NUM_EVENTORDER];
+		unsigned int mNumDead;
 	public:
+		PartiallyOrderedListenerList() : mNumDead(0) {
+		}
 		ListenerList &get (size_t i) {
 			return ll[i];
 		}
-		//ListenerList &operator [] (size_t i) {
-		//	return ll[i];
-		//}
+		/// Marks entry as removed; it stays in place until compact().
+		void kill(ListenerSubscriptionInfo &entry) {
+			if (!entry.mDead) {
+				entry.mDead = true;
+				++mNumDead;
+			}
+		}
+		/// Erases dead entries. Must not be called during dispatch.
+		void compact();
+		/// @returns true if no live listeners are left.
+		bool empty() const {
+			size_t total = 0;
+			for (int i = 0; i < NUM_EVENTORDER; i++) {
+				total += ll[i].size();
+			}
+			return total == mNumDead;
+		}
 	};
 
 	typedef std::tr1::unordered_map<IdPair::Secondary,
 				PartiallyOrderedListenerList*,
 				IdPair::Secondary::Hasher> SecondaryListenerMap;
 	typedef std::pair<PartiallyOrderedListenerList, SecondaryListenerMap> PrimaryListenerInfo;
-	typedef std::map<IdPair::Primary, PrimaryListenerInfo*> PrimaryListenerMap;
+	/// Indexed by IdPair::Primary::index(); NULL where nobody subscribed.
+	typedef std::vector<PrimaryListenerInfo*> PrimaryListenerMap;
 
 	struct SIRIKATA_EXPORT EventSubscriptionInfo {
+		PartiallyOrderedListenerList *mLists;
 		ListenerList *mList;
-		typename ListenerList::iterator mIter;
 
 		// used for garbage collection after unsubscribing.
 		SecondaryListenerMap *secondaryMap;
 		IdPair::Secondary secondaryId;
 
-		EventSubscriptionInfo(ListenerList *list,
-					typename ListenerList::iterator &iter)
-			: mList(list), mIter(iter),
-			  secondaryMap(NULL), secondaryId(IdPair::Secondary::null()) {
-		}
-
-		EventSubscriptionInfo(ListenerList *list,
-					typename ListenerList::iterator &iter,
+		EventSubscriptionInfo(PartiallyOrderedListenerList *lists,
+					ListenerList *list,
 					SecondaryListenerMap *slm,
 					const IdPair::Secondary &slmKey)
-			: mList(list), mIter(iter),
+			: mLists(lists), mList(list),
 			 secondaryMap(slm), secondaryId(slmKey) {
 		}
 	};
@@ -198,9 +222,11 @@ private:
 	struct ListenerSubRequest;
 	struct ListenerUnsubRequest;
 	struct FireEvent;
+	struct FireBatch;
 	friend struct ListenerSubRequest;
 	friend struct ListenerUnsubRequest;
 	friend struct FireEvent;
+	friend struct FireBatch;
 
 	/* MEMBERS */
 
@@ -211,6 +237,15 @@ private:
 
 	RemoveMap mRemoveById; ///< Used for unsubscribe: always keep in sync.
 
+	/** How many FireEvents are on the stack. Listener lists are only
+	 * added to, erased from or deleted while this is 0. */
+	int mDispatchDepth;
+
+	/// Recycled FireEvent work items, so fire() does not allocate.
+	enum {MAX_FREE_FIRE_EVENTS=256};
+	LockFreeQueue<FireEvent*> mFreeFireEvents;
+	AtomicValue<int> mNumFreeFireEvents;
+
 	/* PRIVATE FUNCTIONS */
 
 	PrimaryListenerInfo *insertPriId(const IdPair::Primary &pri);
@@ -229,13 +264,39 @@ private:
 	bool cleanUp(SecondaryListenerMap *slm,
 				typename SecondaryListenerMap::iterator &slm_iter);
 
-	typename ListenerList::iterator
-		addListener(ListenerList *insertList,
+	/** Processes pending subscribe/unsubscribe requests, unless an event
+	 * is currently being dispatched. */
+	void processSubscriptions();
+
+	void addListener(ListenerList *insertList,
 				const EventListener &listener,
 				SubscriptionId removeId);
 
-	bool callAllListeners(EventPtr ev,
+	bool callAllListeners(const EventPtr &ev,
+				PartiallyOrderedListenerList *lists,
 				ListenerList *lili);
+
+	/// Returns NULL if nothing ever subscribed to pri.
+	PrimaryListenerInfo *findPriId(const IdPair::Primary &pri);
+
+	/** Calls the listeners in primaryLists and secondaryLists (may be NULL)
+	 * in EARLY/MIDDLE/LATE order, then notifies ev of the outcome. */
+	void deliverEvent(const EventPtr &ev,
+				PartiallyOrderedListenerList *primaryLists,
+				PartiallyOrderedListenerList *secondaryLists);
+
+	/** Compacts the lists an event with secondary id sec was delivered
+	 * to. Must only be called when no event is being dispatched. */
+	void compactLists(PrimaryListenerInfo *info, const IdPair::Secondary &sec);
+
+	/// Calls all listeners for ev. Runs inside a FireEvent work item.
+	void dispatchEvent(const EventPtr &ev);
+
+	/// Calls all listeners for each event in order, in one work item.
+	void dispatchBatch(const std::vector<EventPtr> &events);
+
+	FireEvent *allocateFireEvent(const EventPtr &ev);
+	void releaseFireEvent(FireEvent *fe);
 public:
 
 	EventManager(WorkQueue *queue);
@@ -351,6 +412,22 @@ public:
 	 */
 	void fire(EventPtr ev);
 
+	/**
+	 * Fires a group of events from a single work item. Listener lists are
+	 * looked up once for each run of events sharing an IdPair, and events
+	 * are delivered in the order given, each with the same EARLY, MIDDLE,
+	 * LATE ordering and cancel semantics as fire().
+	 *
+	 * @param events  the events to fire; the vector is copied.
+	 */
+	void fireBatch(const std::vector<EventPtr> &events);
+
+	/// Fires every EventPtr in [begin, end) as one batch.
+	template <class Iterator>
+	void fireBatch(Iterator begin, Iterator end) {
+		fireBatch(std::vector<EventPtr>(begin, end));
+	}
+
 };
 
 /**
@@ -0,0 +1,224 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  Scheduler.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "Scheduler.hpp"
+#include "WorkQueue.hpp"
+
+namespace Sirikata {
+namespace Task {
+
+FrameScheduler::TaskInfo::TaskInfo(SubscriptionId myId, const TaskFunction &myFunc)
+	: id(myId), func(myFunc), priority(0), ready(false), dead(false),
+	  skippedFrames(0), numTimes(0), nextTime(0) {
+}
+
+void FrameScheduler::TaskInfo::recordTime(const DeltaTime &runTime) {
+	if (numTimes == NUM_AVERAGES) {
+		totalTime -= lastTimes[nextTime];
+	} else {
+		++numTimes;
+	}
+	lastTimes[nextTime] = runTime;
+	totalTime += runTime;
+	nextTime = (nextTime + 1) % NUM_AVERAGES;
+}
+
+DeltaTime FrameScheduler::TaskInfo::expectedTime() const {
+	if (numTimes == 0) {
+		return DeltaTime::zero();
+	}
+	DeltaTime expected = totalTime / (float64)numTimes;
+	if (budget > DeltaTime::zero() && budget < expected) {
+		return budget;
+	}
+	return expected;
+}
+
+FrameScheduler::FrameScheduler(WorkQueue *queue)
+	: mWorkQueue(queue), mInFrame(false) {
+}
+
+FrameScheduler::~FrameScheduler() {
+	for (TaskIdMap::iterator iter = mTaskIdMap.begin(); iter != mTaskIdMap.end(); ++iter) {
+		delete (*iter).second;
+	}
+	for (size_t i = 0; i < mDeadTasks.size(); ++i) {
+		delete mDeadTasks[i];
+	}
+}
+
+FrameScheduler::TaskInfo *FrameScheduler::findTask(SubscriptionId taskId) {
+	TaskIdMap::iterator iter = mTaskIdMap.find(taskId);
+	if (iter == mTaskIdMap.end()) {
+		return NULL;
+	}
+	return (*iter).second;
+}
+
+SubscriptionId FrameScheduler::createTask(const TaskFunction &func) {
+	return createTask(func, 0, DeltaTime::zero());
+}
+
+SubscriptionId FrameScheduler::createTask(const TaskFunction &func,
+			int prio, const DeltaTime &budget) {
+	SubscriptionId myId = SubscriptionIdClass::alloc();
+	TaskInfo *ti = new TaskInfo(myId, func);
+	ti->priority = prio;
+	ti->budget = budget;
+	mTaskIdMap.insert(TaskIdMap::value_type(myId, ti));
+	return myId;
+}
+
+void FrameScheduler::readyTask(SubscriptionId taskId) {
+	TaskInfo *ti = findTask(taskId);
+	if (ti && !ti->ready) {
+		ti->ready = true;
+		ti->readyIter = mReadyQueue.insert(mReadyQueue.end(), ti);
+	}
+}
+
+void FrameScheduler::sleepTask(SubscriptionId taskId) {
+	TaskInfo *ti = findTask(taskId);
+	if (ti && ti->ready) {
+		ti->ready = false;
+		mReadyQueue.erase(ti->readyIter);
+	}
+}
+
+void FrameScheduler::destroyTask(SubscriptionId taskId) {
+	TaskIdMap::iterator iter = mTaskIdMap.find(taskId);
+	if (iter == mTaskIdMap.end()) {
+		return;
+	}
+	TaskInfo *ti = (*iter).second;
+	sleepTask(taskId);
+	mTaskIdMap.erase(iter);
+	SubscriptionIdClass::free(taskId);
+	if (mInFrame) {
+		// runFrame may still hold a pointer to it.
+		ti->dead = true;
+		mDeadTasks.push_back(ti);
+	} else {
+		delete ti;
+	}
+}
+
+void FrameScheduler::setPriority(SubscriptionId taskId, int prio) {
+	TaskInfo *ti = findTask(taskId);
+	if (ti) {
+		ti->priority = prio;
+	}
+}
+
+void FrameScheduler::setBudget(SubscriptionId taskId, const DeltaTime &budget) {
+	TaskInfo *ti = findTask(taskId);
+	if (ti) {
+		ti->budget = budget;
+	}
+}
+
+DeltaTime FrameScheduler::expectedTime(SubscriptionId taskId) {
+	TaskInfo *ti = findTask(taskId);
+	if (ti) {
+		return ti->expectedTime();
+	}
+	return DeltaTime::zero();
+}
+
+void FrameScheduler::runFrame(AbsTime frameEnd) {
+	mInFrame = true;
+
+	DeltaTime expectedTotal = DeltaTime::zero();
+	mFrameTasks.clear();
+	for (TaskList::iterator iter = mReadyQueue.begin(); iter != mReadyQueue.end(); ++iter) {
+		mFrameTasks.push_back(*iter);
+		expectedTotal += (*iter)->expectedTime();
+	}
+	// stable, so that equal priorities keep their turn order.
+	std::stable_sort(mFrameTasks.begin(), mFrameTasks.end(), PriorityOrder());
+
+	AbsTime now = AbsTime::now();
+	if (mWorkQueue) {
+		AbsTime workDeadline = frameEnd - expectedTotal;
+		if (now < workDeadline) {
+			mWorkQueue->dequeueUntil(workDeadline);
+			now = AbsTime::now();
+		}
+	}
+
+	for (size_t i = 0; i < mFrameTasks.size(); ++i) {
+		TaskInfo *ti = mFrameTasks[i];
+		if (ti->dead || !ti->ready) {
+			continue;
+		}
+		// A task that has never run has nothing to be skipped on.
+		if (ti->numTimes > 0 && now + ti->expectedTime() > frameEnd &&
+				ti->skippedFrames < MAX_SKIPPED_FRAMES) {
+			++ti->skippedFrames;
+			continue;
+		}
+		AbsTime taskDeadline = frameEnd;
+		if (ti->budget > DeltaTime::zero() && now + ti->budget < frameEnd) {
+			taskDeadline = now + ti->budget;
+		}
+
+		bool more = ti->func(taskDeadline);
+
+		AbsTime after = AbsTime::now();
+		ti->recordTime(after - now);
+		ti->skippedFrames = 0;
+		now = after;
+		if (ti->dead || !ti->ready) {
+			continue; // Destroyed or put to sleep while running.
+		}
+		// Go to the back of the line for the next frame.
+		mReadyQueue.erase(ti->readyIter);
+		ti->ready = false;
+		if (more) {
+			readyTask(ti->id);
+		}
+	}
+
+	if (mWorkQueue && now < frameEnd) {
+		mWorkQueue->dequeueUntil(frameEnd);
+	}
+
+	mInFrame = false;
+	for (size_t i = 0; i < mDeadTasks.size(); ++i) {
+		delete mDeadTasks[i];
+	}
+	mDeadTasks.clear();
+}
+
+}
+}
@@ -34,44 +34,59 @@
 #define SIRIKATA_Scheduler_HPP__
 
 #include "Time.hpp"
+#include "UniqueId.hpp"
 
 namespace Sirikata {
 namespace Task {
 
+class WorkQueue;
+
 /**
  * TaskFunction represents a runnable task that will is a bound
  * std::tr1::function to some class that needs to be run whenever it
  * needs processing time.  NOTE: Because this interface needs to be fast
- * and should be kept simple,
+ * and should be kept simple, tasks are expected to check the deadline
+ * themselves and return once they pass it.
  *
  * @param AbsTime  When the task should aim to finish.
  * @returns        'true' if the task should remain on the ready queue
  *                 (if it needs more time), or false if it should sleep.
  */
-typedef std::tr1::function1<bool(AbsTime)> TaskFunction;
+typedef std::tr1::function<bool(AbsTime)> TaskFunction;
 
 /// Scheduler interface
-class Scheduler {
+class SIRIKATA_EXPORT Scheduler {
 public:
-	/** Create a task. */
-	SubscriptionId createTask(TaskFunction func) = 0;
+	virtual ~Scheduler() {}
+
+	/** Create a task. It starts out asleep. */
+	virtual SubscriptionId createTask(const TaskFunction &func) = 0;
 
 	/** Put the task in the ready queue to be run at regular intervals. */
-	void readyTask(SubscriptionId taskId) = 0;
+	virtual void readyTask(SubscriptionId taskId) = 0;
 
 	/** A task has nothing to do (or is waiting for some event). */
-	void sleepTask(SubscriptionId taskId) = 0;
+	virtual void sleepTask(SubscriptionId taskId) = 0;
+
+	/** Destroy the task associated with 'taskId'. May be called from
+	 * inside a running task, including on itself. */
+	virtual void destroyTask(SubscriptionId taskId) = 0;
 
-	/** Destroy the task associated with 'taskId'. */
-	void destroyTask(SubscriptionId taskId) = 0;
+	/** Higher priority tasks are run first. The default is 0. */
+	virtual void setPriority(SubscriptionId taskId, int prio) = 0;
 
-	//void setPriority(SubscriptionId taskId, int prio) = 0;
+	/**
+	 * Runs ready tasks between frames.
+	 *
+	 * @param frameEnd  When the next frame must start.
+	 */
+	virtual void runFrame(AbsTime frameEnd) = 0;
 };
 
 
 /** Scheduler runs through the queue in the order that tasks were made
- * ready. */
-class RoundRobinScheduler : Scheduler {
+ * ready, giving each task the rest of the frame. Priorities are ignored. */
+class RoundRobinScheduler : public Scheduler {
 	struct TaskInfo;
 
 	typedef std::list<TaskInfo*> FunctionList;
@@ -83,18 +98,24 @@ class RoundRobinScheduler : Scheduler {
 		TaskFunction func;
 		FunctionList *activeQueue;
 		FunctionList::iterator removeIter;
-
-		/* Help scheduler decide how much time to allocate btwn frames */
-		//DeltaTime lastTimes[NUM_AVERAGES];
-		//DeltaTime expectedTime;
 	};
 
 	TaskIdMap mTaskIdMap;
 	FunctionList mReadyQueue;
-	SubscriptionId mRunningTask;
+	TaskInfo *mRunningTask;
+	bool mDestroyRunningTask;
 public:
+	RoundRobinScheduler()
+		: mRunningTask(NULL), mDestroyRunningTask(false) {
+	}
 
-	SubscriptionId createTask(TaskFunction func) {
+	~RoundRobinScheduler() {
+		for (TaskIdMap::iterator iter = mTaskIdMap.begin(); iter != mTaskIdMap.end(); ++iter) {
+			delete (*iter).second;
+		}
+	}
+
+	SubscriptionId createTask(const TaskFunction &func) {
 		SubscriptionId myId = SubscriptionIdClass::alloc();
 
 		TaskInfo* ti = new TaskInfo;
@@ -103,6 +124,7 @@ public:
 		ti->activeQueue = NULL;
 
 		mTaskIdMap.insert(TaskIdMap::value_type(myId, ti));
+		return myId;
 	}
 
 	void readyTask(SubscriptionId taskId) {
@@ -129,7 +151,7 @@ public:
 		TaskInfo* ti = (*iter).second;
 
 		if (ti->activeQueue != NULL) {
-			ti->activeQueue->remove(ti->removeIter);
+			ti->activeQueue->erase(ti->removeIter);
 			ti->activeQueue = NULL;
 		}
 	}
@@ -142,14 +164,133 @@ public:
 		TaskInfo* ti = (*iter).second;
 
 		if (ti->activeQueue != NULL) {
-			ti->activeQueue->remove(ti->removeIter);
+			ti->activeQueue->erase(ti->removeIter);
 			ti->activeQueue = NULL;
 		}
 
-		delete ti;
-		mTaskIdMap.remove(iter);
+		mTaskIdMap.erase(iter);
+		SubscriptionIdClass::free(taskId);
+		if (ti == mRunningTask) {
+			mDestroyRunningTask = true;
+		} else {
+			delete ti;
+		}
+	}
+
+	void setPriority(SubscriptionId taskId, int prio) {
+	}
+
+	void runFrame(AbsTime frameEnd) {
+		// Only visit the tasks that were ready when the frame started.
+		size_t numTasks = mReadyQueue.size();
+		while (numTasks-- > 0 && !mReadyQueue.empty() &&
+				AbsTime::now() < frameEnd) {
+			TaskInfo *ti = mReadyQueue.front();
+			mRunningTask = ti;
+			bool more = ti->func(frameEnd);
+			mRunningTask = NULL;
+			if (mDestroyRunningTask) {
+				mDestroyRunningTask = false;
+				delete ti;
+				continue;
+			}
+			if (ti->activeQueue == NULL) {
+				continue; // The task put itself to sleep.
+			}
+			mReadyQueue.erase(ti->removeIter);
+			ti->activeQueue = NULL;
+			if (more) {
+				readyTask(ti->id);
+			}
+		}
 	}
+};
+
+
+/**
+ * Divides the time left between frames among ready tasks, in priority
+ * order, and around the messages waiting in a WorkQueue.
+ *
+ * Each task keeps a moving average of how long its last NUM_AVERAGES runs
+ * took. A task is skipped for the frame if that average no longer fits
+ * before the frame ends, but never for more than MAX_SKIPPED_FRAMES frames
+ * in a row; a task that has not run yet is never skipped. A task may also
+ * be given a per-frame budget, which caps the deadline passed to it. Tasks
+ * of equal priority take turns going first.
+ *
+ * When a WorkQueue is given, queued work items are processed first, up to
+ * the point where the expected run time of the ready tasks would no longer
+ * fit, and again with any time left after the tasks have run.
+ *
+ * Not thread safe: all functions must be called from the frame thread.
+ */
+class SIRIKATA_EXPORT FrameScheduler : public Scheduler {
+public:
+	enum {
+		NUM_AVERAGES = 8,
+		MAX_SKIPPED_FRAMES = 4
+	};
+private:
+	struct TaskInfo;
+	typedef std::list<TaskInfo*> TaskList;
+	typedef std::tr1::unordered_map<SubscriptionId, TaskInfo*, SubscriptionIdHasher> TaskIdMap;
+
+	struct TaskInfo {
+		SubscriptionId id;
+		TaskFunction func;
+		int priority;
+		DeltaTime budget; ///< zero means the rest of the frame.
+
+		bool ready;
+		bool dead;
+		TaskList::iterator readyIter;
+		int skippedFrames;
+
+		/* Help scheduler decide how much time to allocate btwn frames */
+		DeltaTime lastTimes[NUM_AVERAGES];
+		int numTimes;
+		int nextTime;
+		DeltaTime totalTime;
+
+		TaskInfo(SubscriptionId myId, const TaskFunction &myFunc);
+		void recordTime(const DeltaTime &runTime);
+		DeltaTime expectedTime() const;
+	};
+
+	struct PriorityOrder {
+		bool operator() (const TaskInfo *a, const TaskInfo *b) const {
+			return a->priority > b->priority;
+		}
+	};
+
+	WorkQueue *mWorkQueue;
+	TaskIdMap mTaskIdMap;
+	TaskList mReadyQueue;
+	std::vector<TaskInfo*> mFrameTasks;
+	std::vector<TaskInfo*> mDeadTasks;
+	bool mInFrame;
+
+	TaskInfo *findTask(SubscriptionId taskId);
+public:
+	/**
+	 * @param queue  Work items from this queue are run between tasks, or
+	 *               NULL if the caller processes its queues separately.
+	 */
+	explicit FrameScheduler(WorkQueue *queue=NULL);
+	~FrameScheduler();
 
+	SubscriptionId createTask(const TaskFunction &func);
+	/** Creates a task with the given priority and per-frame budget. */
+	SubscriptionId createTask(const TaskFunction &func, int prio, const DeltaTime &budget);
+	void readyTask(SubscriptionId taskId);
+	void sleepTask(SubscriptionId taskId);
+	void destroyTask(SubscriptionId taskId);
+	void setPriority(SubscriptionId taskId, int prio);
+	/** Limits how long taskId may run each frame; zero removes the limit. */
+	void setBudget(SubscriptionId taskId, const DeltaTime &budget);
+	/** The average of the task's recent run times, or zero if unknown. */
+	DeltaTime expectedTime(SubscriptionId taskId);
+	void runFrame(AbsTime frameEnd);
 };
 
 }
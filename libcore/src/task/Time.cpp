@@ -32,36 +32,117 @@
 #include "util/Standard.hh"
 #include "Time.hpp"
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <windows.h>
+#else
 #include <sys/time.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
 #endif
 #include <stdlib.h>
 
-#ifdef _WIN32
-#include <windows.h>
-// probably something like this function
+namespace {
+using Sirikata::uint64;
+using Sirikata::int64;
 
-Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
+#ifdef _WIN32
+uint64 systemMicroseconds() {
 	FILETIME ft;
 	GetSystemTimeAsFileTime(&ft);
 	ULARGE_INTEGER uli;
 	uli.LowPart = ft.dwLowDateTime;
 	uli.HighPart = ft.dwHighDateTime;
 	ULONGLONG time64 = uli.QuadPart/10;
-	return AbsTime::microseconds(time64);
+	return time64;
+}
+uint64 monotonicMicroseconds() {
+	static LARGE_INTEGER frequency = {0};
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+		(uint64)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+uint64 coarseMonotonicMicroseconds() {
+	return monotonicMicroseconds();
 }
-
 #else
-Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
+uint64 systemMicroseconds() {
 	struct timeval tv = {0, 0};
 	gettimeofday(&tv, NULL);
     uint64 total_time=tv.tv_sec;
     total_time*=1000000;
     total_time+=tv.tv_usec;
-	return AbsTime::microseconds(total_time);
+	return total_time;
+}
+#ifdef __APPLE__
+uint64 monotonicMicroseconds() {
+	static mach_timebase_info_data_t timebase = {0, 0};
+	if (timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+	uint64 ticks = mach_absolute_time();
+	// ticks * numer / denom is nanoseconds, but ticks * numer overflows
+	// after a few days of uptime. Scale the whole and remainder parts of
+	// ticks / denom separately; the remainder is below denom, so neither
+	// product can overflow.
+	uint64 nanoseconds = ticks / timebase.denom * timebase.numer +
+		ticks % timebase.denom * timebase.numer / timebase.denom;
+	return nanoseconds / 1000;
+}
+uint64 coarseMonotonicMicroseconds() {
+	return monotonicMicroseconds();
+}
+#else
+uint64 readClock(clockid_t clock) {
+	struct timespec ts = {0, 0};
+	clock_gettime(clock, &ts);
+	uint64 total_time=ts.tv_sec;
+	total_time*=1000000;
+	total_time+=ts.tv_nsec/1000;
+	return total_time;
 }
+uint64 monotonicMicroseconds() {
+	return readClock(CLOCK_MONOTONIC);
+}
+uint64 coarseMonotonicMicroseconds() {
+#ifdef CLOCK_MONOTONIC_COARSE
+	return readClock(CLOCK_MONOTONIC_COARSE);
+#else
+	return readClock(CLOCK_MONOTONIC);
+#endif
+}
+#endif
 #endif
 
+/// Added to the monotonic clock so that it starts out at the system time.
+int64 monotonicOffset() {
+	static int64 offset = (int64)systemMicroseconds() - (int64)monotonicMicroseconds();
+	return offset;
+}
+
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::sLastFrameTime(0);
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
+	return AbsTime::microseconds(monotonicMicroseconds() + monotonicOffset());
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::coarseNow() {
+	return AbsTime::microseconds(coarseMonotonicMicroseconds() + monotonicOffset());
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::updateFrameTime() {
+	sLastFrameTime = now();
+	return sLastFrameTime;
+}
+
 namespace Sirikata { namespace Task {
 
 std::ostream& operator<<(std::ostream& os, const DeltaTime& rhs) {
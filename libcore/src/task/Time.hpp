@@ -198,10 +198,7 @@ class SIRIKATA_EXPORT AbsTime {
 		this->mTime = t;
 	}
 
-/*
 	static AbsTime sLastFrameTime; // updated in "updateFrameTime"
-	static void updateFrameTime();
-*/
 public:
         uint64 raw() const {
             return mTime;
@@ -262,11 +259,40 @@ public:
 	/**
 	 * The only public construction function for absolute times.
 	 *
-	 * @returns the current system time (gettimeofday), not to be used
-	 * for time synchronization over the network.
+	 * @returns the current time from a monotonic clock, offset so that it
+	 * matched the system time when the process first asked for it. It does
+	 * not jump when the system clock is set, and is not to be used for
+	 * time synchronization over the network.
 	 */
 	static AbsTime now(); // Only way to generate an AbsTime for now...
 
+	/**
+	 * Like now(), but may lag it by a few milliseconds in exchange for a
+	 * cheaper clock read (CLOCK_MONOTONIC_COARSE on Linux). Good enough
+	 * for timeouts and rate limiting in tight loops.
+	 */
+	static AbsTime coarseNow();
+
+	/**
+	 * @returns the time recorded by the last updateFrameTime() call, or
+	 * now() if it has never been called. Costs no clock read at all, for
+	 * code that only needs to know which frame it is in.
+	 */
+	static AbsTime frameTime() {
+		if (sLastFrameTime.mTime == 0) {
+			return now();
+		}
+		return sLastFrameTime;
+	}
+
+	/**
+	 * Records now() as the frame time. Call once per iteration of the
+	 * main event loop, from that loop's thread.
+	 *
+	 * @returns the new frame time.
+	 */
+	static AbsTime updateFrameTime();
+
 	/**
 	 * Creates the time when items are 0
 	 *
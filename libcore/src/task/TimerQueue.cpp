@@ -0,0 +1,109 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  TimerQueue.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "TimerQueue.hpp"
+
+namespace Sirikata {
+namespace Task {
+
+TimerQueue timer_queue;
+
+TimerQueue::TimerQueue()
+	: mWheel(AbsTime::now()) {
+}
+
+void TimerQueue::insert(const AbsTime &nextTime, const Entry &entry) {
+	Wheel::Handle handle = mWheel.schedule(nextTime, entry);
+	if (entry.mId != SubscriptionIdClass::null()) {
+		mHandles[entry.mId] = handle;
+	}
+}
+
+void TimerQueue::schedule(AbsTime nextTime,
+			const TimedEvent &ev) {
+	insert(nextTime, Entry(ev, SubscriptionIdClass::null()));
+}
+
+SubscriptionId TimerQueue::scheduleId(AbsTime nextTime,
+			const TimedEvent &ev) {
+	SubscriptionId id = SubscriptionIdClass::alloc();
+	insert(nextTime, Entry(ev, id));
+	return id;
+}
+
+void TimerQueue::unschedule(const SubscriptionId &removeId) {
+	HandleMap::iterator iter = mHandles.find(removeId);
+	if (iter == mHandles.end()) {
+		return;
+	}
+	mWheel.cancel(iter->second);
+	mHandles.erase(iter);
+	SubscriptionIdClass::free(removeId);
+}
+
+void TimerQueue::processTimers(const AbsTime &now) {
+	// Callbacks may schedule or unschedule; keep the expired list apart.
+	std::vector<Entry> expired;
+	expired.swap(mExpired);
+	expired.clear();
+	mWheel.expire(now, expired);
+	for (size_t i = 0; i < expired.size(); ++i) {
+		Entry &entry = expired[i];
+		bool hasId = (entry.mId != SubscriptionIdClass::null());
+		if (hasId && mHandles.find(entry.mId) == mHandles.end()) {
+			// Unscheduled by an earlier event in this batch.
+			continue;
+		}
+		DeltaTime next = entry.mEvent();
+		if (hasId) {
+			HandleMap::iterator iter = mHandles.find(entry.mId);
+			if (iter == mHandles.end()) {
+				// The event unscheduled itself.
+				continue;
+			}
+			mHandles.erase(iter);
+		}
+		if (next < DeltaTime::zero()) {
+			if (hasId) {
+				SubscriptionIdClass::free(entry.mId);
+			}
+		} else {
+			insert(now + next, entry);
+		}
+	}
+	expired.clear();
+	expired.swap(mExpired);
+}
+
+}
+}
@@ -35,6 +35,7 @@
 
 #include "Time.hpp"
 #include "UniqueId.hpp"
+#include "TimerWheel.hpp"
 
 
 namespace Sirikata {
@@ -54,9 +55,26 @@ typedef std::tr1::function<DeltaTime()> TimedEvent;
 
 
 /** A work queue that runs on each frame. */
-class TimerQueue {
-	std::map<AbsTime, std::list<TimedEvent> > mQueue;
+class SIRIKATA_EXPORT TimerQueue : Noncopyable {
+	struct Entry {
+		TimedEvent mEvent;
+		SubscriptionId mId;
+		Entry() : mId(SubscriptionIdClass::null()) {
+		}
+		Entry(const TimedEvent &ev, SubscriptionId id)
+			: mEvent(ev), mId(id) {
+		}
+	};
+	typedef TimerWheel<Entry> Wheel;
+	typedef std::tr1::unordered_map<SubscriptionId, Wheel::Handle, SubscriptionIdHasher> HandleMap;
+
+	Wheel mWheel;
+	HandleMap mHandles; ///< Only holds events scheduled with scheduleId.
+	std::vector<Entry> mExpired;
+
+	void insert(const AbsTime &nextTime, const Entry &entry);
 public:
+	TimerQueue();
 
 	/**
 	 * Schedules this event to occur at nextTime.  The only way to remove
@@ -93,10 +111,26 @@ public:
 	 * @param removeId  the exact SubscriptionID to search for.
 	 */
 	void unschedule(const SubscriptionId &removeId);
+
+	/**
+	 * Calls every event whose time is at or before now, and reschedules
+	 * those that return a non-negative DeltaTime. Events rescheduled for
+	 * 0 are called on the next call to processTimers, not this one.
+	 * Times are rounded up to the next millisecond, so an event is never
+	 * called early but may wait for a later call.
+	 *
+	 * @param now  Usually AbsTime::now() at the start of the frame.
+	 */
+	void processTimers(const AbsTime &now);
+
+	/// Number of events waiting to be called.
+	size_t size() const {
+		return mWheel.size();
+	}
 };
 
 /// Global TimerQueue singleton.
-extern TimerQueue timer_queue;
+extern SIRIKATA_EXPORT TimerQueue timer_queue;
 
 }
 }
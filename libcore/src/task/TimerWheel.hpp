@@ -0,0 +1,379 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  TimerWheel.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_TimerWheel_HPP__
+#define SIRIKATA_TimerWheel_HPP__
+
+#include "Time.hpp"
+
+namespace Sirikata {
+namespace Task {
+
+/**
+ * A hierarchical timing wheel. Schedule and cancel are O(1), and expiring
+ * timers costs O(1) per tick plus an occasional cascade of one slot from
+ * a coarser level into a finer one.
+ *
+ * Time is divided into ticks of a fixed resolution; a timer fires during
+ * the first expire() call whose time reaches the tick it was scheduled
+ * in. There are four levels of 256 slots, so with the default 1 ms tick,
+ * timers up to 49 days away are placed directly; later ones are parked in
+ * the last level and re-placed when they cascade.
+ *
+ * Removed nodes are kept on a free list, so a steady state of scheduling
+ * and expiring does not allocate.
+ *
+ * TimerWheel is not thread safe; callers provide their own locking.
+ * Expired values are returned to the caller instead of being called, so
+ * that they can be run after such a lock is released.
+ */
+template <class T>
+class TimerWheel : Noncopyable {
+	enum {
+		SLOT_BITS = 8,
+		NUM_SLOTS = 1 << SLOT_BITS,
+		SLOT_MASK = NUM_SLOTS - 1,
+		NUM_LEVELS = 4
+	};
+
+	struct Link {
+		Link *mPrev;
+		Link *mNext;
+	};
+	struct Node : public Link {
+		uint64 mExpiry; ///< in ticks
+		uint32 mGeneration; ///< bumped each time the node is reused
+		int mLevel; ///< -1 while on mOverdue
+		T mValue;
+	};
+
+public:
+	/**
+	 * Identifies a scheduled timer. A Handle stays safe to cancel after its
+	 * timer has fired; cancel() will just return false.
+	 */
+	class Handle {
+		friend class TimerWheel<T>;
+		Node *mNode;
+		uint32 mGeneration;
+		Handle(Node *node, uint32 generation)
+			: mNode(node), mGeneration(generation) {
+		}
+	public:
+		Handle() : mNode(NULL), mGeneration(0) {
+		}
+		bool null() const {
+			return mNode == NULL;
+		}
+	};
+
+private:
+	Link mSlots[NUM_LEVELS][NUM_SLOTS];
+	/// Timers scheduled for a tick that has already been processed.
+	Link mOverdue;
+	size_t mLevelCount[NUM_LEVELS];
+	size_t mCount;
+
+	Node *mFreeNodes;
+
+	AbsTime mStart;
+	int64 mTickMicros;
+	/// The next tick to be processed; all earlier ticks have fired.
+	uint64 mCurrentTick;
+
+	static void unlink(Link *link) {
+		link->mPrev->mNext = link->mNext;
+		link->mNext->mPrev = link->mPrev;
+		link->mPrev = NULL;
+		link->mNext = NULL;
+	}
+	static void pushBack(Link *head, Link *link) {
+		link->mNext = head;
+		link->mPrev = head->mPrev;
+		head->mPrev->mNext = link;
+		head->mPrev = link;
+	}
+
+	/// Deadlines round up, so that a timer never fires early.
+	uint64 toTick(const AbsTime &when, bool roundUp) const {
+		if (when <= mStart) {
+			return 0;
+		}
+		uint64 micros = (uint64)(when - mStart).toMicroseconds();
+		if (roundUp) {
+			micros += (uint64)mTickMicros - 1;
+		}
+		return micros / (uint64)mTickMicros;
+	}
+
+	/// Files node into the slot that will next cascade or fire it.
+	void place(Node *node) {
+		uint64 expiry = node->mExpiry;
+		if (expiry < mCurrentTick) {
+			node->mLevel = -1;
+			pushBack(&mOverdue, node);
+			return;
+		}
+		uint64 delta = expiry - mCurrentTick;
+		int level = 0;
+		while (level < NUM_LEVELS - 1 &&
+			   delta >= ((uint64)1 << (SLOT_BITS * (level + 1)))) {
+			++level;
+		}
+		uint64 maxDelta = ((uint64)1 << (SLOT_BITS * NUM_LEVELS)) - 1;
+		if (delta > maxDelta) {
+			expiry = mCurrentTick + maxDelta;
+		}
+		size_t slot = (size_t)(expiry >> (SLOT_BITS * level)) & SLOT_MASK;
+		node->mLevel = level;
+		++mLevelCount[level];
+		pushBack(&mSlots[level][slot], node);
+	}
+
+	void remove(Node *node) {
+		unlink(node);
+		if (node->mLevel >= 0) {
+			--mLevelCount[node->mLevel];
+		}
+		--mCount;
+	}
+
+	void release(Node *node) {
+		++node->mGeneration;
+		node->mValue = T();
+		node->mNext = mFreeNodes;
+		mFreeNodes = node;
+	}
+
+	/// Moves every timer in mSlots[level][slot] down to finer levels.
+	void cascade(int level, size_t slot) {
+		Link pending;
+		Link *head = &mSlots[level][slot];
+		if (head->mNext == head) {
+			return;
+		}
+		// Detach the whole slot first: a far timer may land in it again.
+		pending.mNext = head->mNext;
+		pending.mPrev = head->mPrev;
+		pending.mNext->mPrev = &pending;
+		pending.mPrev->mNext = &pending;
+		head->mNext = head->mPrev = head;
+		while (pending.mNext != &pending) {
+			Node *node = static_cast<Node*>(pending.mNext);
+			unlink(node);
+			--mLevelCount[level];
+			place(node);
+		}
+	}
+
+	static void deleteList(Link *head) {
+		while (head->mNext != head) {
+			Node *node = static_cast<Node*>(head->mNext);
+			unlink(node);
+			delete node;
+		}
+	}
+
+public:
+	/**
+	 * @param start  The time corresponding to tick 0. Nothing scheduled
+	 *               before this time will fire earlier than tick 0.
+	 * @param tick   The wheel resolution.
+	 */
+	explicit TimerWheel(const AbsTime &start,
+			const DeltaTime &tick=DeltaTime::milliseconds((int64)1))
+		: mCount(0), mFreeNodes(NULL), mStart(start),
+		  mTickMicros(tick.toMicroseconds() > 0 ? tick.toMicroseconds() : 1),
+		  mCurrentTick(0) {
+		mOverdue.mNext = mOverdue.mPrev = &mOverdue;
+		for (int level = 0; level < NUM_LEVELS; ++level) {
+			mLevelCount[level] = 0;
+			for (int slot = 0; slot < NUM_SLOTS; ++slot) {
+				mSlots[level][slot].mNext = &mSlots[level][slot];
+				mSlots[level][slot].mPrev = &mSlots[level][slot];
+			}
+		}
+	}
+
+	~TimerWheel() {
+		deleteList(&mOverdue);
+		for (int level = 0; level < NUM_LEVELS; ++level) {
+			for (int slot = 0; slot < NUM_SLOTS; ++slot) {
+				deleteList(&mSlots[level][slot]);
+			}
+		}
+		while (mFreeNodes) {
+			Node *next = static_cast<Node*>(mFreeNodes->mNext);
+			delete mFreeNodes;
+			mFreeNodes = next;
+		}
+	}
+
+	/// Number of timers which have neither fired nor been cancelled.
+	size_t size() const {
+		return mCount;
+	}
+	bool empty() const {
+		return mCount == 0;
+	}
+
+	/**
+	 * Schedules value to be returned from expire() at or after when.
+	 * Times before the last expire() call fire on the next call.
+	 */
+	Handle schedule(const AbsTime &when, const T &value) {
+		Node *node = mFreeNodes;
+		if (node) {
+			mFreeNodes = static_cast<Node*>(node->mNext);
+		} else {
+			node = new Node;
+			node->mGeneration = 0;
+		}
+		node->mExpiry = toTick(when, true);
+		node->mValue = value;
+		++mCount;
+		place(node);
+		return Handle(node, node->mGeneration);
+	}
+
+	/**
+	 * Removes a pending timer.
+	 * @returns true if the timer had not yet fired or been cancelled.
+	 */
+	bool cancel(const Handle &handle) {
+		Node *node = handle.mNode;
+		if (node == NULL || node->mGeneration != handle.mGeneration ||
+				node->mPrev == NULL) {
+			return false;
+		}
+		remove(node);
+		release(node);
+		return true;
+	}
+
+	/**
+	 * Removes the earliest timer due at or before now, if any.
+	 * Use this instead of expire() when running one timer may cancel
+	 * another that is due at the same time.
+	 * @returns true if value was set.
+	 */
+	bool expireOne(const AbsTime &now, T &value) {
+		if (mOverdue.mNext != &mOverdue) {
+			Node *node = static_cast<Node*>(mOverdue.mNext);
+			remove(node);
+			value = node->mValue;
+			release(node);
+			return true;
+		}
+		uint64 target = toTick(now, false);
+		while (mCurrentTick <= target) {
+			if (mCount == 0) {
+				mCurrentTick = target + 1;
+				break;
+			}
+			size_t index = (size_t)mCurrentTick & SLOT_MASK;
+			if (index == 0) {
+				// Repeating this when a tick is visited again is harmless.
+				for (int level = 1; level < NUM_LEVELS; ++level) {
+					size_t slot = (size_t)(mCurrentTick >> (SLOT_BITS * level)) & SLOT_MASK;
+					cascade(level, slot);
+					if (slot != 0) {
+						break;
+					}
+				}
+			} else if (mLevelCount[0] == 0) {
+				// Nothing can fire before the next cascade; skip ahead.
+				uint64 boundary = (mCurrentTick | SLOT_MASK) + 1;
+				mCurrentTick = boundary <= target ? boundary : target + 1;
+				continue;
+			}
+			Link *head = &mSlots[0][index];
+			if (head->mNext != head) {
+				Node *node = static_cast<Node*>(head->mNext);
+				remove(node);
+				value = node->mValue;
+				release(node);
+				return true;
+			}
+			++mCurrentTick;
+		}
+		return false;
+	}
+
+	/**
+	 * Advances the wheel to now, appending every timer that is due to
+	 * expired in deadline order (to tick resolution).
+	 */
+	void expire(const AbsTime &now, std::vector<T> &expired) {
+		T value;
+		while (expireOne(now, value)) {
+			expired.push_back(value);
+		}
+	}
+
+	/**
+	 * Returns a time at or before the earliest pending deadline, at which
+	 * expire() should next be called. This may be an intermediate cascade
+	 * point rather than a real deadline.
+	 * @returns false if there are no pending timers.
+	 */
+	bool nextExpiry(AbsTime &when) const {
+		if (mCount == 0) {
+			return false;
+		}
+		uint64 tick = mCurrentTick;
+		if (mOverdue.mNext != &mOverdue) {
+			// Already due; any time before the current tick will do.
+			tick = tick ? tick - 1 : 0;
+		} else if (((size_t)tick & SLOT_MASK) == 0 &&
+				mCount != mLevelCount[0]) {
+			// The cascade at this boundary may not have run yet, and the
+			// timers it brings down can be due before anything in level 0.
+		} else if (mLevelCount[0] != 0) {
+			for (size_t index = (size_t)tick & SLOT_MASK; index < NUM_SLOTS; ++index, ++tick) {
+				const Link *head = &mSlots[0][index];
+				if (head->mNext != head) {
+					break;
+				}
+			}
+		} else if (((size_t)tick & SLOT_MASK) != 0) {
+			tick = (tick | SLOT_MASK) + 1;
+		}
+		when = mStart + DeltaTime::microseconds((int64)(tick * (uint64)mTickMicros));
+		return true;
+	}
+};
+
+}
+}
+
+#endif
@@ -240,8 +240,6 @@ bool UnsafeWorkQueueImpl<QueueType>::probablyEmpty() {
 // Explicit instantiations.
 template class SIRIKATA_EXPORT WorkQueueImpl<ThreadSafeQueue<WorkItem*> >;
 
-// FIXME: Add semaphore to LockFreeQueue to allow for blockingPop
-// See sem_init (POSIX/Linux), sem_open (OS X), CreateSemaphore (WIN32)
 template class SIRIKATA_EXPORT WorkQueueImpl<LockFreeQueue<WorkItem*> >;
 
 template class SIRIKATA_EXPORT UnsafeWorkQueueImpl<std::queue<WorkItem*> >;
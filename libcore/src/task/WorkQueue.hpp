@@ -186,11 +186,9 @@ public:
 	virtual bool probablyEmpty();
 };
 
-///// blockingPop not implemented yet in LockFreeQueue.
-// Needs to use semaphores which are platform-specific.
-//typedef WorkQueueImpl<LockFreeQueue<WorkItem*> > LockFreeWorkQueue;
-typedef WorkQueueImpl<LockFreeQueue<WorkItem*> > RealLockFreeWorkQueue;
-typedef WorkQueueImpl<ThreadSafeQueue<WorkItem*> > LockFreeWorkQueue;
+typedef WorkQueueImpl<LockFreeQueue<WorkItem*> > LockFreeWorkQueue;
+/// Kept for existing users: LockFreeWorkQueue is now the real thing.
+typedef LockFreeWorkQueue RealLockFreeWorkQueue;
 typedef WorkQueueImpl<ThreadSafeQueue<WorkItem*> > ThreadSafeWorkQueue;
 
 template <class QueueType>
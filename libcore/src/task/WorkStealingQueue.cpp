@@ -0,0 +1,251 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  WorkStealingQueue.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "WorkStealingQueue.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+namespace Task {
+
+struct WorkStealingQueue::Deque {
+	boost::mutex mLock;
+	std::deque<WorkItem*> mItems;
+	// Keep neighbouring deques off each other's cache lines.
+	char mPadding[64];
+};
+
+struct WorkStealingQueue::Sleeper {
+	boost::mutex mLock;
+	boost::condition_variable mCond;
+};
+
+struct WorkStealingQueue::WorkerIndex : public boost::thread_specific_ptr<int> {
+};
+
+WorkStealingQueue::WorkStealingQueue(unsigned int numDeques)
+		: mNumPending(0), mNumSleepers(0), mNextWorker(0), mNextInjection(0), mNumSteals(0) {
+	if (numDeques == 0) {
+		numDeques = boost::thread::hardware_concurrency();
+		if (numDeques == 0) {
+			numDeques = 1;
+		}
+	}
+	for (unsigned int i = 0; i < numDeques; ++i) {
+		mDeques.push_back(new Deque);
+	}
+	mSleeper = new Sleeper;
+	mWorkerIndex = new WorkerIndex;
+}
+
+WorkStealingQueue::~WorkStealingQueue() {
+	for (size_t i = 0; i < mDeques.size(); ++i) {
+		std::deque<WorkItem*> &items = mDeques[i]->mItems;
+		for (std::deque<WorkItem*>::iterator iter = items.begin(); iter != items.end(); ++iter) {
+			if (*iter) {
+				std::auto_ptr<WorkItem>deleteMe(*iter);
+			}
+		}
+		delete mDeques[i];
+	}
+	delete mWorkerIndex;
+	delete mSleeper;
+}
+
+int WorkStealingQueue::ownDeque() const {
+	int *which = mWorkerIndex->get();
+	return which ? *which : -1;
+}
+
+int WorkStealingQueue::registerWorker() {
+	int *which = mWorkerIndex->get();
+	if (!which) {
+		which = new int((mNextWorker++) % mDeques.size());
+		mWorkerIndex->reset(which);
+	}
+	return *which;
+}
+
+void WorkStealingQueue::wakeSleeper() {
+	boost::unique_lock<boost::mutex> lok(mSleeper->mLock);
+	mSleeper->mCond.notify_one();
+}
+
+void WorkStealingQueue::enqueue(WorkItem *element) {
+	if (element) {
+		element->enqueued();
+	}
+	int which = ownDeque();
+	if (which < 0) {
+		which = (mNextInjection++) % mDeques.size();
+	}
+	{
+		Deque *deque = mDeques[which];
+		boost::unique_lock<boost::mutex> lok(deque->mLock);
+		deque->mItems.push_back(element);
+	}
+	// Both of these are full barriers: either we see the sleeper, or the
+	// sleeper sees mNumPending go up before it waits.
+	++mNumPending;
+	if (mNumSleepers.read() > 0) {
+		wakeSleeper();
+	}
+}
+
+bool WorkStealingQueue::popOwn(int which, WorkItem *&element) {
+	Deque *deque = mDeques[which];
+	boost::unique_lock<boost::mutex> lok(deque->mLock);
+	if (deque->mItems.empty()) {
+		return false;
+	}
+	element = deque->mItems.front();
+	deque->mItems.pop_front();
+	return true;
+}
+
+bool WorkStealingQueue::steal(int thief, WorkItem *&element, bool wait) {
+	size_t numDeques = mDeques.size();
+	size_t start = thief >= 0 ? (size_t)thief + 1 : (size_t)mNextInjection.read();
+	std::vector<WorkItem*> stolen;
+	for (size_t i = 0; i < numDeques; ++i) {
+		size_t victim = (start + i) % numDeques;
+		if ((int)victim == thief) {
+			continue;
+		}
+		Deque *deque = mDeques[victim];
+		boost::unique_lock<boost::mutex> lok(deque->mLock, boost::defer_lock);
+		if (wait) {
+			lok.lock();
+		} else if (!lok.try_lock()) {
+			continue;
+		}
+		size_t available = deque->mItems.size();
+		if (available == 0) {
+			continue;
+		}
+		// Workers take half so that they do not come back immediately;
+		// anyone else only takes what they are about to run.
+		size_t count = thief >= 0 ? (available + 1) / 2 : 1;
+		std::deque<WorkItem*>::iterator first = deque->mItems.end() - count;
+		stolen.assign(first, deque->mItems.end());
+		deque->mItems.erase(first, deque->mItems.end());
+		break;
+	}
+	if (stolen.empty()) {
+		return false;
+	}
+	++mNumSteals;
+	element = stolen.front();
+	if (stolen.size() > 1) {
+		// Never hold two deque locks at once: two thieves stealing from
+		// each other would deadlock.
+		Deque *deque = mDeques[thief];
+		boost::unique_lock<boost::mutex> lok(deque->mLock);
+		deque->mItems.insert(deque->mItems.end(), stolen.begin() + 1, stolen.end());
+	}
+	return true;
+}
+
+bool WorkStealingQueue::findWork(int which, WorkItem *&element) {
+	if (which >= 0 && popOwn(which, element)) {
+		return true;
+	}
+	if (steal(which, element, false) || steal(which, element, true)) {
+		return true;
+	}
+	return false;
+}
+
+bool WorkStealingQueue::dequeueBlocking() {
+	int which = registerWorker();
+	WorkItem *element;
+	while (!findWork(which, element)) {
+		boost::unique_lock<boost::mutex> lok(mSleeper->mLock);
+		++mNumSleepers;
+		while (mNumPending.read() <= 0) {
+			mSleeper->mCond.wait(lok);
+		}
+		--mNumSleepers;
+	}
+	--mNumPending;
+	if (element) {
+		(*element)();
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool WorkStealingQueue::dequeuePoll() {
+	WorkItem *element;
+	if (mNumPending.read() > 0 && findWork(ownDeque(), element)) {
+		--mNumPending;
+		if (element) {
+			(*element)();
+		}
+		return true;
+	}
+	return false;
+}
+
+unsigned int WorkStealingQueue::dequeueAll() {
+	size_t numDeques = mDeques.size();
+	int own = ownDeque();
+	size_t start = own >= 0 ? (size_t)own : 0;
+	unsigned int numProcessed = 0;
+	for (size_t i = 0; i < numDeques; ++i) {
+		std::deque<WorkItem*> items;
+		{
+			Deque *deque = mDeques[(start + i) % numDeques];
+			boost::unique_lock<boost::mutex> lok(deque->mLock);
+			deque->mItems.swap(items);
+		}
+		if (items.empty()) {
+			continue;
+		}
+		mNumPending -= (int)items.size();
+		for (std::deque<WorkItem*>::iterator iter = items.begin(); iter != items.end(); ++iter) {
+			if (*iter) {
+				(**iter)();
+			}
+			++numProcessed;
+		}
+	}
+	return numProcessed;
+}
+
+bool WorkStealingQueue::probablyEmpty() {
+	return mNumPending.read() <= 0;
+}
+
+}
+}
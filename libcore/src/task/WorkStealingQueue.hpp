@@ -0,0 +1,117 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  WorkStealingQueue.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_WorkStealingQueue_HPP__
+#define SIRIKATA_WorkStealingQueue_HPP__
+
+#include "WorkQueue.hpp"
+
+namespace Sirikata {
+namespace Task {
+
+/**
+ * A WorkQueue meant to be drained by several threads from
+ * createWorkerThreads().  Instead of one lock shared by every producer
+ * and consumer, each worker owns its own deque.  A worker pushes work
+ * it generates onto its own deque and pops from the front of it; when
+ * its deque runs dry it steals half of another worker's deque from the
+ * back.  Threads that are not workers spread their enqueues across the
+ * deques round-robin.
+ *
+ * Idle workers sleep on a condition variable which is only touched by
+ * enqueue() when a worker is actually asleep, so the fast path never
+ * takes a shared lock.
+ *
+ * Ordering is FIFO per deque only: as with any multi-threaded WorkQueue,
+ * no global ordering is guaranteed between items.
+ */
+class SIRIKATA_EXPORT WorkStealingQueue : public WorkQueue {
+	struct Deque;
+	struct Sleeper;
+	struct WorkerIndex;
+
+	std::vector<Deque*> mDeques;
+	Sleeper *mSleeper;
+	WorkerIndex *mWorkerIndex;
+
+	/// Number of items (including NULL wakeups) in all deques.
+	AtomicValue<int> mNumPending;
+	/// Number of workers waiting (or about to wait) on mSleeper.
+	AtomicValue<int> mNumSleepers;
+	AtomicValue<unsigned int> mNextWorker;
+	AtomicValue<unsigned int> mNextInjection;
+	/// Number of times work was taken from a deque the taker does not own.
+	AtomicValue<unsigned int> mNumSteals;
+
+	/// Returns the deque owned by the calling thread, or -1 if not a worker.
+	int ownDeque() const;
+	/// Assigns a deque to the calling thread if it has none yet.
+	int registerWorker();
+
+	bool popOwn(int which, WorkItem *&element);
+	bool steal(int thief, WorkItem *&element, bool wait);
+	bool findWork(int which, WorkItem *&element);
+	void wakeSleeper();
+
+	// Noncopyable
+	WorkStealingQueue(const WorkStealingQueue&);
+	void operator=(const WorkStealingQueue&);
+public:
+	/**
+	 * @param numDeques  How many per-worker deques to keep. Should be at
+	 *                   least the number of worker threads. 0 picks the
+	 *                   number of hardware threads.
+	 */
+	explicit WorkStealingQueue(unsigned int numDeques=0);
+	virtual ~WorkStealingQueue();
+
+	virtual void enqueue(WorkItem *element);
+	virtual bool dequeueBlocking();
+	virtual bool dequeuePoll();
+	virtual unsigned int dequeueAll();
+
+	virtual bool probablyEmpty();
+
+	/**
+	 * How many times a thread took work from a deque it does not own.
+	 * Each steal locks a deque that another worker is using, so this is
+	 * the contention left after workers keep their own work local.
+	 */
+	unsigned int numSteals() const {
+		return mNumSteals.read();
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_WorkStealingQueue_HPP__ */
@@ -37,6 +37,8 @@
 #include "CacheLayer.hpp"
 #include "CacheMap.hpp"
 
+SILOG_DECLARE_MODULE(transfer)
+
 namespace Sirikata {
 /** MemoryCacheLayer.hpp -- MemoryCacheLayer -- the first layer of transfer cache. */
 namespace Transfer {
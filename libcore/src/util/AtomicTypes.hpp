@@ -54,6 +54,9 @@ public:
     template<typename T> static T dec(volatile T*scalar) {
         return (T)InterlockedDecrement((volatile LONG*)scalar);
     }
+    template<typename T> static bool cas(volatile T*scalar, T comperand, T exchange) {
+        return (T)InterlockedCompareExchange((volatile LONG*)scalar,(LONG)exchange,(LONG)comperand)==comperand;
+    }
 };
 template<> class SizedAtomicValue<8> {
 public:
@@ -66,6 +69,9 @@ public:
     template<typename T> static T dec(volatile T*scalar) {
         return (T)InterlockedDecrement64((volatile LONGLONG*)scalar);
     }
+    template<typename T> static bool cas(volatile T*scalar, T comperand, T exchange) {
+        return (T)InterlockedCompareExchange64((volatile LONGLONG*)scalar,(LONGLONG)exchange,(LONGLONG)comperand)==comperand;
+    }
 };
 #elif defined(__APPLE__)
 template<int size> class SizedAtomicValue {
@@ -83,6 +89,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return (T)OSAtomicDecrement32((int32*)scalar);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comperand, T exchange) {
+        return OSAtomicCompareAndSwap32((int32)comperand, (int32)exchange, (int32*)scalar);
+    }
 };
 
 template<> class SizedAtomicValue<8> {
@@ -96,6 +105,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return (T)OSAtomicDecrement64((int64*)scalar);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comperand, T exchange) {
+        return OSAtomicCompareAndSwap64((int64)comperand, (int64)exchange, (int64*)scalar);
+    }
 };
 #else
 template<int size> class SizedAtomicValue {
@@ -109,6 +121,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return __sync_sub_and_fetch(scalar, 1);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comperand, T exchange) {
+        return __sync_bool_compare_and_swap(scalar, comperand, exchange);
+    }
 };
 #endif
 #ifdef _WIN32
@@ -177,6 +192,10 @@ public:
     T operator--(int) {
         return (--*this)+(T)1;
     }
+    /// Stores exchange if the value is still comperand. @returns whether it did
+    bool compare_and_swap(T comperand, T exchange) {
+        return SizedAtomicValue<sizeof(T)>::cas(getThisAlignedAddress(mMemory),comperand,exchange);
+    }
 };
 
 template <class Node>
@@ -196,6 +215,93 @@ inline bool compare_and_swap(volatile Node*volatile *target, volatile Node *comp
 #endif
 }
 
+/**
+ * A pointer and a modification counter packed into a single 64-bit word, so
+ * that both can be replaced with one compare_and_swap.  Bumping the tag on
+ * every successful swap defeats the ABA problem for lock-free lists whose
+ * nodes get recycled: a stale comperand no longer matches even if the same
+ * node comes back to the same place.
+ *
+ * On 64-bit platforms the tag lives in the upper 16 bits, relying on user
+ * space addresses fitting in 48 bits.  On 32-bit platforms it gets a full
+ * 32 bits.
+ */
+template <class T> class TaggedPointer {
+#if defined(__LP64__) || defined(_WIN64)
+    enum {TAG_SHIFT=48};
+    static uint64 packPointer(T*pointer) {
+        uint64 bits=(uint64)(size_t)pointer;
+        assert((uint64)(((int64)(bits<<16))>>16)==bits);
+        return bits&((((uint64)1)<<TAG_SHIFT)-1);
+    }
+    T* unpackPointer() const {
+        // sign-extend bit 47 back into a canonical address.
+        return (T*)(size_t)(((int64)(mWord<<16))>>16);
+    }
+#else
+    enum {TAG_SHIFT=32};
+    static uint64 packPointer(T*pointer) {
+        return (uint64)(size_t)pointer;
+    }
+    T* unpackPointer() const {
+        return (T*)(size_t)(mWord&0xffffffff);
+    }
+#endif
+#ifdef _WIN32
+    __declspec(align(8)) uint64 mWord;
+#else
+    uint64 mWord __attribute__((aligned(8)));
+#endif
+    explicit TaggedPointer(uint64 word) : mWord(word) {}
+public:
+    TaggedPointer() : mWord(0) {}
+    TaggedPointer(T*pointer, uint32 tag)
+        : mWord(packPointer(pointer)|(((uint64)tag)<<TAG_SHIFT)) {
+    }
+    T* pointer() const {
+        return unpackPointer();
+    }
+    uint32 tag() const {
+        return (uint32)(mWord>>TAG_SHIFT);
+    }
+    /// @returns a TaggedPointer to pointer whose tag is one more than this one.
+    TaggedPointer successor(T*pointer) const {
+        return TaggedPointer(pointer,tag()+1);
+    }
+    bool operator==(const TaggedPointer&other) const {
+        return mWord==other.mWord;
+    }
+    bool operator!=(const TaggedPointer&other) const {
+        return mWord!=other.mWord;
+    }
+
+    /// Reads target in one piece, even where 64-bit loads are not atomic.
+    static TaggedPointer read(const volatile TaggedPointer*target) {
+#if defined(__LP64__) || defined(_WIN64)
+        return TaggedPointer(target->mWord);
+#elif defined(_WIN32)
+        return TaggedPointer((uint64)InterlockedCompareExchange64((volatile LONGLONG*)&target->mWord,0,0));
+#elif defined(__APPLE__)
+        return TaggedPointer((uint64)OSAtomicAdd64(0,(int64_t*)&target->mWord));
+#else
+        return TaggedPointer(__sync_val_compare_and_swap((volatile uint64*)&target->mWord,(uint64)0,(uint64)0));
+#endif
+    }
+    /// Writes target; only safe while no other thread can see it.
+    static void write(volatile TaggedPointer*target, const TaggedPointer&value) {
+        target->mWord=value.mWord;
+    }
+    static bool compare_and_swap(volatile TaggedPointer*target, const TaggedPointer&comperand, const TaggedPointer&exchange) {
+#ifdef _WIN32
+        return InterlockedCompareExchange64((volatile LONGLONG*)&target->mWord,(LONGLONG)exchange.mWord,(LONGLONG)comperand.mWord)==(LONGLONG)comperand.mWord;
+#elif defined(__APPLE__)
+        return OSAtomicCompareAndSwap64((int64_t)comperand.mWord,(int64_t)exchange.mWord,(int64_t*)&target->mWord);
+#else
+        return __sync_bool_compare_and_swap(&target->mWord,comperand.mWord,exchange.mWord);
+#endif
+    }
+};
+
 #ifdef _WIN32
 #pragma warning( pop )
 #endif
@@ -35,15 +35,30 @@
 #define _SIRIKATA_LOCK_FREE_QUEUE_HPP_
 
 #include "AtomicTypes.hpp"
+#include "ThreadSafeQueue.hpp"
 
 /// LockFreeQueue.hpp
 namespace Sirikata {
 
-/// A queue of any type that has thread-safe push() and pop() functions.
+/**
+ * A queue of any type that has thread-safe push() and pop() functions.
+ *
+ * This is the Michael-Scott queue with tagged head, tail and next pointers,
+ * so recycled nodes cannot cause ABA corruption.  Popped nodes go back to a
+ * per-queue free list; once that list holds more than maxFreeNodes, further
+ * nodes are handed back to the allocator by epoch-based reclamation.  Every
+ * operation records the epoch it started in, and a thread finishing an
+ * operation moves the epoch on when all operations under way started in the
+ * current one.  Nodes unlinked two epochs ago are then unreachable and get
+ * deleted.  No operation ever waits on another; a thread that fails to move
+ * the epoch on just leaves it to the next one.
+ */
 template <typename T> class LockFreeQueue {
 private:
+    struct Node;
+    typedef TaggedPointer<Node> NodePtr;
     struct Node {
-        volatile Node * mNext;
+        volatile NodePtr mNext;
         T mContent;
         void *operator new(size_t num_bytes) {
             return Sirikata::aligned_malloc<Node>(num_bytes,16);
@@ -51,54 +66,240 @@ private:
         void operator delete(void *data) {
             Sirikata::aligned_free(data);
         }
-        Node() :mNext(NULL), mContent() {
+        Node() :mNext(), mContent() {
         }
     };
-    class FreeNodePool {
 
-        volatile Node *mHead;
+    class FreeNodePool {
+    public:
+        /**
+         * The epoch an operation on the queue started in, or INACTIVE.
+         * Records are claimed by an operation for its duration and are
+         * only freed with the queue.
+         */
+        struct Record {
+            AtomicValue<int> mEpoch;
+            Record *mNext;
+            explicit Record(int epoch) : mEpoch(epoch), mNext(NULL) {
+            }
+        };
+    private:
+        enum {
+            INACTIVE=-1,
+            /// Epochs wrap within this mask, which is a multiple of NUM_LIMBO_LISTS.
+            EPOCH_MASK=0x3fffffff,
+            NUM_LIMBO_LISTS=4
+        };
+        volatile NodePtr mHead;
+        AtomicValue<int> mNumFree;
+        AtomicValue<int> mMaxFree;
+        AtomicValue<int> mEpoch;
+        Record *volatile mRecords;
+        /// Unlinked nodes above the limit, by the epoch they were unlinked in.
+        Node *volatile mLimbo[NUM_LIMBO_LISTS];
+        AtomicValue<int> mNumLimbo;
+
+        /// @returns how many nodes were deleted
+        static int deleteChain(Node *chain) {
+            int retval = 0;
+            while (chain) {
+                Node *next = NodePtr::read(&chain->mNext).pointer();
+                delete chain;
+                chain = next;
+                ++retval;
+            }
+            return retval;
+        }
+        Node *takeLimbo(int which) {
+            Node *chain;
+            do {
+                chain = mLimbo[which];
+            } while (chain && !compare_and_swap((volatile Node*volatile*)&mLimbo[which], (volatile Node*)chain, (volatile Node*)NULL));
+            return chain;
+        }
+        void pushLimbo(int which, Node *node) {
+            Node *oldLimbo;
+            do {
+                oldLimbo = mLimbo[which];
+                // Bump the tag, so a stalled push cannot link onto a node that left the queue.
+                NodePtr oldNext = NodePtr::read(&node->mNext);
+                NodePtr::write(&node->mNext, oldNext.successor(oldLimbo));
+            } while (!compare_and_swap((volatile Node*volatile*)&mLimbo[which], (volatile Node*)oldLimbo, (volatile Node*)node));
+        }
+        /**
+         * Moves to the next epoch if every operation under way started in
+         * this one, and deletes the nodes unlinked two epochs ago: whoever
+         * could still see them has finished.  Gives up rather than waiting.
+         */
+        void tryAdvance() {
+            int epoch = mEpoch.read();
+            for (Record *record = mRecords; record; record = record->mNext) {
+                int recordEpoch = record->mEpoch.read();
+                if (recordEpoch != INACTIVE && recordEpoch != epoch) {
+                    return;
+                }
+            }
+            int next = (epoch + 1) & EPOCH_MASK;
+            if (mEpoch.compare_and_swap(epoch, next)) {
+                mNumLimbo -= deleteChain(takeLimbo((next + NUM_LIMBO_LISTS - 2) % NUM_LIMBO_LISTS));
+            }
+        }
     public:
-        FreeNodePool() {
-            mHead = new Node();
+        FreeNodePool(int maxFree)
+            : mHead(), mNumFree(0), mMaxFree(maxFree), mEpoch(0), mRecords(NULL), mNumLimbo(0) {
+            for (int i = 0; i < NUM_LIMBO_LISTS; ++i) {
+                mLimbo[i] = NULL;
+            }
         }
 
         ~FreeNodePool() {
-            Node *cur = const_cast<Node*>(mHead);
-            Node *next = NULL;
+            deleteChain(NodePtr::read(&mHead).pointer());
+            for (int i = 0; i < NUM_LIMBO_LISTS; ++i) {
+                deleteChain(mLimbo[i]);
+            }
+            while (mRecords) {
+                Record *next = mRecords->mNext;
+                delete mRecords;
+                mRecords = next;
+            }
+        }
+
+        void setMaxFree(int maxFree) {
+            mMaxFree = maxFree;
+        }
+
+        int numLimbo() const {
+            return mNumLimbo.read();
+        }
+
+        /// Marks the calling operation as started in the current epoch.
+        Record *enter() {
+            int epoch = mEpoch.read();
+            for (Record *record = mRecords; record; record = record->mNext) {
+                if (record->mEpoch.read() == INACTIVE && record->mEpoch.compare_and_swap(INACTIVE, epoch)) {
+                    return record;
+                }
+            }
+            Record *record = new Record(epoch);
             do {
-                next = const_cast<Node*>(cur->mNext);
-                delete cur;
-            } while ((cur=next)!=NULL);
+                record->mNext = mRecords;
+            } while (!compare_and_swap((volatile Record*volatile*)&mRecords, (volatile Record*)record->mNext, (volatile Record*)record));
+            return record;
         }
 
+        void leave(Record *record) {
+            record->mEpoch.compare_and_swap(record->mEpoch.read(), INACTIVE);
+            if (mNumLimbo.read() > 0) {
+                tryAdvance();
+            }
+        }
+
+        /// Must be called inside an ActiveGuard.
         Node* allocate() {
-            volatile Node* node=0;
+            NodePtr head;
+            Node *node;
             do {
-                node = mHead->mNext;
-                if (node == 0) {
-                    return new Node();//FIXME should probably be aligned to size(Node) bytes
+                head = NodePtr::read(&mHead);
+                node = head.pointer();
+                if (node == NULL) {
+                    return new Node();
                 }
-            } while (!compare_and_swap(&mHead->mNext, node, node->mNext));
-            Node * return_node=(Node*)node;//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
-            return_node->mNext = NULL;
-            return_node->mContent=T();
-            return return_node;
+            } while (!NodePtr::compare_and_swap(&mHead, head, head.successor(NodePtr::read(&node->mNext).pointer())));
+            --mNumFree;
+            NodePtr oldNext = NodePtr::read(&node->mNext);
+            NodePtr::write(&node->mNext, oldNext.successor(NULL));
+            node->mContent=T();
+            return node;
         }
 
+        /// Must be called inside an ActiveGuard, after node has been unlinked.
         void release(Node *node) {
             node->mContent = T();
+            if (mNumFree.read() >= mMaxFree.read()) {
+                pushLimbo(mEpoch.read() % NUM_LIMBO_LISTS, node);
+                ++mNumLimbo;
+                return;
+            }
+            NodePtr head;
             do {
-                node->mNext = mHead->mNext;
-            } while (!compare_and_swap(&mHead->mNext, node->mNext, node));
+                head = NodePtr::read(&mHead);
+                NodePtr oldNext = NodePtr::read(&node->mNext);
+                NodePtr::write(&node->mNext, oldNext.successor(head.pointer()));
+            } while (!NodePtr::compare_and_swap(&mHead, head, head.successor(node)));
+            ++mNumFree;
         }
-    } mFreeNodePool;
-    volatile Node *mHead;
-    volatile Node *mTail;
+    };
+    /**
+     * Holds an epoch record for the length of a queue operation, so the
+     * nodes it may be looking at are not deleted under it.
+     */
+    class ActiveGuard {
+        FreeNodePool &mPool;
+        typename FreeNodePool::Record *mRecord;
+    public:
+        ActiveGuard(FreeNodePool &pool) : mPool(pool), mRecord(pool.enter()) {
+        }
+        ~ActiveGuard() {
+            mPool.leave(mRecord);
+        }
+    };
+
+    FreeNodePool mFreeNodePool;
+    volatile NodePtr mHead;
+    volatile NodePtr mTail;
+
+    /**
+     * Parking spot for blockingPop().  push() only touches the lock when
+     * mNumWaiters says someone may be asleep, so the push path stays
+     * lock-free when nobody is blocking.
+     */
+    AtomicValue<int> mNumWaiters;
+    ThreadSafeQueueNS::Lock* mWaitLock;
+    ThreadSafeQueueNS::Condition* mWaitCond;
+
+    /**
+     * Condition check for blockingPop, called with mWaitLock held.
+     * @returns true if the queue was empty and the caller must keep waiting
+     */
+    static bool waitCheck(void *thus, void *vretval) {
+        return !reinterpret_cast<LockFreeQueue*>(thus)->pop(*reinterpret_cast<T*>(vretval));
+    }
+
+    // Noncopyable
+    LockFreeQueue(const LockFreeQueue &other);
+    void operator=(const LockFreeQueue &other);
 public:
-    LockFreeQueue() {
-        mHead = mFreeNodePool.allocate();
-        mTail = mHead;
+    enum {
+        DEFAULT_MAX_FREE_NODES=1024
+    };
+
+    /**
+     * @param maxFreeNodes  how many popped nodes to keep around for reuse
+     *                      before returning memory to the allocator.
+     */
+    explicit LockFreeQueue(int maxFreeNodes=DEFAULT_MAX_FREE_NODES)
+        : mFreeNodePool(maxFreeNodes), mNumWaiters(0) {
+        Node *dummy;
+        {
+            ActiveGuard guard(mFreeNodePool);
+            dummy = mFreeNodePool.allocate();
+        }
+        NodePtr::write(&mHead, NodePtr(dummy, 0));
+        NodePtr::write(&mTail, NodePtr(dummy, 0));
+        mWaitLock = ThreadSafeQueueNS::lockCreate();
+        mWaitCond = ThreadSafeQueueNS::condCreate();
     }
+
+    /// Changes the free node high-water mark.
+    void setMaxFreeNodes(int maxFreeNodes) {
+        mFreeNodePool.setMaxFree(maxFreeNodes);
+    }
+
+    /// How many popped nodes are waiting until they can be deleted.
+    int numLimboNodes() const {
+        return mFreeNodePool.numLimbo();
+    }
+
     class NodeIterator {
     private:
     	// Noncopyable
@@ -108,32 +309,37 @@ public:
     	Node *mLastReturned;
     	Node *mCurrent;
 
-    	FreeNodePool *mFreePool;
+    	LockFreeQueue<T> *mQueue;
 
+    	void release(Node *node) {
+    		ActiveGuard guard(mQueue->mFreeNodePool);
+    		mQueue->mFreeNodePool.release(node);
+    	}
     public:
     	NodeIterator(LockFreeQueue<T> &queue)
     		: mLastReturned(queue.fork()),
-    		  mCurrent(const_cast<Node*>(mLastReturned->mNext)),
-    		  mFreePool(&queue.mFreeNodePool) {
+    		  mCurrent(NodePtr::read(&mLastReturned->mNext).pointer()),
+    		  mQueue(&queue) {
     	}
 
     	~NodeIterator() {
     		if (mLastReturned) {
-    			mFreePool->release(mLastReturned);
+    			release(mLastReturned);
     		}
     		while (mCurrent) {
-    			mFreePool->release(mCurrent);
-    			mCurrent = const_cast<Node*>(mCurrent->mNext);
+    			Node *next = NodePtr::read(&mCurrent->mNext).pointer();
+    			release(mCurrent);
+    			mCurrent = next;
     		}
     	}
 
     	T *next() {
     		if (mLastReturned) {
-    			mFreePool->release(mLastReturned);
+    			release(mLastReturned);
     		}
     		mLastReturned = mCurrent;
     		if (mCurrent) {
-    			mCurrent = const_cast<Node*>(mCurrent->mNext);
+    			mCurrent = NodePtr::read(&mCurrent->mNext).pointer();
         		return &mLastReturned->mContent;
     		} else {
     			return NULL;
@@ -143,34 +349,38 @@ public:
     };
 
     ~LockFreeQueue() {
-        NodeIterator junk(*this);
-        // release everything in the queue in ~NodeIterator
+        {
+            NodeIterator junk(*this);
+            // release everything in the queue in ~NodeIterator
+        }
+        // fork() left a fresh dummy node behind.
+        delete NodePtr::read(&mHead).pointer();
+        ThreadSafeQueueNS::lockDestroy(mWaitLock);
+        ThreadSafeQueueNS::condDestroy(mWaitCond);
     }
 
 private:
     friend class NodeIterator;
 
     Node *fork() {
-    	volatile Node *newHead = mFreeNodePool.allocate();
-		volatile Node *oldHead = mHead;
-
-    	// Acquire "lock" on head, for multiple people fork()ing at once.
-    	{
-    		while (oldHead == 0 ||
-						!compare_and_swap(&mHead, oldHead, (volatile Node*)0)) {
-    			oldHead = mHead;
-    		}
-    	}
+        ActiveGuard guard(mFreeNodePool);
+        Node *newHead = mFreeNodePool.allocate();
+        NodePtr oldHead = NodePtr::read(&mHead);
+
+        // Acquire "lock" on head, for multiple people fork()ing at once.
+        while (oldHead.pointer() == NULL ||
+               !NodePtr::compare_and_swap(&mHead, oldHead, oldHead.successor(NULL))) {
+            oldHead = NodePtr::read(&mHead);
+        }
 
-    	{
-			volatile Node *oldTail = mTail;
-			while (!compare_and_swap(&mTail, oldTail, newHead)) {
-				oldTail = mTail;
-			}
-    	}
+        NodePtr oldTail = NodePtr::read(&mTail);
+        while (!NodePtr::compare_and_swap(&mTail, oldTail, oldTail.successor(newHead))) {
+            oldTail = NodePtr::read(&mTail);
+        }
 
-    	mHead = newHead;
-    	return const_cast<Node*>(oldHead);
+        NodePtr lockedHead = NodePtr::read(&mHead);
+        NodePtr::compare_and_swap(&mHead, lockedHead, lockedHead.successor(newHead));
+        return oldHead.pointer();
     }
 public:
 
@@ -180,26 +390,36 @@ public:
      * @param value  Will be copied and placed onto the end of the queue.
      */
     void push(const T &value) {
-        volatile Node* formerTail = NULL;
-        volatile Node* formerTailNext=NULL;
-
-        Node* newerNode = mFreeNodePool.allocate();
-        newerNode->mContent = value;
-        volatile Node*newNode=newerNode;
-        bool successfulAddNode = false;
-        while (!successfulAddNode) {
-            formerTail = mTail;
-            formerTailNext = formerTail->mNext;
-
-            if (mTail == formerTail) {
-                if (formerTailNext == 0)
-                    successfulAddNode = compare_and_swap(&mTail->mNext, (volatile Node*)0, newNode);
-                else
-                    compare_and_swap(&mTail, formerTail, formerTailNext);
+        {
+            ActiveGuard guard(mFreeNodePool);
+            Node* newNode = mFreeNodePool.allocate();
+            newNode->mContent = value;
+            NodePtr formerTail;
+            while (true) {
+                formerTail = NodePtr::read(&mTail);
+                NodePtr formerTailNext = NodePtr::read(&formerTail.pointer()->mNext);
+
+                if (formerTail == NodePtr::read(&mTail)) {
+                    if (formerTailNext.pointer() == NULL) {
+                        if (NodePtr::compare_and_swap(&formerTail.pointer()->mNext, formerTailNext, formerTailNext.successor(newNode))) {
+                            break;
+                        }
+                    } else {
+                        NodePtr::compare_and_swap(&mTail, formerTail, formerTail.successor(formerTailNext.pointer()));
+                    }
+                }
             }
+
+            NodePtr::compare_and_swap(&mTail, formerTail, formerTail.successor(newNode));
         }
 
-        compare_and_swap(&mTail, formerTail, newNode);
+        // The CAS above is a full barrier, so either we see the waiter here
+        // or the waiter's pop() inside waitCheck sees our node.
+        if (mNumWaiters.read() > 0) {
+            ThreadSafeQueueNS::lock(mWaitLock);
+            ThreadSafeQueueNS::notify(mWaitCond);
+            ThreadSafeQueueNS::unlock(mWaitLock);
+        }
     }
 
     /**
@@ -209,50 +429,62 @@ public:
      * @returns      whether value was changed (if the queue had at least one item).
      */
     bool pop(T &value) {
-        volatile Node* formerHead = NULL;
-
-        bool headAlreadyAdvanced = false;
-        while (!headAlreadyAdvanced) {
+        ActiveGuard guard(mFreeNodePool);
+        NodePtr formerHead;
 
-            formerHead = mHead;
-            if (formerHead == NULL) {
+        while (true) {
+            formerHead = NodePtr::read(&mHead);
+            if (formerHead.pointer() == NULL) {
             	// fork() function is operating on mTail.
             	continue;
             }
-            volatile Node* formerHeadNext = formerHead->mNext;
-            volatile Node*formerTail = mTail;
+            NodePtr formerTail = NodePtr::read(&mTail);
+            NodePtr formerHeadNext = NodePtr::read(&formerHead.pointer()->mNext);
 
-            if (formerHead == mHead) {
-                if (formerHead == formerTail) {
-                    if (formerHeadNext == NULL) {
+            if (formerHead == NodePtr::read(&mHead)) {
+                if (formerHead.pointer() == formerTail.pointer()) {
+                    if (formerHeadNext.pointer() == NULL) {
                         value=T();
                         return false;
                     }
-                    compare_and_swap(&mTail, formerTail, formerHeadNext);
-                }
-
-                else {
-                    value = ((Node*)formerHeadNext)->mContent;//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
-                    headAlreadyAdvanced = compare_and_swap(&mHead, formerHead, formerHeadNext);
+                    NodePtr::compare_and_swap(&mTail, formerTail, formerTail.successor(formerHeadNext.pointer()));
+                } else {
+                    value = formerHeadNext.pointer()->mContent;//FIXME only safe if copying mContent cannot be torn by a concurrent release
+                    if (NodePtr::compare_and_swap(&mHead, formerHead, formerHead.successor(formerHeadNext.pointer()))) {
+                        break;
+                    }
                 }
             }
         }
-        mFreeNodePool.release((Node*)formerHead);//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
+        mFreeNodePool.release(formerHead.pointer());
         return true;
     }
 
+    /**
+     * Waits until an item is available on the queue and pops it.
+     * Tries a plain pop() first, and only registers as a waiter if the
+     * queue is empty.
+     *
+     * @param item  Will have the T at the front of the queue copied into it.
+     */
     void blockingPop(T &item) {
-    	throw std::runtime_error(std::string("Blocking Pop not implemented!!!"));
+        if (pop(item)) {
+            return;
+        }
+        ++mNumWaiters;
+        ThreadSafeQueueNS::wait(mWaitLock, mWaitCond, &LockFreeQueue<T>::waitCheck, this, &item);
+        --mNumWaiters;
     }
 
     bool probablyEmpty() {
-        volatile Node* formerHead = mHead;
+        ActiveGuard guard(mFreeNodePool);
+        Node* formerHead = NodePtr::read(&mHead).pointer();
         if (formerHead) {
-            if (formerHead->mNext) {
-                // fork() function is operating on mTail.
+            if (NodePtr::read(&formerHead->mNext).pointer()) {
                 return false;
             }
         }
+        // fork() function is operating on mTail.
         return true;
     }
 };
@@ -31,6 +31,10 @@
  */
 #include "util/Standard.hh"
 #include "options/Options.hpp"
+#include "util/AtomicTypes.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <cstdio>
 extern "C" {
 void *Sirikata_Logging_OptionValue_defaultLevel;
 void *Sirikata_Logging_OptionValue_atLeastLevel;
@@ -80,6 +84,354 @@ class LogLevelMapParser {public:
     }
 };
 
+int gMaxModuleLevel=insane;
+
+namespace {
+typedef std::tr1::unordered_map<std::string,LOGGING_LEVEL> ModuleLevelMap;
+typedef std::map<std::string,int*> ModuleSlotMap;
+
+boost::mutex &slotMutex() {
+    static boost::mutex mutex;
+    return mutex;
+}
+ModuleSlotMap &moduleSlots() {
+    static ModuleSlotMap slots;
+    return slots;
+}
+
+int defaultLevel() {
+    OptionValue*defaultOption=reinterpret_cast<OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel);
+    if (defaultOption==NULL||defaultOption->get()->empty()) {
+#ifdef NDEBUG
+        return info;
+#else
+        return debug;
+#endif
+    }
+    return defaultOption->unsafeAs<LOGGING_LEVEL>();
+}
+
+/// A module override may only lower the level below the default.
+int computeLevel(const std::string&module) {
+    int level=defaultLevel();
+    OptionValue*moduleOption=reinterpret_cast<OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel);
+    if (moduleOption!=NULL&&!moduleOption->get()->empty()) {
+        const ModuleLevelMap&overrides=moduleOption->unsafeAs<ModuleLevelMap>();
+        ModuleLevelMap::const_iterator where=overrides.find(module);
+        if (where!=overrides.end()&&where->second<level)
+            level=where->second;
+    }
+    return level;
+}
+
+/// Call with slotMutex() held.
+void updateModuleLevelsNoLock() {
+    int maxLevel=defaultLevel();
+    for (ModuleSlotMap::iterator i=moduleSlots().begin(),ie=moduleSlots().end();i!=ie;++i) {
+        *i->second=computeLevel(i->first);
+    }
+    gMaxModuleLevel=maxLevel;
+}
+
+void logLevelChanged(const std::string&,Any,Any) {
+    updateModuleLevels();
+}
+
+void asyncLogChanged(const std::string&,Any,Any newValue) {
+    if (newValue.empty()||newValue.as<std::string>().empty()) {
+        stopAsyncLogging();
+    }else {
+        const std::string&where=newValue.as<std::string>();
+        startAsyncLogging(where=="stderr"?std::string():where);
+    }
+}
+}
+
+const int *moduleLevelSlot(const char *module) {
+    boost::mutex::scoped_lock lock(slotMutex());
+    int *&slot=moduleSlots()[module];
+    if (slot==NULL) {
+        slot=new int(computeLevel(module));
+    }
+    return slot;
+}
+
+void updateModuleLevels() {
+    boost::mutex::scoped_lock lock(slotMutex());
+    updateModuleLevelsNoLock();
+}
+
+namespace {
+const char *levelName(int level) {
+    switch (level) {
+      case fatal: return "fatal";
+      case error: return "error";
+      case warning: return "warning";
+      case info: return "info";
+      case debug: return "debug";
+      default: return "insane";
+    }
+}
+
+/**
+ * Single producer, single consumer byte ring. The owning thread appends
+ * length-prefixed records and the drain thread consumes them. Positions
+ * run freely and are masked on access, so the capacity is a power of two.
+ */
+class LogRing {
+    std::vector<char> mData;
+    uint32 mMask;
+    AtomicValue<uint32> mHead; ///< Next byte the drain thread reads.
+    AtomicValue<uint32> mTail; ///< Next byte the owning thread writes.
+    AtomicValue<int> mOrphaned;
+    void copyIn(uint32 pos, const char *data, uint32 len) {
+        uint32 offset=pos&mMask;
+        uint32 first=std::min(len,(uint32)mData.size()-offset);
+        memcpy(&mData[offset],data,first);
+        memcpy(&mData[0],data+first,len-first);
+    }
+    void copyOut(uint32 pos, char *data, uint32 len) const {
+        uint32 offset=pos&mMask;
+        uint32 first=std::min(len,(uint32)mData.size()-offset);
+        memcpy(data,&mData[offset],first);
+        memcpy(data+first,&mData[0],len-first);
+    }
+    LogRing(const LogRing&);
+    LogRing&operator=(const LogRing&);
+public:
+    LogRing(size_t capacity):mHead(0),mTail(0),mOrphaned(0) {
+        uint32 size=256;
+        while (size<capacity&&size<(1U<<30))
+            size<<=1;
+        mData.resize(size);
+        mMask=size-1;
+    }
+    /// Owner thread only. Returns false, writing nothing, if the record does not fit.
+    bool push(const char *data, size_t length) {
+        uint32 len=(uint32)length;
+        uint32 tail=mTail.read();
+        if (length+sizeof(uint32)>mData.size()-(tail-mHead.read()))
+            return false;
+        copyIn(tail,(const char*)&len,sizeof(uint32));
+        copyIn(tail+sizeof(uint32),data,len);
+        // The atomic add is a full barrier, publishing the bytes above.
+        mTail+=len+sizeof(uint32);
+        return true;
+    }
+    /// Drain thread only. Appends every complete record to out.
+    void drain(std::string &out) {
+        uint32 head=mHead.read();
+        uint32 tail=mTail.read();
+        uint32 start=head;
+        while (head!=tail) {
+            uint32 len;
+            copyOut(head,(char*)&len,sizeof(uint32));
+            size_t where=out.size();
+            out.resize(where+len);
+            if (len)
+                copyOut(head+sizeof(uint32),&out[where],len);
+            head+=len+sizeof(uint32);
+        }
+        if (head!=start)
+            mHead+=head-start;
+    }
+    bool empty() const {
+        return mHead.read()==mTail.read();
+    }
+    void orphan() {
+        mOrphaned=1;
+    }
+    bool orphaned() const {
+        return mOrphaned.read()!=0;
+    }
+};
+
+struct ThreadLog {
+    std::ostringstream mStream;
+    bool mBusy;
+    bool mAtLineStart;
+    /// Created the first time this thread logs asynchronously; freed by the drain thread.
+    LogRing *mRing;
+    ThreadLog():mBusy(false),mAtLineStart(true),mRing(NULL) {}
+    ~ThreadLog() {
+        if (mRing)
+            mRing->orphan();
+    }
+};
+
+/**
+ * Shared state of the asynchronous backend. Threads only take mLock to
+ * register a ring; records themselves go through the rings lock-free.
+ */
+struct AsyncLogState {
+    boost::mutex mLock;
+    boost::condition_variable mWake;
+    std::vector<LogRing*> mRings;
+    boost::thread *mThread;
+    FILE *mOutput;
+    size_t mRingBytes;
+    bool mStopping;
+    AtomicValue<int> mEnabled;
+    AtomicValue<size_t> mDropped;
+    size_t mReportedDropped;
+    Task::AbsTime mStartTime;
+    AsyncLogState():mThread(NULL),mOutput(NULL),mRingBytes(0),mStopping(false),mEnabled(0),mDropped(0),mReportedDropped(0),mStartTime(Task::AbsTime::now()) {}
+};
+
+// Leaked on purpose: records may still be logged from static destructors.
+AsyncLogState &asyncLog() {
+    static AsyncLogState *state=new AsyncLogState;
+    return *state;
+}
+boost::thread_specific_ptr<ThreadLog> &threadLog() {
+    static boost::thread_specific_ptr<ThreadLog> *log=new boost::thread_specific_ptr<ThreadLog>;
+    return *log;
+}
+
+/// Moves everything currently in the rings to the output. Call with mLock held.
+void drainRingsNoLock(AsyncLogState &state, std::string &text) {
+    text.clear();
+    for (size_t i=0;i<state.mRings.size();) {
+        LogRing *ring=state.mRings[i];
+        bool orphaned=ring->orphaned();
+        ring->drain(text);
+        if (orphaned&&ring->empty()) {
+            delete ring;
+            state.mRings[i]=state.mRings.back();
+            state.mRings.pop_back();
+        }else {
+            ++i;
+        }
+    }
+    size_t dropped=state.mDropped.read();
+    if (dropped!=state.mReportedDropped) {
+        std::ostringstream report;
+        report<<"[logging] "<<dropped-state.mReportedDropped<<" log records dropped\n";
+        text+=report.str();
+        state.mReportedDropped=dropped;
+    }
+    if (!text.empty()) {
+        fwrite(text.data(),1,text.size(),state.mOutput);
+        fflush(state.mOutput);
+    }
+}
+
+void drainLoop() {
+    AsyncLogState &state=asyncLog();
+    std::string text;
+    boost::unique_lock<boost::mutex> lock(state.mLock);
+    while (!state.mStopping) {
+        drainRingsNoLock(state,text);
+        state.mWake.timed_wait(lock,boost::posix_time::milliseconds(10));
+    }
+    drainRingsNoLock(state,text);
+}
+
+struct StopAsyncLoggingAtExit {
+    ~StopAsyncLoggingAtExit() {
+        stopAsyncLogging();
+    }
+} gStopAsyncLoggingAtExit;
+}
+
+LogRecord::LogRecord(const char *module, int level)
+ : mThreadLog(NULL),mModule(module),mLevel(level) {
+    ThreadLog *log=threadLog().get();
+    if (log==NULL) {
+        log=new ThreadLog;
+        threadLog().reset(log);
+    }
+    if (log->mBusy) {
+        // Something being logged is itself logging; give it its own stream.
+        mStream=new std::ostringstream;
+    }else {
+        log->mBusy=true;
+        log->mStream.str(std::string());
+        mThreadLog=log;
+        mStream=&log->mStream;
+    }
+}
+
+LogRecord::~LogRecord() {
+    ThreadLog *log=static_cast<ThreadLog*>(mThreadLog);
+    std::ostringstream *stream=static_cast<std::ostringstream*>(mStream);
+    std::string text=stream->str();
+    AsyncLogState &state=asyncLog();
+    if (log==NULL) {
+        delete stream;
+        log=threadLog().get();
+    }else {
+        log->mBusy=false;
+    }
+    if (!state.mEnabled.read()) {
+        std::cerr<<text;
+        return;
+    }
+    if (log->mAtLineStart) {
+        char prefix[128];
+        int64 micros=(Task::AbsTime::now()-state.mStartTime).toMicroseconds();
+        snprintf(prefix,sizeof(prefix),"[%lld.%06lld %s %s] ",
+                 (long long)(micros/1000000),(long long)(micros%1000000),
+                 mModule,levelName(mLevel));
+        text.insert(0,prefix);
+    }
+    if (!text.empty())
+        log->mAtLineStart=text[text.size()-1]=='\n';
+    if (log->mRing==NULL) {
+        boost::unique_lock<boost::mutex> lock(state.mLock);
+        log->mRing=new LogRing(state.mRingBytes);
+        state.mRings.push_back(log->mRing);
+    }
+    if (!log->mRing->push(text.data(),text.size()))
+        ++state.mDropped;
+}
+
+void startAsyncLogging(const std::string &filename, size_t bufferBytes) {
+    stopAsyncLogging();
+    AsyncLogState &state=asyncLog();
+    boost::unique_lock<boost::mutex> lock(state.mLock);
+    state.mOutput=stderr;
+    if (!filename.empty()) {
+        state.mOutput=fopen(filename.c_str(),"a");
+        if (state.mOutput==NULL) {
+            state.mOutput=stderr;
+            std::cerr<<"Unable to open log file "<<filename<<", logging to stderr\n";
+        }
+    }
+    state.mRingBytes=bufferBytes;
+    state.mStopping=false;
+    state.mThread=new boost::thread(&drainLoop);
+    state.mEnabled=1;
+}
+
+void stopAsyncLogging() {
+    AsyncLogState &state=asyncLog();
+    boost::thread *thread;
+    {
+        boost::unique_lock<boost::mutex> lock(state.mLock);
+        if (state.mThread==NULL)
+            return;
+        state.mEnabled=0;
+        state.mStopping=true;
+        thread=state.mThread;
+        state.mThread=NULL;
+    }
+    state.mWake.notify_all();
+    thread->join();
+    delete thread;
+    boost::unique_lock<boost::mutex> lock(state.mLock);
+    // Pick up records from threads that saw logging enabled just before it stopped.
+    std::string text;
+    drainRingsNoLock(state,text);
+    if (state.mOutput!=stderr)
+        fclose(state.mOutput);
+    state.mOutput=NULL;
+}
+
+size_t droppedLogRecords() {
+    return asyncLog().mDropped.read();
+}
+
 InitializeGlobalOptions o("",
                     Sirikata_Logging_OptionValue_defaultLevel=new OptionValue("loglevel",
 #ifdef NDEBUG
@@ -88,7 +440,8 @@ InitializeGlobalOptions o("",
                                                  "debug",
 #endif
                                                  "Sets the default level for logging when no per-module override",
-                                                 LogLevelParser()),
+                                                 LogLevelParser(),
+                                                 &logLevelChanged),
                     Sirikata_Logging_OptionValue_atLeastLevel=new OptionValue("maxloglevel",
 #ifdef NDEBUG
                                                  "info",
@@ -100,9 +453,14 @@ InitializeGlobalOptions o("",
                     Sirikata_Logging_OptionValue_moduleLevel=new OptionValue("moduleloglevel",
                                                 "",
                                                 "Sets a per-module logging level: should be formatted <module>=debug,<othermodule>=info...",
-                                                LogLevelMapParser()),
+                                                LogLevelMapParser(),
+                                                &logLevelChanged),
+                    new OptionValue("asynclog",
+                                    "",
+                                    "Logs through a background thread to the given file, or to stderr if set to stderr",
+                                    &OptionValueType<std::string>::lexical_cast,
+                                    &asyncLogChanged),
                      NULL);
 
-std::tr1::unordered_map<std::string,LOGGING_LEVEL> module_level;
 
 } }
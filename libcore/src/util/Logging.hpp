@@ -48,23 +48,102 @@ enum LOGGING_LEVEL {
     debug=4096,
     insane=32768
 };
+
+/**
+ * Returns the slot holding the current level of the named module. Slots
+ * live until the program exits and are updated in place whenever the
+ * loglevel or moduleloglevel options change, so callers may keep the
+ * pointer. SILOG caches it in a static at each call site and SILOGP in a
+ * ModuleSlot per module.
+ */
+SIRIKATA_EXPORT const int *moduleLevelSlot(const char *module);
+
+/**
+ * Holds the slot of one module for SILOGP, which being an expression cannot
+ * declare a static of its own. Module is the tag SILOG_DECLARE_MODULE
+ * declares, so every SILOGP of a module shares one slot, in any file.
+ */
+template <class Module> class ModuleSlot {
+public:
+    static const int *get(const char *module) {
+        static const int *sSlot=moduleLevelSlot(module);
+        return sSlot;
+    }
+};
+
+/// Recomputes every module slot from the logging options.
+SIRIKATA_EXPORT void updateModuleLevels();
+
+/// The highest level any module currently logs at.
+extern SIRIKATA_EXPORT int gMaxModuleLevel;
+
+/**
+ * Collects the text of one enabled log statement. The text is formatted
+ * into a stream reused by the calling thread and handed off as a single
+ * write when the record is destroyed: straight to std::cerr normally, or
+ * into the thread's ring buffer while asynchronous logging is running.
+ */
+class SIRIKATA_EXPORT LogRecord {
+    void *mThreadLog;
+    std::ostream *mStream;
+    const char *mModule;
+    int mLevel;
+    LogRecord(const LogRecord&);
+    LogRecord&operator=(const LogRecord&);
+public:
+    LogRecord(const char *module, int level);
+    ~LogRecord();
+    std::ostream &stream() {
+        return *mStream;
+    }
+};
+
+/**
+ * Sends log output through per-thread ring buffers drained by a background
+ * thread. Each line is prefixed with a monotonic timestamp, the module and
+ * the level. A record that does not fit in its thread's buffer is dropped
+ * and counted rather than blocking the caller.
+ * @param filename file to append to, or empty for stderr
+ * @param bufferBytes capacity of each thread's ring, rounded up to a power of two
+ */
+SIRIKATA_EXPORT void startAsyncLogging(const std::string &filename=std::string(),
+                                       size_t bufferBytes=65536);
+
+/// Writes out everything logged so far and returns to synchronous logging.
+SIRIKATA_EXPORT void stopAsyncLogging();
+
+/// Number of records dropped because a thread's ring was full.
+SIRIKATA_EXPORT size_t droppedLogRecords();
 } }
+/**
+ * Declares the tag SILOGP uses to find the slot of module. Must appear at
+ * global scope before the first SILOGP of that module in a file; repeating
+ * it is harmless.
+ */
+#define SILOG_DECLARE_MODULE(module) \
+    namespace Sirikata { namespace Logging { namespace Modules { struct module; } } }
+
 #if 1
 # ifdef DEBUG_ALL
 #  define SILOGP(module,lvl) true
+#  define SILOGNOCR(module,lvl,value) \
+    do { std::cerr << value; } while (0)
 # else
-//needs to use unsafeAs because the LOGGING_LEVEL typeinfos are not preserved across dll lines
 #  define SILOGP(module,lvl) \
-    (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel)->unsafeAs<Sirikata::Logging::LOGGING_LEVEL>()>=Sirikata::Logging::lvl&& \
-        ( (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().find(#module)==reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().end() && \
-           reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel)->unsafeAs<Sirikata::Logging::LOGGING_LEVEL>()>=(Sirikata::Logging::lvl)) \
-		   || (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().find(#module)!=reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().end() && \
-              reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >()[#module]>=Sirikata::Logging::lvl)))
+    (Sirikata::Logging::gMaxModuleLevel>=Sirikata::Logging::lvl&& \
+     *Sirikata::Logging::ModuleSlot<Sirikata::Logging::Modules::module>::get(#module)>=Sirikata::Logging::lvl)
+// The slot lookup runs once per call site; after that a disabled log
+// statement costs one load and compare.
+#  define SILOGNOCR(module,lvl,value) \
+    do { \
+        static const int *sirikata_log_slot=Sirikata::Logging::moduleLevelSlot(#module); \
+        if (*sirikata_log_slot>=Sirikata::Logging::lvl) { \
+            Sirikata::Logging::LogRecord sirikata_log_record(#module,Sirikata::Logging::lvl); \
+            sirikata_log_record.stream() << value; \
+        } \
+    } while (0)
 # endif
-# define SILOGNOCR(module,lvl,value) \
-    if (SILOGP(module,lvl)) \
-        std::cerr << value
-# define SILOG(module,lvl,value) SILOGNOCR(module,lvl,value) << std::endl
+# define SILOG(module,lvl,value) SILOGNOCR(module,lvl,value << std::endl)
 #else
 # define SILOGP(module,lvl) false
 # define SILOGNOCR(module,lvl,value)
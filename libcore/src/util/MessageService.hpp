@@ -34,7 +34,8 @@
 namespace Sirikata {
 class ObjectReference;
 class RoutableMessageHeader;
-class MessageService {
+class ParsedRoutableMessage;
+class SIRIKATA_EXPORT MessageService {
 public:
     virtual ~MessageService(){}
     /**
@@ -50,6 +51,12 @@ public:
      */
     virtual void processMessage(const RoutableMessageHeader&,
                                 MemoryReference message_body)=0;
+    /**
+     * Process a message whose header has already been decoded and whose body may have been too.
+     * The default hands the original bytes to processMessage; services that read message bodies
+     * override it so a body decoded earlier in the chain is not decoded again.
+     */
+    virtual void processParsedMessage(const ParsedRoutableMessage&message);
 
 };
 
@@ -0,0 +1,82 @@
+/*  Sirikata Messages
+ *  ParsedRoutableMessage.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_PARSED_ROUTABLE_MESSAGE_HPP_
+#define _SIRIKATA_PARSED_ROUTABLE_MESSAGE_HPP_
+
+#include "RoutableMessageHeader.hpp"
+#include "RoutableMessageBody.hpp"
+namespace Sirikata {
+/**
+ * A message as it travels down a chain of MessageServices: the decoded header, the original
+ * body bytes and the body, decoded the first time a service asks for it.
+ * Services that only look at the header or pass the message on never decode the body, and
+ * once one service has decoded it the ones after it reuse that decoding.
+ * Only lives as long as the processParsedMessage call it is passed to, so it refers to the
+ * header and bytes rather than copying them.
+ */
+class ParsedRoutableMessage : Noncopyable {
+    const RoutableMessageHeader &mHeader;
+    MemoryReference mBodyBytes;
+    mutable RoutableMessageBody mBody;
+    mutable const RoutableMessageBody *mDecodedBody;
+    mutable bool mBodyDecoded;
+public:
+    ///Wraps a header and the serialized body that came with it
+    ParsedRoutableMessage(const RoutableMessageHeader&header, MemoryReference bodyBytes)
+        : mHeader(header),mBodyBytes(bodyBytes),mDecodedBody(NULL),mBodyDecoded(false) {
+    }
+    ///Wraps a message whose sender already has the decoded body at hand; decodedBody must outlive this
+    ParsedRoutableMessage(const RoutableMessageHeader&header, MemoryReference bodyBytes, const RoutableMessageBody&decodedBody)
+        : mHeader(header),mBodyBytes(bodyBytes),mDecodedBody(&decodedBody),mBodyDecoded(true) {
+    }
+    const RoutableMessageHeader&header()const {
+        return mHeader;
+    }
+    ///The body exactly as it arrived, for forwarding without serializing it again
+    MemoryReference bodyBytes()const {
+        return mBodyBytes;
+    }
+    ///The decoded body, decoding it on the first call; NULL if the bytes do not parse
+    const RoutableMessageBody*body()const {
+        if (!mBodyDecoded) {
+            mBodyDecoded=true;
+            if (mBody.ParseFromArray(mBodyBytes.data(),mBodyBytes.size())) {
+                mDecodedBody=&mBody;
+            }
+        }
+        return mDecodedBody;
+    }
+};
+
+}
+#endif
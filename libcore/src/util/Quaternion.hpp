@@ -48,7 +48,7 @@ private:
     }
     friend Quaternion operator *(scalar, const Quaternion&);
     friend Quaternion operator /(scalar, const Quaternion&);
-    static void ToRotationMatrix(const Quaternion &q, Matrix3x3<Quaternion::scalar> kRot) {
+    static void ToRotationMatrix(const Quaternion &q, Matrix3x3<Quaternion::scalar> &kRot) {
         Quaternion::scalar fTx  = 2.0f*q.x;
         Quaternion::scalar fTy  = 2.0f*q.y;
         Quaternion::scalar fTz  = 2.0f*q.z;
@@ -35,6 +35,7 @@
 #define _SIRIKATA_SentMessage_HPP_
 
 #include "QueryTracker.hpp"
+#include "network/IOServiceFactory.hpp"
 
 namespace Sirikata {
 
@@ -60,8 +61,8 @@ public:
     typedef std::tr1::function<void (SentMessage* sentMessage, const RoutableMessageHeader &responseHeader, MemoryReference responseBody)> QueryCallback;
 
 private:
-    struct TimerHandler;
-    TimerHandler *mTimerHandle; ///< Holds onto the timeout, if one exists.
+    Network::IOService *mTimerService; ///< Non-NULL if a timeout is pending.
+    Network::IOServiceFactory::TimerHandle mTimerHandle; ///< Holds onto the timeout, if one exists.
     const int64 mId; ///< This query ID. Passed to the constructor.
 
     RoutableMessageHeader mHeader; ///< Header embedded into the struct
@@ -69,6 +70,9 @@ private:
     QueryCallback mResponseCallback; ///< Callback, or null if not yet set.
     QueryTracker *const mTracker;
 
+    /// Sends a TIMEOUT_FAILURE response to mResponseCallback.
+    void timedOut();
+
 public:
     /// Destructor: Caution: NOT VIRTUAL!!! Make sure to downcast if necessary!!
     ~SentMessage();
@@ -40,6 +40,7 @@
 #include "transfer/ProtocolRegistry.hpp"
 #include "transfer/HTTPDownloadHandler.hpp"
 
+SILOG_DECLARE_MODULE(transfer)
 
 using namespace Sirikata;
 
@@ -44,6 +44,8 @@
 #include "transfer/URI.hpp"
 #include "transfer/LRUPolicy.hpp"
 
+SILOG_DECLARE_MODULE(transfer)
+
 using namespace Sirikata;
 class DownloadTest : public CxxTest::TestSuite {
 	typedef Transfer::TransferManager TransferManager;
@@ -189,4 +189,65 @@ public:
     void testDeliveryE( void ) {
         deliveryABCDE(4);
     }
+
+    Task::EventResponse subscribeAnotherTest(Task::GenEventManager::EventPtr ev){
+        using std::tr1::placeholders::_1;
+        mCount++;
+        mManager->subscribe(ev->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::oneShotTest,this,_1));
+        return Task::EventResponse::del();
+    }
+    void testRepeatedFire( void ) {
+        using std::tr1::placeholders::_1;
+        Task::GenEventManager::EventPtr a(new EventA(1));
+        mManager->subscribe(a->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::manyShotTest,this,_1));
+        for (int i = 0; i < 1000; i++) {
+            mManager->fire(a);
+        }
+        mManager->getWorkQueue()->dequeueAll();
+        TS_ASSERT_EQUALS(mCount, 1000);
+
+        // A listener added while an event is dispatched must not see it.
+        Task::GenEventManager::EventPtr b(new EventB(1));
+        mCount = 0;
+        mManager->subscribe(b->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::subscribeAnotherTest,this,_1));
+        mManager->fire(b);
+        mManager->getWorkQueue()->dequeueAll();
+        TS_ASSERT_EQUALS(mCount, 1);
+        mManager->fire(b);
+        mManager->fire(b);
+        mManager->getWorkQueue()->dequeueAll();
+        TS_ASSERT_EQUALS(mCount, 2);
+    }
+
+    Task::EventResponse cancelTest(Task::GenEventManager::EventPtr){
+        mCount++;
+        return Task::EventResponse::cancel();
+    }
+    void testFireBatch( void ) {
+        using std::tr1::placeholders::_1;
+        Task::GenEventManager::EventPtr a(new EventA(1));
+        Task::GenEventManager::EventPtr b(new EventB(1));
+        Task::GenEventManager::EventPtr d(new EventD(1));
+        mManager->subscribe(a->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::manyShotTest,this,_1));
+        mManager->subscribe(b->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::cancelTest,this,_1),
+                            Task::EARLY);
+        mManager->subscribe(b->getId(),
+                            std::tr1::bind(&EventSystemTestSuite::doNotCall,this,_1),
+                            Task::LATE);
+        std::vector<Task::GenEventManager::EventPtr> batch;
+        batch.push_back(a);
+        batch.push_back(b);
+        batch.push_back(a);
+        batch.push_back(d);
+        batch.push_back(b);
+        mManager->fireBatch(batch.begin(), batch.end());
+        mManager->getWorkQueue()->dequeueAll();
+        TS_ASSERT_EQUALS(mCount, 4);
+        TS_ASSERT(mFail==false&&"Cancelled event reached a LATE listener");
+    }
 };
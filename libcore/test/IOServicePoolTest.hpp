@@ -0,0 +1,193 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  IOServicePoolTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "util/AtomicTypes.hpp"
+#include "util/PluginManager.hpp"
+#include "util/DynamicLibrary.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+#include <time.h>
+#include <set>
+using namespace Sirikata::Network;
+class IOServicePoolTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_SERVICES=4,
+        NUM_STREAMS=16,
+        NUM_MESSAGES=64,
+        MESSAGE_SIZE=1000
+    };
+    typedef boost::mutex::scoped_lock scoped_lock;
+    boost::mutex mMutex;
+    std::vector<boost::thread::id> mServiceThreads;
+    ///the threads each accepted stream was called back on, by order of acceptance
+    std::vector<std::set<boost::thread::id> > mStreamThreads;
+    std::vector<size_t> mStreamBytes;
+    std::vector<Stream*> mStreams;
+    Sirikata::AtomicValue<int> mCount;
+    ///waits until mCount reaches count, for at most 30 seconds
+    bool waitForCount(int count) {
+        time_t start=time(NULL);
+        while (mCount.read()<count) {
+            if (time(NULL)>start+30) {
+                return false;
+            }
+            boost::this_thread::yield();
+        }
+        return true;
+    }
+public:
+    IOServicePoolTest():mCount(0) {
+        Sirikata::PluginManager plugins;
+        plugins.load( Sirikata::DynamicLibrary::filename("tcpsst") );
+    }
+    void recordServiceThread(size_t which) {
+        scoped_lock lock(mMutex);
+        mServiceThreads[which]=boost::this_thread::get_id();
+        ++mCount;
+    }
+    void dataRecvCallback(size_t which, const Chunk&data) {
+        scoped_lock lock(mMutex);
+        mStreamThreads[which].insert(boost::this_thread::get_id());
+        mStreamBytes[which]+=data.size();
+        ++mCount;
+    }
+    void listenerNewStreamCallback(Stream * newStream, Stream::SetCallbacks& setCallbacks) {
+        if (newStream) {
+            scoped_lock lock(mMutex);
+            size_t which=mStreams.size();
+            mStreams.push_back(newStream);
+            mStreamThreads.push_back(std::set<boost::thread::id>());
+            mStreamThreads.back().insert(boost::this_thread::get_id());
+            mStreamBytes.push_back(0);
+            using std::tr1::placeholders::_1;
+            using std::tr1::placeholders::_2;
+            setCallbacks(&Stream::ignoreConnectionStatus,
+                         std::tr1::bind(&IOServicePoolTest::dataRecvCallback,this,which,_1));
+        }
+    }
+    void testAffinityService() {
+        IOServicePool pool(3);
+        TS_ASSERT_EQUALS(pool.size(),3u);
+        for (size_t hash=0;hash<9;++hash) {
+            //the same hash picks the same service whichever member of the pool asks
+            for (size_t i=0;i<pool.size();++i) {
+                TS_ASSERT_EQUALS(IOServiceFactory::affinityService(pool.service(i),hash),pool.service(hash%3));
+            }
+        }
+        IOService *io=IOServiceFactory::makeIOService();
+        TS_ASSERT_EQUALS(IOServiceFactory::affinityService(io,12345),io);
+        IOServiceFactory::destroyIOService(io);
+    }
+    void testRunUsesOneThreadPerService() {
+        IOServicePool pool(3);
+        mCount=0;
+        mServiceThreads.resize(pool.size());
+        for (size_t i=0;i<pool.size();++i) {
+            IOServiceFactory::dispatchServiceMessage(pool.service(i),std::tr1::bind(&IOServicePoolTest::recordServiceThread,this,i));
+        }
+        boost::thread runner(boost::bind(&IOServicePool::run,&pool));
+        boost::thread::id runnerId=runner.get_id();
+        TS_ASSERT(waitForCount(3));
+        //run() keeps going after its work is done until stop() is called
+        TS_ASSERT(!runner.timed_join(boost::posix_time::milliseconds(10)));
+        pool.stop();
+        runner.join();
+        scoped_lock lock(mMutex);
+        TS_ASSERT_EQUALS(mServiceThreads[0],runnerId);
+        std::set<boost::thread::id> distinct(mServiceThreads.begin(),mServiceThreads.end());
+        TS_ASSERT_EQUALS(distinct.size(),3u);
+    }
+    void testStreamsStayOnOneThread() {
+        IOServicePool pool(NUM_SERVICES);
+        mCount=0;
+        IOService *io=IOServiceFactory::makeIOService();
+        StreamListener *listener=StreamListenerFactory::getSingleton().getDefaultConstructor()(pool.service(0));
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        listener->listen(Address("127.0.0.1","9143"),std::tr1::bind(&IOServicePoolTest::listenerNewStreamCallback,this,_1,_2));
+        boost::thread poolThread(boost::bind(&IOServicePool::run,&pool));
+
+        std::string message(MESSAGE_SIZE,'T');
+        std::vector<Stream*> clients;
+        for (int i=0;i<NUM_STREAMS;++i) {
+            Stream *s=StreamFactory::getSingleton().getDefaultConstructor()(io);
+            s->connect(Address("127.0.0.1","9143"),
+                       &Stream::ignoreSubstreamCallback,
+                       &Stream::ignoreConnectionStatus,
+                       &Stream::ignoreBytesReceived);
+            for (int j=0;j<NUM_MESSAGES;++j) {
+                s->send(Chunk(message.begin(),message.end()),ReliableOrdered);
+            }
+            clients.push_back(s);
+        }
+        boost::thread clientThread(std::tr1::bind(&IOServiceFactory::runService,io));
+        TS_ASSERT(waitForCount(NUM_STREAMS*NUM_MESSAGES));
+        {
+            scoped_lock lock(mMutex);
+            TS_ASSERT_EQUALS(mStreams.size(),(size_t)NUM_STREAMS);
+            std::set<boost::thread::id> used;
+            for (size_t i=0;i<mStreamThreads.size();++i) {
+                //the new stream callback and every receive of a stream ran on the same thread
+                TS_ASSERT_EQUALS(mStreamThreads[i].size(),1u);
+                TS_ASSERT_EQUALS(mStreamBytes[i],(size_t)NUM_MESSAGES*MESSAGE_SIZE);
+                used.insert(mStreamThreads[i].begin(),mStreamThreads[i].end());
+            }
+#if SIRIKATA_PLATFORM != PLATFORM_WINDOWS
+            //streams are only spread over the pool where their sockets can be moved
+            TS_ASSERT(used.size()>1);
+#endif
+        }
+        for (size_t i=0;i<clients.size();++i) {
+            clients[i]->close();
+            delete clients[i];
+        }
+        {
+            scoped_lock lock(mMutex);
+            for (size_t i=0;i<mStreams.size();++i) {
+                delete mStreams[i];
+            }
+            mStreams.clear();
+        }
+        IOServiceFactory::stopService(io);
+        clientThread.join();
+        pool.stop();
+        poolThread.join();
+        delete listener;
+        IOServiceFactory::destroyIOService(io);
+    }
+};
@@ -0,0 +1,345 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LocTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/RoutableMessage.hpp"
+#include "util/ParsedRoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "Space_Sirikata.pbj.hpp"
+#include "space/Loc.hpp"
+#include "task/WorkQueue.hpp"
+#include "util/PluginManager.hpp"
+#include "oh/ObjectHost.hpp"
+#include "oh/HostedObject.hpp"
+#include "oh/ProxyMeshObject.hpp"
+#include "oh/SpaceIDMap.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata;
+using namespace Sirikata::Network;
+class LocTest : public CxxTest::TestSuite, MessageService
+{
+    static const int NUM_OBJECTS=4;
+    UUID mObjectId[NUM_OBJECTS];
+    IOService *mIO;
+    Loc *mLoc;
+    Time mStart;
+    ///(subscriber, object) of every update Loc routed to a subscriber
+    std::vector<std::pair<UUID,UUID> > mRouted;
+    ///the ObjLoc of each of mRouted, as it was sent
+    std::vector<std::string> mRoutedLocs;
+    ///each of mRouted as a header and serialized body, ready to hand to an object host
+    std::vector<std::pair<RoutableMessageHeader,std::string> > mRoutedMessages;
+    ///the object of every update Loc passed on to the services it forwards to
+    std::vector<UUID> mForwarded;
+
+    void clearRecords() {
+        mRouted.clear();
+        mRoutedLocs.clear();
+        mRoutedMessages.clear();
+        mForwarded.clear();
+    }
+    ///Runs the updates Loc has held back to coalesce them
+    void flush() {
+        IOServiceFactory::resetService(mIO);
+        IOServiceFactory::runService(mIO);
+    }
+    void deliver(const RoutableMessageHeader&header,const std::string&name,const std::string&argument) {
+        RoutableMessageBody body;
+        body.add_message(name,argument);
+        std::string serialized_body;
+        body.SerializeToString(&serialized_body);
+        mLoc->processMessage(header,MemoryReference(serialized_body));
+    }
+    Protocol::ObjLoc objLoc(const Time&t,const Vector3d&position,const Vector3f&velocity) {
+        Protocol::ObjLoc loc;
+        loc.set_timestamp(t);
+        loc.set_position(position);
+        loc.set_orientation(Quaternion::identity());
+        loc.set_velocity(velocity);
+        return loc;
+    }
+    ///Tells Loc about a new object, as Registration does
+    void addObject(int which,const Vector3d&position,const Vector3f&velocity=Vector3f(0,0,0)) {
+        Protocol::RetObj robj;
+        robj.set_object_reference(mObjectId[which]);
+        robj.mutable_location()=objLoc(mStart,position,velocity);
+        std::string serialized;
+        robj.SerializeToString(&serialized);
+        RoutableMessageHeader header;
+        header.set_source_object(ObjectReference::spaceServiceID());
+        header.set_source_port(Services::REGISTRATION);
+        deliver(header,"RetObj",serialized);
+    }
+    ///Sends a location update from an object; returns it serialized
+    std::string moveObject(int which,const Duration&sinceStart,const Vector3d&position,const Vector3f&velocity=Vector3f(0,0,0)) {
+        std::string serialized;
+        objLoc(mStart+sinceStart,position,velocity).SerializeToString(&serialized);
+        RoutableMessageHeader header;
+        header.set_source_object(ObjectReference(mObjectId[which]));
+        header.set_destination_object(ObjectReference::spaceServiceID());
+        header.set_destination_port(Services::LOC);
+        deliver(header,"",serialized);
+        return serialized;
+    }
+    void absoluteQuery(int subscriber,uint32 id,const Vector3d&center,float radius) {
+        Protocol::NewProxQuery query;
+        query.set_query_id(id);
+        query.set_absolute_center(center);
+        query.set_max_radius(radius);
+        sendQuery(subscriber,query);
+    }
+    void relativeQuery(int subscriber,uint32 id,float radius) {
+        Protocol::NewProxQuery query;
+        query.set_query_id(id);
+        query.set_relative_center(Vector3f(0,0,0));
+        query.set_max_radius(radius);
+        sendQuery(subscriber,query);
+    }
+    void sendQuery(int subscriber,const Protocol::NewProxQuery&query) {
+        std::string serialized;
+        query.SerializeToString(&serialized);
+        RoutableMessageHeader header;
+        header.set_source_object(ObjectReference(mObjectId[subscriber]));
+        header.set_destination_object(ObjectReference::spaceServiceID());
+        header.set_destination_port(Services::GEOM);
+        deliver(header,"NewProxQuery",serialized);
+    }
+    ///how many updates about object were routed to subscriber
+    int routedCount(int subscriber,int object) {
+        return (int)std::count(mRouted.begin(),mRouted.end(),std::pair<UUID,UUID>(mObjectId[subscriber],mObjectId[object]));
+    }
+public:
+    LocTest():mIO(NULL),mLoc(NULL),mStart(Time::now()) {
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            mObjectId[i]=UUID::random();
+        }
+        Sirikata::PluginManager plugins;
+        plugins.load( Sirikata::DynamicLibrary::filename("tcpsst") );
+    }
+    void setUp() {
+        mIO=IOServiceFactory::makeIOService();
+        mLoc=new Loc(mIO);
+        mLoc->forwardMessagesTo(this);
+        mLoc->routeUpdatesThrough(this);
+        clearRecords();
+    }
+    void tearDown() {
+        delete mLoc;
+        mLoc=NULL;
+        IOServiceFactory::destroyIOService(mIO);
+        mIO=NULL;
+    }
+
+    bool forwardMessagesTo(MessageService*) {
+        return false;
+    }
+    bool endForwardingMessagesTo(MessageService*) {
+        return false;
+    }
+    void processMessage(const RoutableMessageHeader&header,MemoryReference body) {
+        ParsedRoutableMessage parsed(header,body);
+        processParsedMessage(parsed);
+    }
+    void processParsedMessage(const ParsedRoutableMessage&message) {
+        const RoutableMessageHeader&header=message.header();
+        TS_ASSERT(message.body()!=NULL);
+        if (message.body()==NULL)
+            return;
+        TS_ASSERT_EQUALS(message.body()->message_size(),1);
+        if (header.source_object()==ObjectReference::spaceServiceID()) {
+            mForwarded.push_back(header.destination_object().getAsUUID());
+        }else {
+            TS_ASSERT_EQUALS(header.destination_port(),(unsigned int)Services::LOC);
+            mRouted.push_back(std::pair<UUID,UUID>(header.destination_object().getAsUUID(),header.source_object().getAsUUID()));
+            mRoutedLocs.push_back(message.body()->message_arguments(0));
+            mRoutedMessages.push_back(std::pair<RoutableMessageHeader,std::string>(header,std::string((const char*)message.bodyBytes().data(),message.bodyBytes().size())));
+        }
+    }
+
+    void testQueryContents() {
+        addObject(0,Vector3d(0,0,0));
+        addObject(1,Vector3d(10,0,0));
+        addObject(2,Vector3d(0,-49,0));
+        addObject(3,Vector3d(500,0,0));
+        flush();
+        TS_ASSERT_EQUALS(mForwarded.size(),(size_t)NUM_OBJECTS);
+        TS_ASSERT(mRouted.empty());
+        clearRecords();
+        //the subscriber hears about every object in the sphere but itself, however many cells away
+        absoluteQuery(0,1,Vector3d(0,0,0),50);
+        TS_ASSERT_EQUALS(mRouted.size(),2u);
+        TS_ASSERT_EQUALS(routedCount(0,1),1);
+        TS_ASSERT_EQUALS(routedCount(0,2),1);
+    }
+    void testInterestFiltering() {
+        addObject(0,Vector3d(0,0,0));
+        addObject(1,Vector3d(10,0,0));
+        addObject(2,Vector3d(500,0,0));
+        absoluteQuery(0,1,Vector3d(0,0,0),50);
+        flush();
+        clearRecords();
+        //moving into the sphere is heard, moving about outside it is not
+        moveObject(2,Duration::seconds(1),Vector3d(40,0,0));
+        moveObject(1,Duration::seconds(1),Vector3d(1000,0,0));
+        flush();
+        TS_ASSERT_EQUALS(mForwarded.size(),2u);
+        TS_ASSERT_EQUALS(mRouted.size(),1u);
+        TS_ASSERT_EQUALS(routedCount(0,2),1);
+        clearRecords();
+        //an object at the edge of a sphere that spans fewer cells than the unbounded cutoff is still found
+        absoluteQuery(3,2,Vector3d(31.9,31.9,31.9),208);
+        clearRecords();
+        moveObject(2,Duration::seconds(2),Vector3d(31.9-207,31.9,31.9));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(3,2),1);
+        moveObject(2,Duration::seconds(3),Vector3d(31.9,31.9+207,31.9));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(3,2),2);
+    }
+    void testRelativeQueryFollowsSubscriber() {
+        addObject(0,Vector3d(0,0,0));
+        addObject(1,Vector3d(100,0,0));
+        relativeQuery(0,1,50);
+        TS_ASSERT(mRouted.empty());
+        //the subscriber moves several cells, taking its query along
+        moveObject(0,Duration::seconds(1),Vector3d(90,0,0));
+        flush();
+        clearRecords();
+        moveObject(1,Duration::seconds(2),Vector3d(103,0,0));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(0,1),1);
+        //unbounded relative queries follow too
+        relativeQuery(2,1,1000);
+        clearRecords();
+        addObject(2,Vector3d(5000,0,0));
+        moveObject(1,Duration::seconds(3),Vector3d(105,0,0));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(2,1),0);
+        moveObject(2,Duration::seconds(4),Vector3d(900,0,0));
+        moveObject(1,Duration::seconds(4),Vector3d(110,0,0));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(2,1),1);
+    }
+    void testDeadReckoningSuppression() {
+        addObject(0,Vector3d(0,0,0));
+        addObject(1,Vector3d(0,0,0),Vector3f(1,0,0));
+        absoluteQuery(0,1,Vector3d(0,0,0),100);
+        flush();
+        clearRecords();
+        //exactly where receivers extrapolate it to: nothing is sent
+        moveObject(1,Duration::seconds(1),Vector3d(1,0,0),Vector3f(1,0,0));
+        flush();
+        TS_ASSERT(mForwarded.empty());
+        TS_ASSERT(mRouted.empty());
+        //a change of motion goes out although the position still matches
+        moveObject(1,Duration::seconds(2),Vector3d(2,0,0),Vector3f(0,0,0));
+        flush();
+        TS_ASSERT_EQUALS(mForwarded.size(),1u);
+        TS_ASSERT_EQUALS(routedCount(0,1),1);
+        clearRecords();
+        //as does straying more than a meter from the prediction
+        moveObject(1,Duration::seconds(3),Vector3d(2.5,0,0));
+        flush();
+        TS_ASSERT(mRouted.empty());
+        moveObject(1,Duration::seconds(4),Vector3d(4,0,0));
+        flush();
+        TS_ASSERT_EQUALS(routedCount(0,1),1);
+        //a withheld update is folded into the next one that goes out
+        Protocol::ObjLoc sent;
+        TS_ASSERT(sent.ParseFromString(mRoutedLocs.back()));
+        TS_ASSERT_EQUALS(sent.position(),Vector3d(4,0,0));
+        TS_ASSERT(sent.has_velocity());
+    }
+    void testCoalescing() {
+        addObject(0,Vector3d(0,0,0));
+        addObject(1,Vector3d(0,0,0));
+        absoluteQuery(0,1,Vector3d(0,0,0),100);
+        flush();
+        clearRecords();
+        //a lone update is passed on byte for byte
+        std::string lone=moveObject(1,Duration::seconds(1),Vector3d(10,0,0));
+        flush();
+        TS_ASSERT_EQUALS(mRouted.size(),1u);
+        TS_ASSERT_EQUALS(mRoutedLocs.back(),lone);
+        clearRecords();
+        //a burst of updates before the flush costs each receiver one message with the latest location
+        moveObject(1,Duration::seconds(2),Vector3d(20,0,0));
+        moveObject(1,Duration::seconds(2.1),Vector3d(30,0,0));
+        moveObject(1,Duration::seconds(2.2),Vector3d(40,0,0));
+        TS_ASSERT(mRouted.empty());
+        flush();
+        TS_ASSERT_EQUALS(mForwarded.size(),1u);
+        TS_ASSERT_EQUALS(mRouted.size(),1u);
+        Protocol::ObjLoc sent;
+        TS_ASSERT(sent.ParseFromString(mRoutedLocs.back()));
+        TS_ASSERT_EQUALS(sent.position(),Vector3d(40,0,0));
+        TS_ASSERT_EQUALS(sent.timestamp(),mStart+Duration::seconds(2.2));
+    }
+    void testUpdatesReachObjectHost() {
+        //the object host of the subscriber is never run, so its connection to the space stays pending
+        IOService*ohIO=IOServiceFactory::makeIOService();
+        Task::ThreadSafeWorkQueue messageQueue;
+        SpaceIDMap spaceMap;
+        SpaceID space(UUID::random());
+        {
+            ObjectHost objectHost(&spaceMap,&messageQueue,ohIO);
+            HostedObjectPtr subscriber=HostedObject::construct<HostedObject>(&objectHost,mObjectId[0]);
+            subscriber->connectToSpace(space);
+            ProxyManager*proxyManager=objectHost.getProxyManager(space);
+            TS_ASSERT(proxyManager!=NULL);
+            if (proxyManager) {
+                ProxyObjectPtr proxy(new ProxyMeshObject(proxyManager,SpaceObjectReference(space,ObjectReference(mObjectId[1]))));
+                proxyManager->createObject(proxy);
+                addObject(0,Vector3d(0,0,0));
+                addObject(1,Vector3d(10,0,0));
+                absoluteQuery(0,1,Vector3d(0,0,0),100);
+                flush();
+                moveObject(1,Duration::seconds(1),Vector3d(20,0,0));
+                flush();
+                TS_ASSERT(routedCount(0,1)>0);
+                //hand the routed updates to the subscriber as its space connection would
+                for (size_t i=0;i<mRoutedMessages.size();++i) {
+                    RoutableMessageHeader header(mRoutedMessages[i].first);
+                    header.set_source_space(space);
+                    header.set_destination_space(space);
+                    subscriber->processRoutableMessage(header,MemoryReference(mRoutedMessages[i].second));
+                }
+                TS_ASSERT_EQUALS(proxy->getPosition(),Vector3d(20,0,0));
+                //an error reply to the moving object would be waiting in the message queue
+                TS_ASSERT_EQUALS(messageQueue.dequeueAll(),0u);
+                proxyManager->destroyObject(proxy);
+            }
+            subscriber.reset();
+        }
+        IOServiceFactory::destroyIOService(ohIO);
+    }
+};
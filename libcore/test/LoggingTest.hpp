@@ -0,0 +1,78 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LoggingTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/Standard.hh"
+#include <boost/thread.hpp>
+#include <cstdio>
+#include <fstream>
+class LoggingTest : public CxxTest::TestSuite
+{
+    static void logLines(int thread) {
+        for (int i=0;i<100;++i) {
+            SILOG(logging_test,error,"thread "<<thread<<" line "<<i);
+        }
+    }
+public:
+    void testAsyncLogging( void )
+    {
+        const char *filename="logging_test.log";
+        std::remove(filename);
+        size_t droppedBefore=Sirikata::Logging::droppedLogRecords();
+        Sirikata::Logging::startAsyncLogging(filename);
+        boost::thread first(std::tr1::bind(&LoggingTest::logLines,1));
+        boost::thread second(std::tr1::bind(&LoggingTest::logLines,2));
+        first.join();
+        second.join();
+        SILOGNOCR(logging_test,error,"partial ");
+        SILOG(logging_test,error,"end");
+        Sirikata::Logging::stopAsyncLogging();
+
+        std::ifstream log(filename);
+        std::string line;
+        int lines=0;
+        bool sawEnd=false;
+        while (std::getline(log,line)) {
+            if (line.find("[logging]")==0)
+                continue;
+            TS_ASSERT(line.find(" logging_test error] ")!=std::string::npos);
+            if (line.find("] partial end")!=std::string::npos)
+                sawEnd=true;
+            ++lines;
+        }
+        size_t dropped=Sirikata::Logging::droppedLogRecords()-droppedBefore;
+        TS_ASSERT_EQUALS(lines+dropped,(size_t)201);
+        TS_ASSERT(sawEnd);
+        log.close();
+        std::remove(filename);
+    }
+};
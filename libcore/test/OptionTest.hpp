@@ -32,6 +32,10 @@
 
 #include <cxxtest/TestSuite.h>
 #include "options/Options.hpp"
+
+SILOG_DECLARE_MODULE(option_test)
+SILOG_DECLARE_MODULE(option_test_other)
+
 class OptionTest : public CxxTest::TestSuite
 {
     typedef Sirikata::OptionSet OptionSet;
@@ -77,4 +81,24 @@ public:
         }
         //SILOG(option_test,info,"Logging test");
     }
+    // Two modules at one call site line must not share a cached slot.
+    static bool warnsOtherOnly() {
+        return !SILOGP(option_test,warning)&&SILOGP(option_test_other,warning);
+    }
+    void testModuleLogLevel( void )
+    {
+        const char *lowered[]={"test.exe","--loglevel=debug","--moduleloglevel=option_test=error",NULL};
+        const char *reset[]={"test.exe","--loglevel=info","--moduleloglevel=option_test_unused=fatal",NULL};
+        OptionSet::getOptions("")->parse(countString(lowered),lowered);
+        TS_ASSERT(SILOGP(option_test,error));
+        TS_ASSERT(!SILOGP(option_test,warning));
+        TS_ASSERT(SILOGP(option_test_other,debug));
+        TS_ASSERT(warnsOtherOnly());
+        const int *slot=Sirikata::Logging::moduleLevelSlot("option_test");
+        TS_ASSERT_EQUALS(*slot,(int)Sirikata::Logging::error);
+        OptionSet::getOptions("")->parse(countString(reset),reset);
+        TS_ASSERT_EQUALS(*slot,(int)Sirikata::Logging::info);
+        TS_ASSERT(!SILOGP(option_test_other,debug));
+        TS_ASSERT(!warnsOtherOnly());
+    }
 };
@@ -0,0 +1,224 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  RouterTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "network/IOServiceFactory.hpp"
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "util/RoutableMessage.hpp"
+#include "space/ObjectConnections.hpp"
+#include "space/Router.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata;
+using namespace Sirikata::Network;
+class RouterTest : public CxxTest::TestSuite
+{
+    ///Records every batch sent on it, one string per message
+    class FakeStream : public Stream {
+    public:
+        std::vector<std::vector<std::string> > mBatches;
+        void connect(const Address&,const SubstreamCallback&,const ConnectionCallback&,const BytesReceivedCallback&){}
+        void prepareOutboundConnection(const SubstreamCallback&,const ConnectionCallback&,const BytesReceivedCallback&){}
+        void connect(const Address&){}
+        Stream*factory(){return new FakeStream;}
+        Stream*clone(const SubstreamCallback&){return NULL;}
+        Stream*clone(const ConnectionCallback&,const BytesReceivedCallback&){return NULL;}
+        void send(MemoryReference data,StreamReliability reliability){
+            sendBatch(&data,1,reliability);
+        }
+        void send(MemoryReference first,MemoryReference second,StreamReliability reliability){
+            std::string both((const char*)first.data(),first.size());
+            both.append((const char*)second.data(),second.size());
+            send(MemoryReference(both),reliability);
+        }
+        void send(const Chunk&data,StreamReliability reliability){
+            send(MemoryReference(data),reliability);
+        }
+        void sendBatch(const MemoryReference*messages,size_t numMessages,StreamReliability){
+            mBatches.push_back(std::vector<std::string>());
+            for (size_t i=0;i<numMessages;++i) {
+                mBatches.back().push_back(std::string((const char*)messages[i].data(),messages[i].size()));
+            }
+        }
+        void setPriority(StreamPriority){}
+        StreamStats getStats()const{return StreamStats();}
+        StreamStats getConnectionStats()const{return StreamStats();}
+        void close(){}
+    };
+    ///Never hears of any connection: the test connects objects through FakeConnections
+    class FakeListener : public StreamListener {
+    public:
+        bool listen(const Address&,const Stream::SubstreamCallback&){return true;}
+        String listenAddressName()const{return String();}
+        Address listenAddress()const{return Address::null();}
+        void close(){}
+    };
+    ///Hands the Router whatever stream the test connected each object with
+    class FakeConnections : public ObjectConnections {
+    public:
+        std::map<UUID,Stream*> mConnected;
+        FakeConnections():ObjectConnections(new FakeListener,Address::null()){}
+        Stream*activeConnectionTo(const ObjectReference&ref) {
+            std::map<UUID,Stream*>::iterator where=mConnected.find(ref.getAsUUID());
+            return where==mConnected.end()?NULL:where->second;
+        }
+    };
+    static const int NUM_OBJECTS=3;
+    UUID mObjectId[NUM_OBJECTS];
+    FakeStream mStream[NUM_OBJECTS];
+    IOService *mIO;
+    FakeConnections *mConnections;
+    Router *mRouter;
+
+    void connect(int which) {
+        mConnections->mConnected[mObjectId[which]]=&mStream[which];
+    }
+    ///Runs the end of turn flush the Router has scheduled
+    void flush() {
+        IOServiceFactory::resetService(mIO);
+        IOServiceFactory::runService(mIO);
+    }
+    void route(int source,int destination,const std::string&body) {
+        RoutableMessageHeader header;
+        header.set_source_object(ObjectReference(mObjectId[source]));
+        header.set_destination_object(ObjectReference(mObjectId[destination]));
+        mRouter->processMessage(header,MemoryReference(body));
+    }
+    ///Checks one message as the destination receives it: the source is kept, the destination left out
+    void checkMessage(const std::string&message,int source,const std::string&body) {
+        RoutableMessageHeader header;
+        MemoryReference receivedBody=header.ParseFromArray(message.data(),message.size());
+        TS_ASSERT_EQUALS(header.source_object(),ObjectReference(mObjectId[source]));
+        TS_ASSERT(!header.has_destination_object());
+        TS_ASSERT_EQUALS(std::string((const char*)receivedBody.data(),receivedBody.size()),body);
+    }
+public:
+    RouterTest():mIO(NULL),mConnections(NULL),mRouter(NULL) {
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            mObjectId[i]=UUID::random();
+        }
+    }
+    void setUp() {
+        mIO=IOServiceFactory::makeIOService();
+        mConnections=new FakeConnections;
+        mRouter=new Router(mConnections,mIO);
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            mStream[i].mBatches.clear();
+        }
+    }
+    void tearDown() {
+        delete mRouter;
+        mRouter=NULL;
+        delete mConnections;
+        mConnections=NULL;
+        IOServiceFactory::destroyIOService(mIO);
+        mIO=NULL;
+    }
+    void testBatchesPerDestination() {
+        connect(1);
+        connect(2);
+        route(0,1,"first");
+        route(2,1,"second");
+        route(0,2,"third");
+        route(0,1,"fourth");
+        //nothing goes out until the end of the turn
+        TS_ASSERT(mStream[1].mBatches.empty());
+        TS_ASSERT(mStream[2].mBatches.empty());
+        flush();
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),1u);
+        TS_ASSERT_EQUALS(mStream[2].mBatches.size(),1u);
+        if (mStream[1].mBatches.size()==1&&mStream[1].mBatches[0].size()==3) {
+            checkMessage(mStream[1].mBatches[0][0],0,"first");
+            checkMessage(mStream[1].mBatches[0][1],2,"second");
+            checkMessage(mStream[1].mBatches[0][2],0,"fourth");
+        }else {
+            TS_FAIL("object 1 should get its three messages in one batch");
+        }
+        if (mStream[2].mBatches.size()==1&&mStream[2].mBatches[0].size()==1) {
+            checkMessage(mStream[2].mBatches[0][0],0,"third");
+        }else {
+            TS_FAIL("object 2 should get its message in one batch");
+        }
+        //a later turn starts a new batch
+        route(0,1,"fifth");
+        flush();
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),2u);
+        TS_ASSERT_EQUALS(mStream[2].mBatches.size(),1u);
+    }
+    void testLargeBatchSentImmediately() {
+        connect(1);
+        std::string body(40000,'x');
+        route(0,1,body);
+        TS_ASSERT(mStream[1].mBatches.empty());
+        //the second message takes the destination past 64KB
+        route(0,1,body);
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),1u);
+        if (mStream[1].mBatches.size()==1) {
+            TS_ASSERT_EQUALS(mStream[1].mBatches[0].size(),2u);
+        }
+        //the end of the turn has nothing left to send
+        flush();
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),1u);
+    }
+    void testUnconnectedDestinationDropped() {
+        connect(1);
+        route(0,1,"delivered");
+        route(0,2,"dropped");
+        flush();
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),1u);
+        TS_ASSERT(mStream[2].mBatches.empty());
+        //the dropped message is not held for when the object connects
+        connect(2);
+        route(0,1,"again");
+        flush();
+        TS_ASSERT(mStream[2].mBatches.empty());
+    }
+    void testIdleDestinationsForgotten() {
+        connect(1);
+        connect(2);
+        route(0,1,"one");
+        route(0,2,"two");
+        flush();
+        TS_ASSERT_EQUALS(mRouter->numDestinations(),2u);
+        //object 2 gets nothing this turn, so the flush after it drops its entry
+        route(0,1,"one again");
+        flush();
+        TS_ASSERT_EQUALS(mRouter->numDestinations(),1u);
+        TS_ASSERT_EQUALS(mStream[1].mBatches.size(),2u);
+        TS_ASSERT_EQUALS(mStream[2].mBatches.size(),1u);
+        //a forgotten destination is added again when it gets messages
+        route(0,1,"one once more");
+        route(0,2,"two again");
+        flush();
+        TS_ASSERT_EQUALS(mRouter->numDestinations(),2u);
+        TS_ASSERT_EQUALS(mStream[2].mBatches.size(),2u);
+    }
+};
@@ -0,0 +1,141 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SchedulerTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "task/Scheduler.hpp"
+#include "task/WorkQueue.hpp"
+#include "util/ThreadSafeQueue.hpp"
+using namespace Sirikata;
+class SchedulerTestSuite : public CxxTest::TestSuite
+{
+    std::vector<int> mRuns;
+    Task::FrameScheduler *mScheduler;
+    Task::SubscriptionId mSelf;
+
+    bool record(int which, bool more, Task::AbsTime) {
+        mRuns.push_back(which);
+        return more;
+    }
+    bool destroySelf(Task::AbsTime) {
+        mRuns.push_back(-1);
+        mScheduler->destroyTask(mSelf);
+        return true;
+    }
+    static Task::AbsTime later() {
+        return Task::AbsTime::now() + Duration::seconds(1.0);
+    }
+public:
+    void testPriorityOrder( void ) {
+        using std::tr1::placeholders::_1;
+        Task::FrameScheduler scheduler;
+        mRuns.clear();
+        Task::SubscriptionId low = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::record, this, 0, true, _1));
+        Task::SubscriptionId high = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::record, this, 1, true, _1), 10, Duration::zero());
+        Task::SubscriptionId once = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::record, this, 2, false, _1));
+        scheduler.readyTask(low);
+        scheduler.readyTask(once);
+        scheduler.readyTask(high);
+        scheduler.runFrame(later());
+        TS_ASSERT_EQUALS(mRuns.size(), 3u);
+        TS_ASSERT_EQUALS(mRuns[0], 1);
+        TS_ASSERT_EQUALS(mRuns[1], 0);
+        TS_ASSERT_EQUALS(mRuns[2], 2);
+        // The task returning false went to sleep.
+        scheduler.runFrame(later());
+        TS_ASSERT_EQUALS(mRuns.size(), 5u);
+        scheduler.sleepTask(high);
+        scheduler.setPriority(low, -1);
+        scheduler.readyTask(once);
+        scheduler.runFrame(later());
+        TS_ASSERT_EQUALS(mRuns.size(), 7u);
+        TS_ASSERT_EQUALS(mRuns[5], 2);
+        TS_ASSERT_EQUALS(mRuns[6], 0);
+        scheduler.destroyTask(high);
+    }
+    void testDestroyWhileRunning( void ) {
+        Task::FrameScheduler scheduler;
+        mScheduler = &scheduler;
+        mRuns.clear();
+        mSelf = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::destroySelf, this, std::tr1::placeholders::_1));
+        scheduler.readyTask(mSelf);
+        scheduler.runFrame(later());
+        scheduler.runFrame(later());
+        TS_ASSERT_EQUALS(mRuns.size(), 1u);
+    }
+    void testSkipsLateTasks( void ) {
+        using std::tr1::placeholders::_1;
+        Task::FrameScheduler scheduler;
+        mRuns.clear();
+        Task::SubscriptionId id = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::record, this, 0, true, _1));
+        scheduler.readyTask(id);
+        // A frame that has already ended still lets a task with no history run.
+        Task::AbsTime ended = Task::AbsTime::now() - Duration::seconds(1.0);
+        scheduler.runFrame(ended);
+        TS_ASSERT_EQUALS(mRuns.size(), 1u);
+        TS_ASSERT(scheduler.expectedTime(id) >= Duration::zero());
+        // Once it has a history it waits, but only for MAX_SKIPPED_FRAMES frames.
+        for (int i = 0; i < Task::FrameScheduler::MAX_SKIPPED_FRAMES; ++i) {
+            scheduler.runFrame(ended);
+        }
+        TS_ASSERT_EQUALS(mRuns.size(), 1u);
+        scheduler.runFrame(ended);
+        TS_ASSERT_EQUALS(mRuns.size(), 2u);
+    }
+    class CountItem : public Task::WorkItem {
+        int *mCount;
+    public:
+        CountItem(int *count) : mCount(count) {
+        }
+        void operator()() {
+            AutoPtr deleteMe(this);
+            ++*mCount;
+        }
+    };
+    void testWorkQueue( void ) {
+        using std::tr1::placeholders::_1;
+        Task::ThreadSafeWorkQueue queue;
+        Task::FrameScheduler scheduler(&queue);
+        mRuns.clear();
+        int count = 0;
+        for (int i = 0; i < 100; ++i) {
+            queue.enqueue(new CountItem(&count));
+        }
+        Task::SubscriptionId id = scheduler.createTask(std::tr1::bind(&SchedulerTestSuite::record, this, 0, false, _1));
+        scheduler.readyTask(id);
+        Task::AbsTime frameEnd = later();
+        scheduler.runFrame(frameEnd);
+        TS_ASSERT(Task::AbsTime::now() < frameEnd);
+        TS_ASSERT_EQUALS(count, 100);
+        TS_ASSERT(queue.probablyEmpty());
+        TS_ASSERT_EQUALS(mRuns.size(), 1u);
+    }
+};
@@ -45,10 +45,27 @@ using namespace Sirikata::Network;
 class SstTest : public CxxTest::TestSuite
 {
 public:
+    StreamReliability reliabilityOf(const std::string&message) {
+        return message.size()?(message[0]=='U'?ReliableUnordered:(message[0]=='X'?Unreliable:ReliableOrdered)):ReliableOrdered;
+    }
     void runRoutine(Stream* s) {
+        std::vector<Sirikata::MemoryReference> batch;
         for (unsigned int i=0;i<mMessagesToSend.size();++i) {
+            if (i==mMessagesToSend.size()/2) {
+                //changing priority partway must not reorder the packets of the stream
+                s->setPriority(HighPriority);
+            }
+            if (i<mMessagesToSend.size()/4) {
+                //the first quarter goes out in batches of messages that share a reliability
+                batch.push_back(Sirikata::MemoryReference(mMessagesToSend[i].data(),mMessagesToSend[i].size()));
+                if (i+1==mMessagesToSend.size()/4||reliabilityOf(mMessagesToSend[i+1])!=reliabilityOf(mMessagesToSend[i])) {
+                    s->sendBatch(&batch[0],batch.size(),reliabilityOf(mMessagesToSend[i]));
+                    batch.clear();
+                }
+                continue;
+            }
             s->send(Chunk(mMessagesToSend[i].begin(),mMessagesToSend[i].end()),
-                    mMessagesToSend[i].size()?(mMessagesToSend[i][0]=='U'?ReliableUnordered:(mMessagesToSend[i][0]=='X'?Unreliable:ReliableOrdered)):ReliableOrdered);
+                    reliabilityOf(mMessagesToSend[i]));
         }
     }
     ///this will only be calledback if main connection fails--which means that secondary stream rather than answerer to secondary stream will fail
@@ -81,8 +98,12 @@ public:
     void connectorDataRecvCallback(Stream *s,int id, const Chunk&data) {
         dataRecvCallback(s,id,data);
     }
-    void listenerDataRecvCallback(Stream *s,int id, const Chunk&data) {
-        dataRecvCallback(s,id,data);
+    void listenerDataRecvCallback(Stream *s,int id, Sirikata::MemoryReference data, Stream::ReceivedBuffer&buffer) {
+        //keep the packet without copying it when the stream allows
+        mDataMap[id].push_back(Chunk());
+        buffer.take(mDataMap[id].back());
+        TS_ASSERT_EQUALS(mDataMap[id].back().size(),data.size());
+        ++mCount;
     }
     void connectorNewStreamCallback (int id,Stream * newStream, Stream::SetCallbacks& setCallbacks) {
         if (newStream) {
@@ -104,8 +125,8 @@ public:
             mStreams.push_back(newStream);
             using std::tr1::placeholders::_1;
             using std::tr1::placeholders::_2;
-            setCallbacks(std::tr1::bind(&SstTest::connectionCallback,this,newid,_1,_2),
-                         std::tr1::bind(&SstTest::listenerDataRecvCallback,this,newStream,newid,_1));
+            setCallbacks.setReferenceCallbacks(std::tr1::bind(&SstTest::connectionCallback,this,newid,_1,_2),
+                                               std::tr1::bind(&SstTest::listenerDataRecvCallback,this,newStream,newid,_1,_2));
             ++newid;
             runRoutine(newStream);
         }
@@ -493,6 +514,13 @@ public:
                  ++datamapiter) {
                 validateVector(datamapiter->first,datamapiter->second,mMessagesToSend);
             }
+            StreamStats streamStats=r->getStats();
+            StreamStats connectionStats=r->getConnectionStats();
+            //refused unreliable messages are not counted as sent, but every message is either sent or dropped
+            TS_ASSERT(streamStats.packetsSent<=(Sirikata::uint64)mMessagesToSend.size());
+            TS_ASSERT(streamStats.packetsSent+connectionStats.unreliableDropped>=(Sirikata::uint64)mMessagesToSend.size());
+            TS_ASSERT(connectionStats.packetsSent>=streamStats.packetsSent);
+            TS_ASSERT(connectionStats.bytesSent>=streamStats.bytesSent);
             r->close();
             delete r;
         }
@@ -0,0 +1,141 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TimerWheelTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "task/TimerWheel.hpp"
+#include "task/TimerQueue.hpp"
+using namespace Sirikata;
+class TimerWheelTestSuite : public CxxTest::TestSuite
+{
+    typedef Task::TimerWheel<int> Wheel;
+    static Task::AbsTime at(int64 ms) {
+        return Task::AbsTime::microseconds(1000000) + Duration::milliseconds(ms);
+    }
+    int mCount;
+    Duration countAndStop() {
+        ++mCount;
+        return -Duration::seconds(1.0);
+    }
+    Duration countAndRepeat() {
+        ++mCount;
+        return Duration::milliseconds((int64)10);
+    }
+public:
+    void testOrdering( void ) {
+        Wheel wheel(at(0));
+        // Spread over every level, in reverse order.
+        int64 delays[] = {100000000, 5000000, 70000, 300, 40, 1};
+        for (int i = 0; i < 6; ++i) {
+            wheel.schedule(at(delays[i]), i);
+        }
+        TS_ASSERT_EQUALS(wheel.size(), 6u);
+        std::vector<int> expired;
+        wheel.expire(at(0), expired);
+        TS_ASSERT(expired.empty());
+        for (int i = 5; i >= 0; --i) {
+            wheel.expire(at(delays[i] - 1), expired);
+            TS_ASSERT_EQUALS(expired.size(), (size_t)(5 - i));
+            wheel.expire(at(delays[i]), expired);
+            TS_ASSERT_EQUALS(expired.size(), (size_t)(6 - i));
+            TS_ASSERT_EQUALS(expired.back(), i);
+        }
+        TS_ASSERT(wheel.empty());
+    }
+    void testCancel( void ) {
+        Wheel wheel(at(0));
+        Wheel::Handle a = wheel.schedule(at(10), 1);
+        Wheel::Handle b = wheel.schedule(at(100000), 2);
+        Wheel::Handle c = wheel.schedule(at(20), 3);
+        TS_ASSERT(wheel.cancel(b));
+        TS_ASSERT(!wheel.cancel(b));
+        std::vector<int> expired;
+        wheel.expire(at(200000), expired);
+        TS_ASSERT_EQUALS(expired.size(), 2u);
+        // Fired handles are stale, even once their nodes are reused.
+        TS_ASSERT(!wheel.cancel(a));
+        Wheel::Handle d = wheel.schedule(at(300000), 4);
+        TS_ASSERT(!wheel.cancel(c));
+        TS_ASSERT(!wheel.cancel(a));
+        TS_ASSERT(wheel.cancel(d));
+        TS_ASSERT(wheel.empty());
+    }
+    void testNextExpiry( void ) {
+        Wheel wheel(at(0));
+        Task::AbsTime when = Task::AbsTime::null();
+        TS_ASSERT(!wheel.nextExpiry(when));
+        wheel.schedule(at(1000), 1);
+        std::vector<int> expired;
+        // Following nextExpiry should reach the deadline without firing early.
+        while (expired.empty()) {
+            TS_ASSERT(wheel.nextExpiry(when));
+            TS_ASSERT(when <= at(1000));
+            wheel.expire(when, expired);
+        }
+        TS_ASSERT(when == at(1000));
+    }
+    void testNextExpiryAtCascade( void ) {
+        Wheel wheel(at(0));
+        wheel.schedule(at(300), 1);
+        std::vector<int> expired;
+        wheel.expire(at(200), expired);
+        wheel.schedule(at(450), 2);
+        // Stops on the 256 tick boundary with level 0 holding the later timer.
+        wheel.expire(at(255), expired);
+        TS_ASSERT(expired.empty());
+        Task::AbsTime when = Task::AbsTime::null();
+        while (expired.empty()) {
+            TS_ASSERT(wheel.nextExpiry(when));
+            TS_ASSERT(when <= at(300));
+            wheel.expire(when, expired);
+        }
+        TS_ASSERT(when == at(300));
+        TS_ASSERT_EQUALS(expired.size(), 1u);
+        TS_ASSERT_EQUALS(expired.back(), 1);
+    }
+    void testTimerQueue( void ) {
+        using std::tr1::bind;
+        Task::TimerQueue queue;
+        mCount = 0;
+        Task::AbsTime start = Task::AbsTime::now();
+        queue.schedule(start, bind(&TimerWheelTestSuite::countAndStop, this));
+        Task::SubscriptionId id = queue.scheduleId(start, bind(&TimerWheelTestSuite::countAndRepeat, this));
+        queue.processTimers(start + Duration::milliseconds((int64)1));
+        TS_ASSERT_EQUALS(mCount, 2);
+        TS_ASSERT_EQUALS(queue.size(), 1u);
+        queue.processTimers(start + Duration::milliseconds((int64)12));
+        TS_ASSERT_EQUALS(mCount, 3);
+        queue.unschedule(id);
+        TS_ASSERT_EQUALS(queue.size(), 0u);
+        queue.processTimers(start + Duration::seconds(1.0));
+        TS_ASSERT_EQUALS(mCount, 3);
+    }
+};
@@ -0,0 +1,215 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  WorkQueueTest.hpp
+ *
+ *  Copyright (c) 2008, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "task/WorkQueue.hpp"
+#include "task/WorkStealingQueue.hpp"
+#include "util/AtomicTypes.hpp"
+#include "util/LockFreeQueue.hpp"
+#include <boost/thread.hpp>
+using namespace Sirikata;
+class WorkQueueTestSuite : public CxxTest::TestSuite
+{
+    class CountItem : public Task::WorkItem {
+        Task::WorkQueue *mQueue;
+        AtomicValue<int> *mCount;
+        int mSpawn;
+    public:
+        CountItem(Task::WorkQueue *queue, AtomicValue<int> *count, int spawn)
+            : mQueue(queue), mCount(count), mSpawn(spawn) {
+        }
+        void operator()() {
+            AutoPtr deleteMe(this);
+            ++(*mCount);
+            for (int i = 0; i < mSpawn; ++i) {
+                mQueue->enqueue(new CountItem(mQueue, mCount, 0));
+            }
+        }
+    };
+    /// Runs a binary tree of items below it, as work that splits itself up would.
+    class TreeItem : public Task::WorkItem {
+        Task::WorkQueue *mQueue;
+        AtomicValue<int> *mCount;
+        int mDepth;
+    public:
+        TreeItem(Task::WorkQueue *queue, AtomicValue<int> *count, int depth)
+            : mQueue(queue), mCount(count), mDepth(depth) {
+        }
+        void operator()() {
+            AutoPtr deleteMe(this);
+            ++(*mCount);
+            if (mDepth > 0) {
+                mQueue->enqueue(new TreeItem(mQueue, mCount, mDepth-1));
+                mQueue->enqueue(new TreeItem(mQueue, mCount, mDepth-1));
+            }
+        }
+    };
+    static void produce(Task::WorkQueue *queue, AtomicValue<int> *count, int num) {
+        for (int i = 0; i < num; ++i) {
+            queue->enqueue(new CountItem(queue, count, i%2));
+        }
+    }
+public:
+    void testWorkStealingPoll( void ) {
+        AtomicValue<int> count(0);
+        Task::WorkStealingQueue queue(4);
+        TS_ASSERT(queue.probablyEmpty());
+        produce(&queue, &count, 10);
+        TS_ASSERT(!queue.probablyEmpty());
+        while (queue.dequeuePoll()) {
+        }
+        TS_ASSERT_EQUALS(count.read(), 15);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+    void testWorkStealingDequeueAll( void ) {
+        AtomicValue<int> count(0);
+        Task::WorkStealingQueue queue(4);
+        produce(&queue, &count, 10);
+        queue.dequeueAll();
+        queue.dequeueAll();
+        TS_ASSERT_EQUALS(count.read(), 15);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+    void runThreads(Task::WorkQueue *queue, int numWorkers) {
+        const int numPerProducer = 10000;
+        AtomicValue<int> count(0);
+        Task::WorkQueueThread *workers = queue->createWorkerThreads(numWorkers);
+        boost::thread first(std::tr1::bind(&WorkQueueTestSuite::produce, queue, &count, numPerProducer));
+        boost::thread second(std::tr1::bind(&WorkQueueTestSuite::produce, queue, &count, numPerProducer));
+        first.join();
+        second.join();
+        while (count.read() < 3*numPerProducer) {
+            boost::this_thread::yield();
+        }
+        queue->destroyWorkerThreads(workers);
+        TS_ASSERT_EQUALS(count.read(), 3*numPerProducer);
+        TS_ASSERT(queue->probablyEmpty());
+    }
+    void testWorkStealingThreads( void ) {
+        Task::WorkStealingQueue queue(4);
+        runThreads(&queue, 4);
+    }
+    void testWorkStealingStaysLocal( void ) {
+        const int numWorkers = 4;
+        const int depth = 12;
+        const int numPerTree = (2<<depth)-1;
+        AtomicValue<int> count(0);
+        Task::WorkStealingQueue queue(numWorkers);
+        Task::WorkQueueThread *workers = queue.createWorkerThreads(numWorkers);
+        for (int i = 0; i < numWorkers; ++i) {
+            queue.enqueue(new TreeItem(&queue, &count, depth));
+        }
+        while (count.read() < numWorkers*numPerTree) {
+            boost::this_thread::yield();
+        }
+        queue.destroyWorkerThreads(workers);
+        TS_ASSERT_EQUALS(count.read(), numWorkers*numPerTree);
+        // Items a worker spawns go on its own deque, so all but a few are
+        // run without touching another worker's lock.
+        TS_ASSERT_LESS_THAN(queue.numSteals(), (unsigned int)(numWorkers*numPerTree/100));
+    }
+    void testLockFreeThreads( void ) {
+        Task::LockFreeWorkQueue queue;
+        runThreads(&queue, 4);
+    }
+    static void pushRange(LockFreeQueue<int> *queue, int num) {
+        for (int i = 1; i <= num; ++i) {
+            queue->push(i);
+        }
+    }
+    void testLockFreeBoundedPool( void ) {
+        const int numPerProducer = 20000;
+        // A tiny free list forces most popped nodes back to the allocator.
+        LockFreeQueue<int> queue(4);
+        boost::thread first(std::tr1::bind(&WorkQueueTestSuite::pushRange, &queue, numPerProducer));
+        boost::thread second(std::tr1::bind(&WorkQueueTestSuite::pushRange, &queue, numPerProducer));
+        int64 sum = 0;
+        int count = 0;
+        int value;
+        while (count < 2*numPerProducer) {
+            if (queue.pop(value)) {
+                sum += value;
+                ++count;
+            }
+        }
+        first.join();
+        second.join();
+        TS_ASSERT_EQUALS(sum, (int64)numPerProducer*(numPerProducer+1));
+        TS_ASSERT(!queue.pop(value));
+    }
+    /// Yields inside every queue operation, so operations of different threads overlap even on one core.
+    class SlowCopy {
+    public:
+        int mValue;
+        SlowCopy(int value = 0) : mValue(value) {
+        }
+        SlowCopy &operator=(const SlowCopy &other) {
+            mValue = other.mValue;
+            boost::this_thread::yield();
+            return *this;
+        }
+    };
+    static void pushAndPop(LockFreeQueue<SlowCopy> *queue, int num, AtomicValue<int> *popped, int *maxLimbo) {
+        SlowCopy value;
+        for (int i = 1; i <= num; ++i) {
+            queue->push(SlowCopy(i));
+            if (queue->pop(value)) {
+                ++*popped;
+            }
+            *maxLimbo = std::max(*maxLimbo, queue->numLimboNodes());
+        }
+    }
+    void testLockFreeLimboBounded( void ) {
+        const int numThreads = 4;
+        const int numPerThread = 20000;
+        // Every popped node goes to limbo, and with the queue never idle it
+        // only leaves limbo as the epoch moves on under the running threads.
+        LockFreeQueue<SlowCopy> queue(0);
+        AtomicValue<int> popped(0);
+        int maxLimbo[numThreads];
+        std::vector<boost::thread*> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            maxLimbo[i] = 0;
+            threads.push_back(new boost::thread(std::tr1::bind(&WorkQueueTestSuite::pushAndPop, &queue, numPerThread, &popped, &maxLimbo[i])));
+        }
+        for (int i = 0; i < numThreads; ++i) {
+            threads[i]->join();
+            delete threads[i];
+            // Left alone the limbo grows to nearly every node ever popped.
+            TS_ASSERT_LESS_THAN_EQUALS(maxLimbo[i], 1000);
+        }
+        // Every thread pops after pushing, so each push is popped by someone.
+        TS_ASSERT_EQUALS(popped.read(), numThreads*numPerThread);
+        SlowCopy value;
+        TS_ASSERT(!queue.pop(value));
+    }
+};
@@ -967,7 +967,7 @@ bool OgreSystem::renderOneFrame(Time curFrameTime, Duration deltaTime) {
 static Time debugStartTime = Time::now();
 bool OgreSystem::tick(){
     GraphicsResourceManager::getSingleton().computeLoadedSet();
-    Time curFrameTime(Time::now());
+    Time curFrameTime(Time::updateFrameTime());
     Time finishTime(curFrameTime + desiredTickRate()); // arbitrary
 
     tickInputHandler(curFrameTime);
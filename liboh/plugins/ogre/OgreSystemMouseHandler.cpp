@@ -227,6 +227,7 @@ private:
         return true;
     }
     int mWhichRayObject;
+    // Picks at the frame time, so the ray hits objects where the frame the user clicked on drew them.
     void selectObjectAction(Vector2f p, int direction) {
         CameraEntity *camera = mParent->mPrimaryCamera;
         if (!camera) {
@@ -235,7 +236,7 @@ private:
         if (mParent->mInputManager->isModifierDown(Input::MOD_SHIFT)) {
             // add object.
             int numObjectsUnderCursor=0;
-            Entity *mouseOver = hoverEntity(camera, Task::AbsTime::now(), p.x, p.y, &numObjectsUnderCursor, mWhichRayObject);
+            Entity *mouseOver = hoverEntity(camera, Task::AbsTime::frameTime(), p.x, p.y, &numObjectsUnderCursor, mWhichRayObject);
             if (!mouseOver) {
                 return;
             }
@@ -254,7 +255,7 @@ private:
             }else {
                 mWhichRayObject=0;
             }
-            mouseOver = hoverEntity(camera, Task::AbsTime::now(), p.x, p.y, &mLastHitCount, mWhichRayObject);
+            mouseOver = hoverEntity(camera, Task::AbsTime::frameTime(), p.x, p.y, &mLastHitCount, mWhichRayObject);
             if (!mouseOver) {
                 return;
             }
@@ -288,9 +289,9 @@ private:
             clearSelection();
             mWhichRayObject+=direction;
             int numObjectsUnderCursor=0;
-            Entity *mouseOver = hoverEntity(camera, Task::AbsTime::now(), p.x, p.y, &numObjectsUnderCursor, mWhichRayObject);
+            Entity *mouseOver = hoverEntity(camera, Task::AbsTime::frameTime(), p.x, p.y, &numObjectsUnderCursor, mWhichRayObject);
             if (recentMouseInRange(p.x, p.y, &mLastHitX, &mLastHitY)==false||numObjectsUnderCursor!=mLastHitCount){
-                mouseOver = hoverEntity(camera, Task::AbsTime::now(), p.x, p.y, &mLastHitCount, mWhichRayObject=0);
+                mouseOver = hoverEntity(camera, Task::AbsTime::frameTime(), p.x, p.y, &mLastHitCount, mWhichRayObject=0);
             }
             if (mouseOver) {
                 mSelectedObjects.insert(mouseOver->getProxyPtr());
@@ -401,6 +401,28 @@ struct HostedObject::PrivateCallbacks {
         }
     }
 
+    static void handleLocMessage(HostedObject *realThis, const RoutableMessageHeader &header, MemoryReference bodyData) {
+        /// The space's Loc pushes the moves of objects our queries can see. Nobody waits for an answer.
+        RoutableMessageBody msg;
+        msg.ParseFromArray(bodyData.data(), bodyData.length());
+        ProxyManager *pm = realThis->getObjectHost()->getProxyManager(header.source_space());
+        if (!pm) {
+            return;
+        }
+        ProxyObjectPtr obj(pm->getProxyObject(SpaceObjectReference(header.source_space(), header.source_object())));
+        if (!obj) {
+            SILOG(cppoh,debug,"Location update for unknown object "<<header.source_object());
+            return;
+        }
+        for (int i = 0; i < msg.message_size(); ++i) {
+            if (msg.message_names(i) == "ObjLoc") {
+                ObjLoc loc;
+                loc.ParseFromString(msg.message_arguments(i));
+                realThis->receivedPositionUpdate(obj, loc, false);
+            }
+        }
+    }
+
     static void receivedProxObjectLocation(
         const HostedObjectWPtr &weakThis,
         SentMessage* sentMessage,
@@ -806,6 +828,8 @@ void HostedObject::processRoutableMessage(const RoutableMessageHeader &header, M
         PrivateCallbacks::handleRPCMessage(this, header, bodyData);
     } else if (header.destination_port() == Services::PERSISTENCE) {
         PrivateCallbacks::handlePersistenceMessage(this, header, bodyData);
+    } else if (header.destination_port() == Services::LOC) {
+        PrivateCallbacks::handleLocMessage(this, header, bodyData);
     } else {
         if (mObjectScript) {
             mObjectScript->processMessage(header, bodyData);
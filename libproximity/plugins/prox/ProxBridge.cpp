@@ -52,9 +52,9 @@ void ProxBridge::newObjectStreamCallback(Network::Stream*newStream, Network::Str
     if (newStream) {
         std::tr1::shared_ptr<std::vector<ObjectReference> > ref(new std::vector<ObjectReference>());
         std::tr1::shared_ptr<Network::Stream> stream(newStream);
-        setCallbacks(
+        setCallbacks.setReferenceCallbacks(
             std::tr1::bind(&ProxBridge::disconnectionCallback,this,stream,ref,_1,_2),
-            std::tr1::bind(&ProxBridge::incomingMessage,this,stream,ref,_1));
+            std::tr1::bind(&ProxBridge::incomingMessage,this,stream,ref,_1,_2));
     }else {
         //whole object host has disconnected;
     }
@@ -450,11 +450,12 @@ void ProxBridge::delObj(const ObjectReference&source, const Sirikata::Protocol::
 
 void ProxBridge::incomingMessage(const std::tr1::weak_ptr<Network::Stream>&strm,
                                  const std::tr1::shared_ptr<std::vector<ObjectReference> >&ref,
-                                 const Network::Chunk&data) {
+                                 MemoryReference data,
+                                 Network::Stream::ReceivedBuffer&) {
     RoutableMessageHeader hdr;
 
     if (data.size()) {
-        MemoryReference bodyData=hdr.ParseFromArray(&*data.begin(),data.size());
+        MemoryReference bodyData=hdr.ParseFromArray(data.data(),data.size());
         size_t old_size=ref->size();
         if (hdr.has_source_object()) {
             ObjectReference source_object(hdr.source_object());
@@ -108,7 +108,8 @@ class ProxBridge : public ProximitySystem {
     void newObjectStreamCallback(Network::Stream*newStream, Network::Stream::SetCallbacks&setCallbacks);
     void incomingMessage(const std::tr1::weak_ptr<Network::Stream>&strm,
                          const std::tr1::shared_ptr<std::vector<ObjectReference> >&ref,
-                         const Network::Chunk&data);
+                         MemoryReference data,
+                         Network::Stream::ReceivedBuffer&buffer);
     void disconnectionCallback(const std::tr1::shared_ptr<Network::Stream>&strm,
                                const std::tr1::shared_ptr<std::vector<ObjectReference> >&ref,
                                Network::Stream::ConnectionStatus stat,
@@ -35,25 +35,152 @@
 
 #include <space/Platform.hpp>
 #include <util/ObjectReference.hpp>
+#include <util/Extrapolation.hpp>
+#include <network/IOServiceFactory.hpp>
 
 namespace Sirikata {
 namespace Protocol {
 class ObjLoc;
+class NewProxQuery;
 }
 class Loc;
 class Oseg;
 class Cseg;
 
+/**
+ * Loc keeps the location of every object in the space and tells interested parties when it changes.
+ * Objects are kept in a uniform grid of GRID_CELL_SIZE meter cells, as are the regions covered by the
+ * NewProxQuery requests objects have made, so a location update only goes to the subscribers whose
+ * query sphere contains the object.  Updates that the receivers' own dead reckoning would have
+ * predicted to within UpdateNeeded's tolerance are not sent at all.
+ * Updates are not passed on as they arrive: an object's updates are folded together for the
+ * loc-coalesce window (by default until the end of the current io service turn), so a burst of
+ * updates from one object costs each subscriber a single message.
+ */
 class SIRIKATA_SPACE_EXPORT Loc : public MessageService {
+    /**
+     * Whether a freshly reported location is far enough from what receivers extrapolate
+     * from the last update they were sent that they must be told about it
+     */
+    class UpdateNeeded {
+    public:
+        bool operator() (const Location&updatedValue, const Location&predictedValue)const;
+    };
+    typedef TimedWeightedExtrapolator<Location,UpdateNeeded> SentLocation;
+    class GridCell {
+    public:
+        int32 x;
+        int32 y;
+        int32 z;
+        GridCell(int32 x,int32 y,int32 z):x(x),y(y),z(z){}
+        bool operator==(const GridCell&other)const {
+            return x==other.x&&y==other.y&&z==other.z;
+        }
+        class Hasher {public:
+            size_t operator()(const GridCell&cell) const {
+                return (size_t)cell.x*73856093^(size_t)cell.y*19349663^(size_t)cell.z*83492791;
+            }
+        };
+    };
+    ///a query is named by the object that made it and the id that object chose for it
+    typedef std::pair<ObjectReference,uint32> QueryKey;
+    class Cell {
+    public:
+        std::set<ObjectReference> mObjects;
+        std::set<QueryKey> mQueries;
+    };
+    class ObjectState {
+    public:
+        ///the most recent location reported by the object
+        Location mLocation;
+        Time mUpdateTime;
+        ///what everyone who hears about this object has been told
+        SentLocation mSent;
+        ///whether updates have been withheld since mSent was last updated
+        bool mWithheld;
+        ///whether receivers must start over from mLocation rather than blend into it
+        bool mReset;
+        ///how many updates have arrived since the last flushUpdates
+        uint32 mPendingUpdates;
+        ///update_flags of the updates since the last flushUpdates
+        uint32 mPendingFlags;
+        ///the first update since the last flushUpdates as the object sent it, if it arrived serialized
+        std::string mPendingLoc;
+        GridCell mCell;
+        ObjectState(const Time&t,const Location&location,const GridCell&cell);
+    };
+    class Query {
+    public:
+        ///if true mCenter is an offset from the subscriber, otherwise it is an absolute position
+        bool mRelative;
+        Vector3d mCenter;
+        float32 mRadius;
+        ///the cells covering the sphere, or empty if the query is registered in mUnboundedQueries
+        std::vector<GridCell> mCells;
+    };
+    enum {
+        GRID_CELL_SIZE=32,
+        ///queries whose padded cells could number more than this along an axis are checked against every update instead
+        MAX_QUERY_CELLS_PER_AXIS=16
+    };
+    typedef std::tr1::unordered_map<ObjectReference,ObjectState,ObjectReference::Hasher> ObjectMap;
+    typedef std::tr1::unordered_map<GridCell,Cell,GridCell::Hasher> CellMap;
+    ///ordered so the queries made by one object are next to each other
+    typedef std::map<QueryKey,Query> QueryMap;
+    ///space services that need every location, such as the proximity system
     std::vector<MessageService*> mServices;
+    ///where updates for subscribing objects are sent
+    MessageService*mRouter;
+    ObjectMap mObjects;
+    CellMap mCells;
+    QueryMap mQueries;
+    std::set<QueryKey> mUnboundedQueries;
+    Network::IOService*mIO;
+    ///objects with updates waiting for flushUpdates
+    std::vector<ObjectReference> mPendingObjects;
+    ///scratch space for the objects being flushed, so updates arriving meanwhile wait for the next flush
+    std::vector<ObjectReference> mFlushing;
+    ///whether flushUpdates has been scheduled
+    bool mFlushScheduled;
+    Network::IOServiceFactory::TimerHandle mFlushTimer;
+    static Duration coalesceWindow();
+    static GridCell cellContaining(const Vector3d&position);
     void processMessage(const ObjectReference&object_reference,const Protocol::ObjLoc&loc);
+    ///Sends the serialized ObjLoc of an object on to every service in mServices
+    void processMessage(const ObjectReference&object_reference,const std::string&serialized_loc);
+    /**
+     * Records a location update from an object for the next flushUpdates.
+     * serialized_loc may be NULL if loc did not arrive serialized
+     * \param reset whether receivers must start over from this location, as when the object is new
+     */
+    void updateLocation(const ObjectReference&object_reference,const Protocol::ObjLoc&loc,const std::string*serialized_loc,bool reset);
+    ///Passes on the latest location of every object that has been updated since the last call
+    void flushUpdates();
+    ///Passes on the latest location of one object unless receivers would have predicted it
+    void sendUpdates(const ObjectReference&object_reference,ObjectState&state);
+    ///Sends an update for object to every subscriber other than itself whose query contains position
+    void notifySubscribers(const ObjectReference&object,const Vector3d&position,const std::string&serialized_loc);
+    ///Sends the current location of every object inside the query to subscriber
+    void sendContents(const ObjectReference&subscriber,const Query&query);
+    ///The center of a query right now, or false if it is relative to an object Loc has no location for
+    bool queryCenter(const QueryKey&key,const Query&query,Vector3d&center)const;
+    void sendUpdate(const ObjectReference&subscriber,const ObjectReference&object,const std::string&serialized_loc);
+    void newQuery(const ObjectReference&subscriber,const Protocol::NewProxQuery&newQuery);
+    void delQuery(const QueryKey&key);
+    ///Puts the query into the cells around its current center
+    void placeQuery(const QueryKey&key,Query&query);
+    void removeObject(const ObjectReference&object_reference);
 public:
-    Loc();
+    Loc(Network::IOService*io);
     ~Loc();
     bool forwardMessagesTo(MessageService*);
     bool endForwardingMessagesTo(MessageService*);
+    ///Sets the service, normally the Router, that carries location updates to the objects that subscribed to them
+    void routeUpdatesThrough(MessageService*router);
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    ///Same as processMessage, reusing the body if the sender already decoded it
+    void processParsedMessage(const ParsedRoutableMessage&message);
 
 }; // class Space
 
@@ -104,7 +104,7 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     ///The message that lets users know which services the space supports and on what ObjectReferences
     String mSpaceServiceIntroductionMessage;
     ///processes a message from the RegistrationService: returns true if the object is a new object (false if the object was deleted)
-    bool processNewObject(const RoutableMessageHeader&hdr,MemoryReference body_array,ObjectReference&);
+    bool processNewObject(const ParsedRoutableMessage&message,ObjectReference&);
     ///processes a message for an object that exists in the Space (i.e. not a temporary object with fake UUID), forwarding message if necessary
     void processExistingObject(const RoutableMessageHeader&hdr,MemoryReference body_array, bool forward);
     ///callback for new streams, giving them a temporary UUID and assigning it into mTemporaryStreams and mStreams
@@ -118,6 +118,8 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
      *                                     that they may to a service or a forwader
      */
     void bytesReceivedCallback(Network::Stream*stream,const Network::Chunk&chunk);
+    ///bytesReceivedCallback for bytes that are still in the stream's read buffer
+    void bytesReferenceReceivedCallback(Network::Stream*stream,MemoryReference chunk,Network::Stream::ReceivedBuffer&buffer);
     ///makes a Disconnection message for the Registration service in the event a connection should unexpectedly close
     void forgeDisconnectionMessage(const ObjectReference&ref);
     ///actually close a Stream connection to an object.
@@ -127,7 +129,7 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
                       const Network::Address &listenAddress);
     ~ObjectConnections();
     ///If there's an active connection to a given object reference
-    Network::Stream* activeConnectionTo(const ObjectReference&);
+    virtual Network::Stream* activeConnectionTo(const ObjectReference&);
     ///If there's an as-of-yet-unnamed connection to a given object reference
     Network::Stream* temporaryConnectionTo(const UUID&);
     ///The space needs to register here so that the ObjectConnection knows how to forward messages
@@ -137,6 +139,8 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     ///Processes a message destined for an Object referenced by either temporary (from registrationService) or permanent (from anyone else) ID in the header
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    ///Same as processMessage, reusing the body if the sender already decoded it
+    void processParsedMessage(const ParsedRoutableMessage&message);
     
 };
 }
@@ -44,6 +44,10 @@ class Cseg;
 class SIRIKATA_SPACE_EXPORT Registration : public MessageService {
     std::vector<MessageService*> mServices;
     SHA256 mPrivateKey;
+    ///scratch space for copying the requested location of a new object into its RetObj
+    std::string mLocationBuffer;
+    ///scratch space for the serialized RetObj reply, kept between registrations so it is not reallocated for each one
+    std::string mReplyBuffer;
 public:
     Registration(const SHA256&privateKey);
     ~Registration();
@@ -51,12 +55,14 @@ public:
     bool endForwardingMessagesTo(MessageService*);
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    ///Same as processMessage, reusing the body if the sender already decoded it
+    void processParsedMessage(const ParsedRoutableMessage&message);
     /**
      * A sample registration service. Right now simply takes a private key, 
      * hashes it with the given evidence UUID and returns the hashed value
+     * The message body must decode.
      */
-    void asyncRegister(const RoutableMessageHeader&header,
-                       const RoutableMessageBody& message_body);
+    void asyncRegister(const ParsedRoutableMessage&message);
 }; // class Space
 
 } // namespace Sirikata
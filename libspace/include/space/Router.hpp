@@ -34,17 +34,63 @@
 #define _SIRIKATA_ROUTER_HPP_
 
 #include <space/Platform.hpp>
+#include <util/ObjectReference.hpp>
+#include <network/IOServiceFactory.hpp>
 namespace Sirikata {
+class ObjectConnections;
 
+/**
+ * The Router delivers messages from one object to another object connected to this space node.
+ * Messages are not written out one at a time: they wait in a table keyed by destination
+ * until the current turn of the io service is done, and then each destination gets all of
+ * its messages in a single Stream::sendBatch on whatever stream ObjectConnections currently has to it.
+ * Table entries are reused from one turn to the next, so a steady stream of traffic does not allocate.
+ */
 class SIRIKATA_SPACE_EXPORT Router : public MessageService {
-    std::vector<MessageService*> mServices;
+    /**
+     * The messages waiting for one destination, each one a serialized header followed by the body
+     */
+    class PendingMessages {
+    public:
+        ///every message back to back
+        std::string mData;
+        ///offset in mData where each message ends
+        std::vector<size_t> mEnds;
+        ///whether the destination has had messages since the last flushAll: idle destinations are dropped from the table
+        bool mRecentlyUsed;
+        PendingMessages():mRecentlyUsed(false){}
+    };
+    typedef std::tr1::unordered_map<ObjectReference,PendingMessages,ObjectReference::Hasher> DestinationMap;
+    enum {
+        ///a destination with this many bytes waiting is sent to immediately instead of at the end of the turn
+        MAX_PENDING_BYTES=65536
+    };
+    DestinationMap mDestinations;
+    ObjectConnections *mObjectConnections;
+    Network::IOService *mIO;
+    ///whether flushAll has been scheduled
+    bool mFlushScheduled;
+    Network::IOServiceFactory::TimerHandle mFlushTimer;
+    ///scratch space for the list of messages handed to sendBatch
+    std::vector<MemoryReference> mBatch;
+    ///sends everything waiting for one destination, or drops it if the destination is not connected
+    void flushDestination(const ObjectReference&destination, PendingMessages&pending);
+    ///sends everything waiting and forgets destinations that were idle since the last flush
+    void flushAll();
 public:
-	Router(){}
-	~Router(){}
+    Router(ObjectConnections*objectConnections, Network::IOService*io);
+    ~Router();
+    ///The Router only delivers to objects
+    bool forwardMessagesTo(MessageService*){return false;}
+    ///The Router only delivers to objects
+    bool endForwardingMessagesTo(MessageService*){return false;}
+    ///Queues the message for its destination object; it goes out at the end of the current io service turn
     void processMessage(const RoutableMessageHeader&header,
-		                MemoryReference message_body){}
-}; // class Space
+		                MemoryReference message_body);
+    ///How many destinations the table holds, including those that went idle since the last flush
+    size_t numDestinations()const{return mDestinations.size();}
+}; // class Router
 
 } // namespace Sirikata
 
-#endif //_SIRIKATA_REGISTRATION_HPP
+#endif //_SIRIKATA_ROUTER_HPP_
@@ -66,7 +66,7 @@ class SIRIKATA_SPACE_EXPORT Space :public MessageService{
     Oseg *mObjectSegmentation;
     ///The coordinate segmentation service: which Space server hosts a given set of coordinates
     Cseg *mCoordinateSegmentation;
-    ///The routing system to forward messages to other SpaceServers(given by mObjectSegmentation/mCoordinateSegmentation)
+    ///The router delivering messages between objects (and in future to other SpaceServers given by mObjectSegmentation/mCoordinateSegmentation)
     MessageService *mRouter;
     ///Active connections to object hosts, with streams to individual objects;
     ObjectConnections* mObjectConnections;
@@ -77,11 +77,13 @@ public:
     bool forwardMessagesTo(MessageService*){return false;}
     ///Space does not forward messages outside of what it chooses by looking at the mServices and mRouter classes
     bool endForwardingMessagesTo(MessageService*){return false;}
-    ///This method calls the other processMessage method
+    ///This method parses the header and calls processParsedMessage
     void processMessage(const ObjectReference*ref,MemoryReference message);
-    ///This method checks if the message is destined for any named mServices. If not, it gives it to mRouter
+    ///This method calls processParsedMessage
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    ///Hands the message to the named mServices or else to mRouter without decoding its body
+    void processParsedMessage(const ParsedRoutableMessage&message);
 
     Space(const SpaceID&);
     ~Space();
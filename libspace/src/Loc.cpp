@@ -34,14 +34,55 @@
 #include <space/Registration.hpp>
 #include "Space_Sirikata.pbj.hpp"
 #include "util/RoutableMessage.hpp"
+#include "util/ParsedRoutableMessage.hpp"
 #include "util/KnownServices.hpp"
+#include "options/Options.hpp"
 namespace Sirikata {
-Loc::Loc(){
+namespace {
+OptionValue*sCoalesceWindow;
+InitializeGlobalOptions locOptions("",
+    sCoalesceWindow=new OptionValue("loc-coalesce","0",OptionValueType<double>(),"Seconds Loc waits to fold together an object's location updates before passing them on, 0 to wait only until the end of the current io service turn"),
+    NULL
+);
+}
+
+bool Loc::UpdateNeeded::operator() (
+    const Location&updatedValue,
+    const Location&predictedValue) const {
+    Vector3f ux,uy,uz,px,py,pz;
+    updatedValue.getOrientation().toAxes(ux,uy,uz);
+    predictedValue.getOrientation().toAxes(px,py,pz);
+    //a change in motion must go out even while the position still matches, or receivers would extrapolate the old motion forever
+    return (updatedValue.getPosition()-predictedValue.getPosition()).lengthSquared()>1.0 ||
+           ux.dot(px)<.9||uy.dot(py)<.9||uz.dot(pz)<.9 ||
+           (updatedValue.getVelocity()-predictedValue.getVelocity()).lengthSquared()>.01 ||
+           (updatedValue.getAxisOfRotation()*updatedValue.getAngularSpeed()
+            -predictedValue.getAxisOfRotation()*predictedValue.getAngularSpeed()).lengthSquared()>.01;
+}
+
+Loc::ObjectState::ObjectState(const Time&t,const Location&location,const GridCell&cell)
+ : mLocation(location),
+   mUpdateTime(t),
+   mSent(Duration::seconds(.1),t,location,UpdateNeeded()),
+   mWithheld(false),
+   mReset(false),
+   mPendingUpdates(0),
+   mPendingFlags(0),
+   mCell(cell) {
+}
+
+Loc::Loc(Network::IOService*io):mRouter(NULL),mIO(io),mFlushScheduled(false){
     
 }
 
 Loc::~Loc() {
+    if (mFlushScheduled) {
+        Network::IOServiceFactory::cancelTimer(mIO,mFlushTimer);
+    }
+}
 
+Duration Loc::coalesceWindow() {
+    return Duration::seconds(sCoalesceWindow->as<double>());
 }
 
 bool Loc::forwardMessagesTo(MessageService*ms) {
@@ -57,44 +98,344 @@ bool Loc::endForwardingMessagesTo(MessageService*ms) {
     return true;
 }
 
+void Loc::routeUpdatesThrough(MessageService*router) {
+    mRouter=router;
+}
+
+Loc::GridCell Loc::cellContaining(const Vector3d&position) {
+    return GridCell((int32)std::floor(position.x/GRID_CELL_SIZE),
+                    (int32)std::floor(position.y/GRID_CELL_SIZE),
+                    (int32)std::floor(position.z/GRID_CELL_SIZE));
+}
+
 void Loc::processMessage(const ObjectReference&object_reference,const Protocol::ObjLoc&loc){
+    std::string serialized_loc;
+    loc.SerializeToString(&serialized_loc);
+    processMessage(object_reference,serialized_loc);
+}
+void Loc::processMessage(const ObjectReference&object_reference,const std::string&serialized_loc){
     RoutableMessageBody body;
-    ;
-    loc.SerializeToString(body.add_message(std::string()));
+    body.add_message(std::string(),serialized_loc);
     std::string message_body;
     body.SerializeToString(&message_body);
     RoutableMessageHeader destination_header;
     destination_header.set_source_object(ObjectReference::spaceServiceID());
     destination_header.set_source_port(Services::LOC);
     destination_header.set_destination_object(object_reference);
-    
+    //services downstream use body rather than decoding message_body again
+    ParsedRoutableMessage update(destination_header,MemoryReference(message_body),body);
     for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
-        (*i)->processMessage(destination_header,MemoryReference(message_body));
+        (*i)->processParsedMessage(update);
     }
    
 }
-void Loc::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+
+void Loc::updateLocation(const ObjectReference&object_reference,const Protocol::ObjLoc&loc,const std::string*serialized_loc,bool reset) {
+    Time t=loc.has_timestamp()?Time(loc.timestamp()):Time::now();
+    ObjectMap::iterator where=mObjects.find(object_reference);
+    Location location;
+    if (where==mObjects.end()) {
+        location=Location(Vector3d(0,0,0),Quaternion(Quaternion::identity()),
+                          Vector3f(0,0,0),Vector3f(0,1,0),0);
+    }else {
+        location=where->second.mLocation.extrapolate(t-where->second.mUpdateTime);
+    }
+    if (loc.has_position()) {
+        location.setPosition(loc.position());
+    }
+    if (loc.has_orientation()) {
+        location.setOrientation(loc.orientation());
+    }
+    if (loc.has_velocity()) {
+        location.setVelocity(loc.velocity());
+    }
+    if (loc.has_rotational_axis()) {
+        location.setAxisOfRotation(loc.rotational_axis());
+    }
+    if (loc.has_angular_speed()) {
+        location.setAngularSpeed(loc.angular_speed());
+    }
+    GridCell cell=cellContaining(location.getPosition());
+    bool changedCell=true;
+    if (where==mObjects.end()) {
+        where=mObjects.insert(ObjectMap::value_type(object_reference,ObjectState(t,location,cell))).first;
+        mCells[cell].mObjects.insert(object_reference);
+        reset=true;
+    }else {
+        ObjectState&state=where->second;
+        state.mLocation=location;
+        state.mUpdateTime=t;
+        if (!(state.mCell==cell)) {
+            CellMap::iterator old=mCells.find(state.mCell);
+            if (old!=mCells.end()) {
+                old->second.mObjects.erase(object_reference);
+                if (old->second.mObjects.empty()&&old->second.mQueries.empty())
+                    mCells.erase(old);
+            }
+            mCells[cell].mObjects.insert(object_reference);
+            state.mCell=cell;
+        }else {
+            changedCell=false;
+        }
+    }
+    //queries centered on this object move with it: they cover a cell more than they need to so this only matters on changing cells
+    for (QueryMap::iterator i=mQueries.lower_bound(QueryKey(object_reference,0));changedCell&&i!=mQueries.end()&&i->first.first==object_reference;++i) {
+        if (i->second.mRelative) {
+            placeQuery(i->first,i->second);
+        }
+    }
+    ObjectState&state=where->second;
+    if (loc.has_update_flags()) {
+        state.mPendingFlags|=loc.update_flags();
+        reset=reset||(loc.update_flags()&Protocol::ObjLoc::FORCE);
+    }
+    state.mReset=state.mReset||reset;
+    if (state.mPendingUpdates++==0) {
+        mPendingObjects.push_back(object_reference);
+        if (serialized_loc)
+            state.mPendingLoc=*serialized_loc;
+    }
+    if (!mFlushScheduled) {
+        mFlushScheduled=true;
+        mFlushTimer=Network::IOServiceFactory::scheduleTimer(mIO,coalesceWindow(),std::tr1::bind(&Loc::flushUpdates,this));
+    }
+}
+
+void Loc::flushUpdates() {
+    mFlushScheduled=false;
+    mFlushing.swap(mPendingObjects);
+    for (std::vector<ObjectReference>::iterator i=mFlushing.begin(),ie=mFlushing.end();i!=ie;++i) {
+        ObjectMap::iterator where=mObjects.find(*i);
+        if (where!=mObjects.end()&&where->second.mPendingUpdates) {
+            sendUpdates(*i,where->second);
+        }
+    }
+    //clear keeps the capacity for the next flush
+    mFlushing.clear();
+}
+
+void Loc::sendUpdates(const ObjectReference&object_reference,ObjectState&state) {
+    //a lone update the object sent is passed on as it came
+    bool as_sent=state.mPendingUpdates==1&&!state.mWithheld&&!state.mPendingLoc.empty();
+    state.mPendingUpdates=0;
+    const Location&location=state.mLocation;
+    if (state.mReset) {
+        state.mSent.resetValue(state.mUpdateTime,location);
+        state.mReset=false;
+    }else if (state.mSent.needsUpdate(state.mUpdateTime,location)) {
+        state.mSent.updateValue(state.mUpdateTime,location);
+    }else {
+        state.mWithheld=true;
+        state.mPendingLoc.clear();
+        return;
+    }
+    if (!as_sent) {
+        //several updates were folded together or receivers missed some fields along the way, so give them everything
+        Protocol::ObjLoc objLoc;
+        objLoc.set_timestamp(state.mUpdateTime);
+        objLoc.set_position(location.getPosition());
+        objLoc.set_orientation(location.getOrientation());
+        objLoc.set_velocity(location.getVelocity());
+        objLoc.set_rotational_axis(location.getAxisOfRotation());
+        objLoc.set_angular_speed(location.getAngularSpeed());
+        if (state.mPendingFlags)
+            objLoc.set_update_flags(state.mPendingFlags);
+        state.mPendingLoc.clear();
+        objLoc.SerializeToString(&state.mPendingLoc);
+    }
+    state.mWithheld=false;
+    state.mPendingFlags=0;
+    processMessage(object_reference,state.mPendingLoc);
+    notifySubscribers(object_reference,location.getPosition(),state.mPendingLoc);
+    state.mPendingLoc.clear();
+}
+
+bool Loc::queryCenter(const QueryKey&key,const Query&query,Vector3d&center)const {
+    if (!query.mRelative) {
+        center=query.mCenter;
+        return true;
+    }
+    ObjectMap::const_iterator subscriber=mObjects.find(key.first);
+    if (subscriber==mObjects.end())
+        return false;
+    center=subscriber->second.mLocation.getPosition()+query.mCenter;
+    return true;
+}
+
+void Loc::notifySubscribers(const ObjectReference&object,const Vector3d&position,const std::string&serialized_loc) {
+    std::set<ObjectReference> subscribers;
+    const std::set<QueryKey>*candidates[2]={&mUnboundedQueries,NULL};
+    CellMap::iterator cell=mCells.find(cellContaining(position));
+    if (cell!=mCells.end())
+        candidates[1]=&cell->second.mQueries;
+    for (int c=0;c<2&&candidates[c];++c) {
+        for (std::set<QueryKey>::const_iterator i=candidates[c]->begin(),ie=candidates[c]->end();i!=ie;++i) {
+            QueryMap::iterator query=mQueries.find(*i);
+            Vector3d center;
+            if (!(i->first==object)&&query!=mQueries.end()&&queryCenter(*i,query->second,center)
+                &&(position-center).lengthSquared()<=(float64)query->second.mRadius*query->second.mRadius) {
+                subscribers.insert(i->first);
+            }
+        }
+    }
+    for (std::set<ObjectReference>::iterator i=subscribers.begin(),ie=subscribers.end();i!=ie;++i) {
+        sendUpdate(*i,object,serialized_loc);
+    }
+}
+
+void Loc::sendUpdate(const ObjectReference&subscriber,const ObjectReference&object,const std::string&serialized_loc) {
+    if (!mRouter)
+        return;
     RoutableMessageBody body;
-    if (body.ParseFromArray(message_body.data(),message_body.size())) {
+    body.add_message("ObjLoc",serialized_loc);
+    std::string message_body;
+    body.SerializeToString(&message_body);
+    RoutableMessageHeader destination_header;
+    destination_header.set_source_object(object);
+    destination_header.set_source_port(Services::LOC);
+    destination_header.set_destination_object(subscriber);
+    destination_header.set_destination_port(Services::LOC);
+    ParsedRoutableMessage update(destination_header,MemoryReference(message_body),body);
+    mRouter->processParsedMessage(update);
+}
+
+void Loc::sendContents(const ObjectReference&subscriber,const Query&query) {
+    Vector3d center;
+    if (!queryCenter(QueryKey(subscriber,0),query,center))
+        return;
+    float64 radiusSquared=(float64)query.mRadius*query.mRadius;
+    for (ObjectMap::iterator i=mObjects.begin(),ie=mObjects.end();i!=ie;++i) {
+        if (!(i->first==subscriber)&&(i->second.mLocation.getPosition()-center).lengthSquared()<=radiusSquared) {
+            const Location&location=i->second.mSent.lastValue();
+            Protocol::ObjLoc objLoc;
+            objLoc.set_timestamp(i->second.mSent.lastUpdateTime());
+            objLoc.set_position(location.getPosition());
+            objLoc.set_orientation(location.getOrientation());
+            objLoc.set_velocity(location.getVelocity());
+            objLoc.set_rotational_axis(location.getAxisOfRotation());
+            objLoc.set_angular_speed(location.getAngularSpeed());
+            std::string serialized_loc;
+            objLoc.SerializeToString(&serialized_loc);
+            sendUpdate(subscriber,i->first,serialized_loc);
+        }
+    }
+}
+
+void Loc::placeQuery(const QueryKey&key,Query&query) {
+    for (std::vector<GridCell>::iterator i=query.mCells.begin(),ie=query.mCells.end();i!=ie;++i) {
+        CellMap::iterator cell=mCells.find(*i);
+        if (cell!=mCells.end()) {
+            cell->second.mQueries.erase(key);
+            if (cell->second.mObjects.empty()&&cell->second.mQueries.empty())
+                mCells.erase(cell);
+        }
+    }
+    query.mCells.clear();
+    Vector3d center;
+    if (mUnboundedQueries.find(key)!=mUnboundedQueries.end()||!queryCenter(key,query,center))
+        return;
+    float64 padded=(float64)query.mRadius+GRID_CELL_SIZE;
+    Vector3d extent(padded,padded,padded);
+    GridCell low=cellContaining(center-extent);
+    GridCell high=cellContaining(center+extent);
+    for (int32 x=low.x;x<=high.x;++x) {
+        for (int32 y=low.y;y<=high.y;++y) {
+            for (int32 z=low.z;z<=high.z;++z) {
+                query.mCells.push_back(GridCell(x,y,z));
+                mCells[query.mCells.back()].mQueries.insert(key);
+            }
+        }
+    }
+}
+
+void Loc::newQuery(const ObjectReference&subscriber,const Protocol::NewProxQuery&newQuery) {
+    Query query;
+    query.mRelative=!newQuery.has_absolute_center();
+    query.mCenter=query.mRelative?Vector3d(newQuery.relative_center()):newQuery.absolute_center();
+    query.mRadius=newQuery.max_radius();
+    sendContents(subscriber,query);
+    if (newQuery.stateless())
+        return;
+    QueryKey key(subscriber,newQuery.query_id());
+    delQuery(key);
+    QueryMap::iterator where=mQueries.insert(QueryMap::value_type(key,query)).first;
+    //placeQuery pads the sphere by a cell on each side, and a padded extent of 2r+2*GRID_CELL_SIZE may touch one cell more than it spans
+    if (2*((float64)query.mRadius+GRID_CELL_SIZE)>(float64)GRID_CELL_SIZE*(MAX_QUERY_CELLS_PER_AXIS-1)) {
+        mUnboundedQueries.insert(key);
+    }
+    placeQuery(key,where->second);
+}
+
+void Loc::delQuery(const QueryKey&key) {
+    QueryMap::iterator where=mQueries.find(key);
+    if (where==mQueries.end())
+        return;
+    mUnboundedQueries.erase(key);
+    placeQuery(key,where->second);//unbounded now, so this only takes it out of its cells
+    mQueries.erase(where);
+}
+
+void Loc::removeObject(const ObjectReference&object_reference) {
+    ObjectMap::iterator where=mObjects.find(object_reference);
+    if (where==mObjects.end())
+        return;
+    for (QueryMap::iterator i=mQueries.lower_bound(QueryKey(object_reference,0));i!=mQueries.end()&&i->first.first==object_reference;) {
+        QueryKey key=(i++)->first;
+        delQuery(key);
+    }
+    CellMap::iterator cell=mCells.find(where->second.mCell);
+    if (cell!=mCells.end()) {
+        cell->second.mObjects.erase(object_reference);
+        if (cell->second.mObjects.empty()&&cell->second.mQueries.empty())
+            mCells.erase(cell);
+    }
+    mObjects.erase(where);
+}
+
+void Loc::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    ParsedRoutableMessage parsed(header,message_body);
+    processParsedMessage(parsed);
+}
+void Loc::processParsedMessage(const ParsedRoutableMessage&message) {
+    const RoutableMessageHeader&header=message.header();
+    if (message.body()) {
+        const RoutableMessageBody&body=*message.body();
         int num_args=body.message_size();
         if (header.has_source_object()&&header.source_object()==ObjectReference::spaceServiceID()&&header.source_port()==Services::REGISTRATION) {
             for (int i=0;i<num_args;++i) {
-                if (body.message_size()==0||body.message_names(i)=="RetObj") {
+                if (body.message_names(i)=="RetObj") {
                     Protocol::RetObj retObj;
                     if (retObj.ParseFromString(body.message_arguments(i))&&retObj.has_location()) {
-                        processMessage(ObjectReference(retObj.object_reference()),retObj.location());
+                        updateLocation(ObjectReference(retObj.object_reference()),retObj.location(),NULL,true);
                     }else {
                         SILOG(loc,warning,"Loc:Unable to parse RetObj message body originating from "<<header.source_object());
                     }
+                }else if (body.message_names(i)=="DelObj") {
+                    Protocol::DelObj delObj;
+                    if (delObj.ParseFromString(body.message_arguments(i))&&delObj.has_object_reference()) {
+                        removeObject(ObjectReference(delObj.object_reference()));
+                    }
                 }
             }
         }else {
             for (int i=0;i<num_args;++i) {
-                Protocol::ObjLoc objLoc;
-                if (objLoc.ParseFromString(body.message_arguments(i))) {
-                    processMessage(ObjectReference(header.source_object()),objLoc);
-                }else {
-                    SILOG(loc,warning,"Loc:Unable to parse ObjLoc message body originating from "<<header.source_object());
+                if (body.message_names(i)=="NewProxQuery") {
+                    Protocol::NewProxQuery newProxQuery;
+                    if (newProxQuery.ParseFromString(body.message_arguments(i))) {
+                        newQuery(header.source_object(),newProxQuery);
+                    }
+                }else if (body.message_names(i)=="DelProxQuery") {
+                    Protocol::DelProxQuery delProxQuery;
+                    if (delProxQuery.ParseFromString(body.message_arguments(i))) {
+                        delQuery(QueryKey(header.source_object(),delProxQuery.query_id()));
+                    }
+                }else if (header.destination_port()==Services::LOC) {//queries bound for the proximity system are shown to Loc too, but nothing else on that port is a location
+                    Protocol::ObjLoc objLoc;
+                    if (objLoc.ParseFromString(body.message_arguments(i))) {
+                        updateLocation(ObjectReference(header.source_object()),objLoc,&body.message_arguments(i),false);//pass on the update as the object sent it
+                    }else {
+                        SILOG(loc,warning,"Loc:Unable to parse ObjLoc message body originating from "<<header.source_object());
+                    }
                 }
             }           
             
@@ -37,6 +37,7 @@
 #include "util/ObjectReference.hpp"
 #include "Space_Sirikata.pbj.hpp"
 #include "util/RoutableMessage.hpp"
+#include "util/ParsedRoutableMessage.hpp"
 #include "util/KnownServices.hpp"
 #include "space/Registration.hpp"
 #include "space/ObjectConnections.hpp"
@@ -65,33 +66,37 @@ void ObjectConnections::newStreamCallback(Network::Stream*stream, Network::Strea
         data.mStream=stream;
         mTemporaryStreams.insert(TemporaryStreamMultimap::value_type(temporaryId,data));//record this stream to the mTemporaryStreams
         using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
-        callbacks(std::tr1::bind(&ObjectConnections::connectionCallback,this,stream,_1,_2),
-                  std::tr1::bind(&ObjectConnections::bytesReceivedCallback,this,stream,_1));
+        callbacks.setReferenceCallbacks(std::tr1::bind(&ObjectConnections::connectionCallback,this,stream,_1,_2),
+                                        std::tr1::bind(&ObjectConnections::bytesReferenceReceivedCallback,this,stream,_1,_2));
     }else{
         //whole object host has disconnected
     }
 }
 void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Network::Chunk&chunk) {
+    MemoryReference chunkRef(chunk);
+    Network::Stream::CopyReceivedBuffer buffer(chunkRef);
+    bytesReferenceReceivedCallback(stream,chunkRef,buffer);
+}
+void ObjectConnections::bytesReferenceReceivedCallback(Network::Stream*stream, MemoryReference chunk, Network::Stream::ReceivedBuffer&buffer) {
     //find the temporary stream ID and connected boolean
     std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where=mStreams.find(stream);
     RoutableMessageHeader hdr;
-    MemoryReference chunkRef(chunk);//parse header
-    MemoryReference message_body=hdr.ParseFromArray(chunkRef.data(),chunkRef.size());
+    //parse header in place: the bytes are only copied if they have to wait in mPendingMessages
+    MemoryReference message_body=hdr.ParseFromArray(chunk.data(),chunk.size());
     //munge header to reflect known ID
     hdr.set_source_object(ObjectReference(where->second.uuid()));
+    ParsedRoutableMessage parsed(hdr,message_body);
     if (false&&((!hdr.has_destination_object())||hdr.destination_object()==ObjectReference::null())&&message_body.size()==0) {
         //if our message is size 0 and header nowhere or to null(), assume it's the object host request for service addresses
         stream->send(MemoryReference(mSpaceServiceIntroductionMessage),Network::ReliableOrdered);//send the tuned packet with all information needed to know services
     }else if (hdr.has_destination_object()&&hdr.destination_object()==ObjectReference::spaceServiceID()&&hdr.destination_port()==Services::REGISTRATION) {
         //this is a NewObj request Parse the body to find out
-        RoutableMessageBody rmb;
-        bool success=rmb.ParseFromArray(message_body.data(),message_body.size());
-        Protocol::RetObj ro;
-        if (success) {
+        const RoutableMessageBody *rmb=parsed.body();//decoded once here and reused by the registration service
+        if (rmb) {
             bool connection=false;
             int i;
-            for (i=0;i<rmb.message_size();++i){
-                connection=connection||(rmb.message_names(i)=="NewObj");
+            for (i=0;i<rmb->message_size();++i){
+                connection=connection||(rmb->message_names(i)=="NewObj");
             }
             if (connection) {
                 where->second.setConnecting();
@@ -99,7 +104,7 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
             //let a connection request through to the registration service
             if (connection||where->second.connected()) {
                 if (mSpace) {
-                    mSpace->processMessage(hdr,MemoryReference(message_body));
+                    mSpace->processParsedMessage(parsed);
                 } else {
                     SILOG(space,warning,"Dropping registration message from "<<where->second.uuid().toString()<<" because forwardMessagesTo was not called");
                 }
@@ -109,15 +114,20 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
                     if (twhere->second.mTotalMessageSize+chunk.size()<mPerObjectTemporarySizeMaximum
                         &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
                         twhere->second.mTotalMessageSize+=chunk.size();//annotate size
-                        twhere->second.mPendingMessages.push_back(chunk);//push back to array
+                        twhere->second.mPendingMessages.push_back(Network::Chunk());//push back to array
+                        buffer.take(twhere->second.mPendingMessages.back());
                     }
                 }else{
                     SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
                 }
             }
         }
-    } else if (where->second.connected()) {//ordinary message to connected object
-        processExistingObject(hdr, message_body, true); // forward set to true for now....
+    } else if (where->second.connected()) {//ordinary message from a connected object
+        if (mSpace) {
+            mSpace->processParsedMessage(parsed);//the space hands it to one of its services or to the router
+        }else {
+            processExistingObject(hdr, message_body, true); // forward set to true for now....
+        }
     } else {//Not sure if we should verify that a connection request is going through,
             // or if we should just find the size of bytes saved and cap that reasonably
             // this check would have verified a good faith effort to start connecting if (where->second.isConnecting()) {
@@ -126,7 +136,8 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
             if (twhere->second.mTotalMessageSize<mPerObjectTemporarySizeMaximum
                 &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
                 twhere->second.mTotalMessageSize+=chunk.size();//annotate size
-                twhere->second.mPendingMessages.push_back(chunk);//push back to array
+                twhere->second.mPendingMessages.push_back(Network::Chunk());//push back to array
+                buffer.take(twhere->second.mPendingMessages.back());
             }
         }else{
             SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
@@ -146,7 +157,8 @@ void ObjectConnections::forgeDisconnectionMessage(const ObjectReference&ref) {
     std::string serialized_message_body;
     rm.body().SerializeToString(&serialized_message_body);
     if (mSpace) {
-        mSpace->processMessage(rm.header(),MemoryReference(serialized_message_body));//tell the space to forward the message to the registration service
+        ParsedRoutableMessage parsed(rm.header(),MemoryReference(serialized_message_body),rm.body());
+        mSpace->processParsedMessage(parsed);//tell the space to forward the message to the registration service
     }
 }
 void ObjectConnections::connectionCallback(Network::Stream*stream, Network::Stream::ConnectionStatus status, const std::string&reason){
@@ -234,12 +246,18 @@ bool ObjectConnections::endForwardingMessagesTo(MessageService*ms) {
 
 void ObjectConnections::processMessage(const RoutableMessageHeader&header,
                     MemoryReference message_body){
+    ParsedRoutableMessage parsed(header,message_body);
+    processParsedMessage(parsed);
+}
+
+void ObjectConnections::processParsedMessage(const ParsedRoutableMessage&message){
+    const RoutableMessageHeader&header=message.header();
     RoutableMessageHeader newHeader;
     const RoutableMessageHeader *hdr=&header;
     bool disconnectionAttempt=false;
     if (header.has_source_object()&&header.source_object()==ObjectReference::spaceServiceID()&&header.source_port()==Services::REGISTRATION) {//message from registration service
         ObjectReference newRef;
-        if (processNewObject(header,message_body,newRef)) {//it could be a new object
+        if (processNewObject(message,newRef)) {//it could be a new object
             newHeader=header;
             newHeader.set_destination_object(newRef);//it is a new object complete with a permanent ObjectReference...make a new Header
             hdr=&newHeader;//set the hdr pointer to the new header
@@ -247,7 +265,7 @@ void ObjectConnections::processMessage(const RoutableMessageHeader&header,
             disconnectionAttempt=true;//it was a forcable disconnection (potentially at user request)
         }
     }
-    processExistingObject(*hdr,message_body,!disconnectionAttempt);//process the message but do not forward a disconnection attempt if stream is nonexistant
+    processExistingObject(*hdr,message.bodyBytes(),!disconnectionAttempt);//process the message but do not forward a disconnection attempt if stream is nonexistant
     if (disconnectionAttempt) {//Server ban of user, or confirm of disconnect
         shutdownConnection(header.destination_object());//destroy stream if destination object was forcably removed by space
     }
@@ -289,11 +307,12 @@ void ObjectConnections::shutdownConnection(const ObjectReference&ref) {
     }
 }
 
-bool ObjectConnections::processNewObject(const RoutableMessageHeader&hdr,MemoryReference body_array, ObjectReference&newRef) {
+bool ObjectConnections::processNewObject(const ParsedRoutableMessage&message, ObjectReference&newRef) {
     bool new_object=false;
-    RoutableMessageBody rmb;
+    const RoutableMessageHeader&hdr=message.header();
     if (hdr.has_destination_object()) {//destination_object is the temporary UUID given for pending connecting objects
-        if (rmb.ParseFromArray(body_array.data(),body_array.size())) {
+        if (message.body()) {
+            const RoutableMessageBody&rmb=*message.body();
             if (rmb.message_size()) {
                 if (rmb.message_names(0)=="RetObj") {//make sure the name of the message is RetObj so it contains the ID
                     Protocol::RetObj ro;
@@ -33,6 +33,7 @@
 #include <space/Registration.hpp>
 #include <Space_Sirikata.pbj.hpp>
 #include <util/RoutableMessage.hpp>
+#include <util/ParsedRoutableMessage.hpp>
 #include <util/KnownServices.hpp>
 namespace Sirikata {
 
@@ -58,19 +59,25 @@ bool Registration::endForwardingMessagesTo(MessageService*ms) {
 }
 
 void Registration::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
-    RoutableMessageBody body;
-    if (body.ParseFromArray(message_body.data(),message_body.size())) {
-        asyncRegister(header,body);
+    ParsedRoutableMessage parsed(header,message_body);
+    processParsedMessage(parsed);
+}
+void Registration::processParsedMessage(const ParsedRoutableMessage&message) {
+    if (message.body()) {
+        asyncRegister(message);
     }else{
-        SILOG(registration,warning,"Unable to parse message body from message originating from "<<header.source_object());        
+        SILOG(registration,warning,"Unable to parse message body from message originating from "<<message.header().source_object());        
     }
 }
-void Registration::asyncRegister(const RoutableMessageHeader&header,const RoutableMessageBody& body) {
+void Registration::asyncRegister(const ParsedRoutableMessage&message) {
+    const RoutableMessageHeader&header=message.header();
+    const RoutableMessageBody&body=*message.body();
     RoutableMessageBody retval;
     //for now do so synchronously in a very short-sighted manner.
     int num_messages=body.message_size();
     for (int i=0;i<num_messages;++i) {
         if (body.message_names(i)=="NewObj") {
+            retval.clear_message();//each reply carries just its own RetObj, and clearing keeps the storage for the next
             Protocol::NewObj newObj;
             newObj.ParseFromString(body.message_arguments(i));
             if (newObj.has_requested_object_loc()&&newObj.has_bounding_sphere()) {
@@ -80,9 +87,8 @@ void Registration::asyncRegister(const RoutableMessageHeader&header,const Routab
                 std::memcpy(evidence+SHA256::static_size,private_object_evidence.getArray().begin(),UUID::static_size);
                 RoutableMessageHeader destination_header;
                 Protocol::RetObj retObj;
-                std::string obj_loc_string;
-                newObj.requested_object_loc().SerializeToString(&obj_loc_string);
-                retObj.mutable_location().ParseFromString(obj_loc_string);
+                newObj.requested_object_loc().SerializeToString(&mLocationBuffer);
+                retObj.mutable_location().ParseFromString(mLocationBuffer);
                 retObj.set_bounding_sphere(newObj.bounding_sphere());
                 if (private_object_evidence.getArray()[0]==private_object_evidence.getArray()[1]&&
                     private_object_evidence.getArray()[1]==private_object_evidence.getArray()[2]&&
@@ -112,11 +118,18 @@ void Registration::asyncRegister(const RoutableMessageHeader&header,const Routab
                     destination_header.set_reply_id(header.id());
                 }
                 retObj.SerializeToString(retval.add_message("RetObj"));
+                //take mReplyBuffer while the services look at the reply in case one of them registers another object
                 std::string return_message;
+                return_message.swap(mReplyBuffer);
                 retval.SerializeToString(&return_message);
-                for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
-                    (*i)->processMessage(destination_header,MemoryReference(return_message));
+                {
+                    ParsedRoutableMessage reply(destination_header,MemoryReference(return_message),retval);
+                    for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
+                        (*i)->processParsedMessage(reply);
+                    }
                 }
+                return_message.clear();
+                mReplyBuffer.swap(return_message);
             }else {
                 SILOG(registration,warning,"Insufficient information in NewObj request"<<body.message_names(i));
             }
@@ -129,11 +142,11 @@ void Registration::asyncRegister(const RoutableMessageHeader&header,const Routab
                     destination_header.set_destination_object(ObjectReference(delObj.object_reference()));
                     destination_header.set_source_object(ObjectReference::spaceServiceID());
                     destination_header.set_source_port(Services::REGISTRATION);
+                    //the deletion goes out as it came in
+                    ParsedRoutableMessage deletion(destination_header,message.bodyBytes(),body);
                     for (std::vector<MessageService*>::reverse_iterator i=mServices.rbegin(),ie=mServices.rend();i!=ie;++i) {
-                        std::string body_string;
-                        body.SerializeToString(&body_string);
-                        (*i)->processMessage(destination_header,MemoryReference(body_string));
-                    }                    
+                        (*i)->processParsedMessage(deletion);
+                    }
                 }
             }
         }else {
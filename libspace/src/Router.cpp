@@ -0,0 +1,106 @@
+/*  Sirikata libspace -- Object Message Router
+ *  Router.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <space/Platform.hpp>
+#include <network/Stream.hpp>
+#include <network/StreamListener.hpp>
+#include <util/RoutableMessage.hpp>
+#include <space/ObjectConnections.hpp>
+#include <space/Router.hpp>
+namespace Sirikata {
+
+Router::Router(ObjectConnections*objectConnections, Network::IOService*io)
+    : mObjectConnections(objectConnections),mIO(io),mFlushScheduled(false) {
+}
+
+Router::~Router() {
+    if (mFlushScheduled) {
+        Network::IOServiceFactory::cancelTimer(mIO,mFlushTimer);
+    }
+}
+
+void Router::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    if (!header.has_destination_object()) {
+        SILOG(space,warning,"Router: null destination object for message with source "<<header.source_object().toString());
+        return;
+    }
+    PendingMessages &pending=mDestinations[header.destination_object()];
+    RoutableMessageHeader hdr(header);
+    hdr.clear_destination_object();//the stream already says who it is for
+    hdr.AppendToString(&pending.mData);
+    pending.mData.append((const char*)message_body.data(),message_body.size());
+    pending.mEnds.push_back(pending.mData.size());
+    pending.mRecentlyUsed=true;
+    if (pending.mData.size()>=MAX_PENDING_BYTES) {
+        flushDestination(header.destination_object(),pending);
+    }else if (!mFlushScheduled) {
+        mFlushScheduled=true;
+        mFlushTimer=Network::IOServiceFactory::scheduleTimer(mIO,Duration::zero(),std::tr1::bind(&Router::flushAll,this));
+    }
+}
+
+void Router::flushDestination(const ObjectReference&destination, PendingMessages&pending) {
+    if (pending.mEnds.empty()) {
+        return;
+    }
+    Network::Stream *stream=mObjectConnections->activeConnectionTo(destination);
+    if (stream) {
+        mBatch.clear();
+        size_t begin=0;
+        for (std::vector<size_t>::const_iterator i=pending.mEnds.begin(),ie=pending.mEnds.end();i!=ie;++i) {
+            mBatch.push_back(MemoryReference(pending.mData.data()+begin,*i-begin));
+            begin=*i;
+        }
+        stream->sendBatch(&mBatch[0],mBatch.size(),Network::ReliableOrdered);
+    }else {
+        SILOG(space,warning,"Router: dropping "<<pending.mEnds.size()<<" messages to unconnected object "<<destination.toString());
+    }
+    //clear keeps the capacity for the next batch
+    pending.mData.clear();
+    pending.mEnds.clear();
+}
+
+void Router::flushAll() {
+    mFlushScheduled=false;
+    for (DestinationMap::iterator i=mDestinations.begin();i!=mDestinations.end();) {
+        if (i->second.mRecentlyUsed) {
+            flushDestination(i->first,i->second);
+            i->second.mRecentlyUsed=false;
+            ++i;
+        }else {
+            mDestinations.erase(i++);
+        }
+    }
+}
+
+} // namespace Sirikata
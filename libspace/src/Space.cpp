@@ -40,6 +40,7 @@
 #include <space/ObjectConnections.hpp>
 #include <Space_Sirikata.pbj.hpp>
 #include <util/RoutableMessage.hpp>
+#include <util/ParsedRoutableMessage.hpp>
 #include <util/KnownServices.hpp>
 #include <proximity/Platform.hpp>
 #include <proximity/ProximitySystem.hpp>
@@ -71,10 +72,10 @@ Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOServ
     spaceServices.set_router_port(fsi);//UUID(fsi,sizeof(fsi)));
     
     mRegistration = new Registration(SHA256::convertFromBinary(randomKey));
-    mLoc=new Loc;
+    Loc*loc=new Loc(mIO);
+    mLoc=loc;
     Proximity::ProximityConnection*proxCon=Proximity::ProximityConnectionFactory::getSingleton().getDefaultConstructor()(mIO,"");
     mGeom=new Proximity::BridgeProximitySystem(proxCon,spaceServices.registration_port());
-    mRouter=NULL;
     mCoordinateSegmentation=NULL;
     mObjectSegmentation=NULL;
     String port="5943";
@@ -85,6 +86,8 @@ Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOServ
                                              //spaceServicesString
                                              );
     mObjectConnections->forwardMessagesTo(this);
+    mRouter=new Router(mObjectConnections,mIO);
+    loc->routeUpdatesThrough(mRouter);
     mServices[spaceServices.registration_port()]=mRegistration;
     mServices[spaceServices.loc_port()]=mLoc;
     mServices[spaceServices.geom_port()]=mGeom;
@@ -97,7 +100,6 @@ Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOServ
 
     mGeom->forwardMessagesTo(mObjectConnections);
     mLoc->forwardMessagesTo(mGeom);
-    mLoc->forwardMessagesTo(mObjectConnections);//FIXME: is this necessary
 }
 void Space::run() {
     Network::IOServiceFactory::runService(mIO);
@@ -109,19 +111,29 @@ void Space::processMessage(const ObjectReference*ref,MemoryReference message){
     if (!hdr.has_source_object()&&ref) {
         hdr.set_source_object(*ref);
     }
-    this->processMessage(hdr,message_body);
+    ParsedRoutableMessage parsed(hdr,message_body);
+    this->processParsedMessage(parsed);
 }
 
 void Space::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    ParsedRoutableMessage parsed(header,message_body);
+    this->processParsedMessage(parsed);
+}
+
+void Space::processParsedMessage(const ParsedRoutableMessage&message) {
+    const RoutableMessageHeader&header=message.header();
     if (header.destination_object()==ObjectReference::spaceServiceID()) {
         std::tr1::unordered_map<unsigned int,MessageService*>::iterator where=mServices.find(header.destination_port());
         if (where!=mServices.end()) {
-            where->second->processMessage(header,message_body);
+            where->second->processParsedMessage(message);
+            if (header.destination_port()==Services::GEOM) {
+                mLoc->processParsedMessage(message);//Loc keeps its own copy of the proximity queries to decide who hears about which moves
+            }
         }else {
             SILOG(space,warning,"Do not know where to forward space-destined message to "<<header.destination_port());
         }
     }else if (mRouter) {
-        mRouter->processMessage(header,message_body);
+        mRouter->processParsedMessage(message);
     }else {
         SILOG(space,warning,"Do not know where to forward message to "<<header.destination_object().toString());
     }
@@ -88,7 +88,7 @@ void SubscriptionState::registerSubscriber(const std::tr1::shared_ptr<Network::S
 
 
 void SubscriptionState::broadcast(Server*poll,const MemoryReference&data){
-    Time now=Time::now();
+    Time now=Time::coarseNow();
     std::vector<SubscriberTimePair> newUnsenders;
     if (mLatestSentTime<now||mLatestUnsentTime<now) {//there exists a completing queue
         Time latestSentTime=mLatestSentTime;
@@ -183,7 +183,7 @@ void SubscriptionState::Subscriber::broadcast(const MemoryReference&data){
     }
 }
 void SubscriptionState::poll(Server*parent) {
-    Time now=Time::now();
+    Time now=Time::coarseNow();
     while (!mUnsentSubscribersHeap.empty()) {
         SubscriberTimePair* iter=&mUnsentSubscribersHeap.front();
         if (mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
@@ -203,7 +203,7 @@ void SubscriptionState::poll(Server*parent) {
 }
 
 Time SubscriptionState::Subscriber::computeNextUpdateFromNow(){
-    return Time::now()+mPeriod;
+    return Time::coarseNow()+mPeriod;
 }
 
 